@@ -0,0 +1,254 @@
+/*
+ * Microbenchmark de PackBits: MB/s por kernel (scalar/sse2/avx2) del
+ * encoder y del decoder, en bloques de RLE2_BLOCK_SIZE como hace
+ * rle2_compress_stream. El decoder se compara además con
+ * packbits_decode_simple (un paquete cada vez, sin sobre-copia).
+ *
+ *   make bench && ./packbits_bench [archivo ...]
+ *
+ * Sin argumentos usa text_english.txt, binary.dat y un buffer sintético
+ * formado solo por runs.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "compressor.h"
+#include "packbits.h"
+
+#define MIN_BENCH_NS 300000000LL /* repetir al menos 0.3 s por kernel */
+
+static long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + (long long)ts.tv_nsec;
+}
+
+static uint8_t *load_file(const char *path, size_t *n)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f)
+    {
+        perror(path);
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    long sz = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *buf = (uint8_t *)malloc(sz > 0 ? (size_t)sz : 1);
+    if (!buf || fread(buf, 1, (size_t)sz, f) != (size_t)sz)
+    {
+        fprintf(stderr, "read failed: %s\n", path);
+        free(buf);
+        fclose(f);
+        return NULL;
+    }
+    fclose(f);
+    *n = (size_t)sz;
+    return buf;
+}
+
+/* Runs de longitud 1..300 de unos pocos valores */
+static uint8_t *make_all_runs(size_t n)
+{
+    uint8_t *buf = (uint8_t *)malloc(n);
+    if (!buf)
+        return NULL;
+    unsigned seed = 12345;
+    size_t i = 0;
+    while (i < n)
+    {
+        seed = seed * 1103515245u + 12345u;
+        size_t len = 3 + (seed >> 16) % 298;
+        uint8_t v = (uint8_t)((seed >> 8) & 0x3);
+        for (size_t t = 0; t < len && i < n; t++)
+            buf[i++] = v;
+    }
+    return buf;
+}
+
+static size_t encode_blocks(const uint8_t *in, size_t n, uint8_t *out)
+{
+    size_t o = 0;
+    for (size_t off = 0; off < n; off += RLE2_BLOCK_SIZE)
+    {
+        size_t len = (n - off > RLE2_BLOCK_SIZE) ? RLE2_BLOCK_SIZE : n - off;
+        o += packbits_encode_threshold(in + off, len, out + o, RLE2_RUN_THRESHOLD);
+    }
+    return o;
+}
+
+/* Decodifica bloque a bloque; cada bloque tiene exactamente la capacidad
+ * de su tamaño original, como en el formato revisión 1. */
+static int decode_blocks(int simple, const uint8_t *enc, const size_t *enc_len, size_t nblocks,
+                         uint8_t *out, size_t n)
+{
+    size_t e = 0;
+    for (size_t b = 0; b < nblocks; b++)
+    {
+        size_t off = b * RLE2_BLOCK_SIZE;
+        size_t cap = (n - off > RLE2_BLOCK_SIZE) ? RLE2_BLOCK_SIZE : n - off;
+        size_t got;
+        int rc = simple ? packbits_decode_simple(enc + e, enc_len[b], out + off, cap, &got)
+                        : packbits_decode(enc + e, enc_len[b], out + off, cap, &got);
+        if (rc != 0 || got != cap)
+            return 1;
+        e += enc_len[b];
+    }
+    return 0;
+}
+
+static int bench_decode(const char *label, const uint8_t *in, size_t n)
+{
+    static const char *kernels[] = {"simple", "scalar", "sse2", "avx2"};
+    size_t nblocks = (n + RLE2_BLOCK_SIZE - 1) / RLE2_BLOCK_SIZE;
+    uint8_t *enc = (uint8_t *)malloc(n * 2 + 16);
+    size_t *enc_len = (size_t *)malloc((nblocks ? nblocks : 1) * sizeof(size_t));
+    uint8_t *out = (uint8_t *)malloc(n ? n : 1);
+    if (!enc || !enc_len || !out)
+    {
+        fprintf(stderr, "malloc failed\n");
+        free(enc);
+        free(enc_len);
+        free(out);
+        return 1;
+    }
+
+    /* Se codifica todo como RLE (sin la decisión RAW) para medir el decoder */
+    packbits_set_kernel("scalar");
+    size_t e = 0;
+    for (size_t b = 0; b < nblocks; b++)
+    {
+        size_t off = b * RLE2_BLOCK_SIZE;
+        size_t len = (n - off > RLE2_BLOCK_SIZE) ? RLE2_BLOCK_SIZE : n - off;
+        enc_len[b] = packbits_encode_threshold(in + off, len, enc + e, RLE2_RUN_THRESHOLD);
+        e += enc_len[b];
+    }
+
+    int rc = 0;
+    for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++)
+    {
+        int simple = (k == 0);
+        if (!simple && !packbits_set_kernel(kernels[k]))
+        {
+            printf("%-20s  decode  %-6s  %10s\n", label, kernels[k], "n/a");
+            continue;
+        }
+
+        int bad = 0;
+        long long iters = 0, t0 = now_ns(), t1;
+        do
+        {
+            bad |= decode_blocks(simple, enc, enc_len, nblocks, out, n);
+            iters++;
+            t1 = now_ns();
+        } while (t1 - t0 < MIN_BENCH_NS);
+
+        int same = !bad && memcmp(out, in, n) == 0;
+        double mbps = (double)n * (double)iters / ((double)(t1 - t0) / 1e9) / (1024.0 * 1024.0);
+        printf("%-20s  decode  %-6s  %10.1f MB/s  %s\n", label, kernels[k], mbps,
+               same ? "round-trip ok" : "MISMATCH");
+        if (!same)
+            rc = 1;
+    }
+
+    free(enc);
+    free(enc_len);
+    free(out);
+    return rc;
+}
+
+static int bench_buffer(const char *label, const uint8_t *in, size_t n)
+{
+    static const char *kernels[] = {"scalar", "sse2", "avx2"};
+    uint8_t *ref = (uint8_t *)malloc(n * 2 + 16);
+    uint8_t *out = (uint8_t *)malloc(n * 2 + 16);
+    if (!ref || !out)
+    {
+        fprintf(stderr, "malloc failed\n");
+        free(ref);
+        free(out);
+        return 1;
+    }
+
+    packbits_set_kernel("scalar");
+    size_t ref_n = encode_blocks(in, n, ref);
+
+    int rc = 0;
+    for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++)
+    {
+        if (!packbits_set_kernel(kernels[k]))
+        {
+            printf("%-20s  encode  %-6s  %10s\n", label, kernels[k], "n/a");
+            continue;
+        }
+
+        size_t out_n = 0;
+        long long iters = 0, t0 = now_ns(), t1;
+        do
+        {
+            out_n = encode_blocks(in, n, out);
+            iters++;
+            t1 = now_ns();
+        } while (t1 - t0 < MIN_BENCH_NS);
+
+        int same = (out_n == ref_n && memcmp(out, ref, ref_n) == 0);
+        double mbps = (double)n * (double)iters / ((double)(t1 - t0) / 1e9) / (1024.0 * 1024.0);
+        printf("%-20s  encode  %-6s  %10.1f MB/s  ratio %6.3f  %s\n",
+               label, kernels[k], mbps, n ? (double)out_n / (double)n : 0.0,
+               same ? "identical" : "MISMATCH");
+        if (!same)
+            rc = 1;
+    }
+
+    free(ref);
+    free(out);
+    return rc | bench_decode(label, in, n);
+}
+
+int main(int argc, char *argv[])
+{
+    static const char *defaults[] = {
+        "examples/pruebas/text_english.txt",
+        "examples/pruebas/binary.dat",
+    };
+    int rc = 0;
+
+    printf("%-20s  %-6s  %-6s  %15s\n", "Input", "Op", "Kernel", "Throughput");
+
+    if (argc > 1)
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            size_t n;
+            uint8_t *buf = load_file(argv[i], &n);
+            if (!buf)
+                return 1;
+            const char *slash = strrchr(argv[i], '/');
+            rc |= bench_buffer(slash ? slash + 1 : argv[i], buf, n);
+            free(buf);
+        }
+        return rc;
+    }
+
+    for (size_t i = 0; i < sizeof(defaults) / sizeof(defaults[0]); i++)
+    {
+        size_t n;
+        uint8_t *buf = load_file(defaults[i], &n);
+        if (!buf)
+            return 1;
+        rc |= bench_buffer(strrchr(defaults[i], '/') + 1, buf, n);
+        free(buf);
+    }
+
+    size_t runs_n = 8 * 1024 * 1024;
+    uint8_t *runs = make_all_runs(runs_n);
+    if (!runs)
+        return 1;
+    rc |= bench_buffer("all-runs (8 MiB)", runs, runs_n);
+    free(runs);
+    return rc;
+}
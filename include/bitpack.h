@@ -0,0 +1,40 @@
+#ifndef BITPACK_H
+#define BITPACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Bit-packing codec for blocks with few distinct byte values.
+ * Payload layout:
+ *   n             u32 LE, decoded size
+ *   bits          u8, index width k (1..7)
+ *   nsym - 1      u8, symbols in the table (at most 2^k)
+ *   symbols       nsym bytes, the table
+ *   indices       n indices of k bits, LSB-first, packed 8 per k bytes
+ *                 (the last group only takes the bytes it needs)
+ */
+
+#define BITPACK_HEADER_SIZE 6
+#define BITPACK_MAX_SYMBOLS 128
+
+typedef struct
+{
+    unsigned bits;
+    unsigned nsym;
+    uint8_t symbols[BITPACK_MAX_SYMBOLS];
+    uint8_t index[256]; /* symbol -> index */
+    size_t size;        /* exact payload size */
+} BitpackPlan;
+
+/* Collects the distinct symbols of 'in'. Returns the payload size, or 0 if
+ * there are more than BITPACK_MAX_SYMBOLS (it stops reading early then). */
+size_t bitpack_plan(const uint8_t *in, size_t n, BitpackPlan *plan);
+
+/* Writes plan->size bytes to out */
+size_t bitpack_encode(const uint8_t *in, size_t n, const BitpackPlan *plan, uint8_t *out);
+
+/* Returns 0 on success, 1 on a corrupted payload or one larger than out_cap */
+int bitpack_decode(const uint8_t *in, size_t n, uint8_t *out, size_t out_cap, size_t *out_len);
+
+#endif /* BITPACK_H */
@@ -0,0 +1,31 @@
+#ifndef BLOCKSTAT_H
+#define BLOCKSTAT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Cheap pre-pass over a block, done before running any codec. It looks at
+ * a 1/8 sample (chunks spread over the whole block) and measures what the
+ * codecs live on: order-0 entropy (Huffman, bit-packing), runs (PackBits)
+ * and repeated 4-byte strings (LZ). The encoder uses it to skip codecs
+ * that cannot win, or the whole block when nothing can.
+ */
+
+typedef struct
+{
+    size_t sampled;      /* bytes looked at */
+    unsigned distinct;   /* distinct byte values in the sample */
+    unsigned entropy_q8; /* order-0 entropy, bits per byte x 256 (0..2048) */
+    size_t order0_size;  /* whole block coded at that entropy, in bytes */
+    size_t run_bytes;    /* sampled bytes inside runs of at least k_min_run */
+    size_t repeats;      /* sampled positions whose 4 bytes were seen before */
+} BlockStats;
+
+void blockstat_sample(const uint8_t *in, size_t n, int k_min_run, BlockStats *st);
+
+/* 1 if the sample has near-8-bit entropy, no runs and no repeats: no
+ * codec is expected to beat storing the block as is */
+int blockstat_incompressible(const BlockStats *st);
+
+#endif /* BLOCKSTAT_H */
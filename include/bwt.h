@@ -0,0 +1,30 @@
+#ifndef BWT_H
+#define BWT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Block-sorting codec: BWT -> move-to-front -> zero-run coding -> Huffman.
+ * Payload layout:
+ *   primary       u32 LE, row of the sorted rotations that holds the
+ *                 end-of-block marker
+ *   huffman       huffman.h payload of the MTF / zero-run symbols:
+ *                   0, 1      RUNA / RUNB, a run of MTF zeros in bijective
+ *                             base 2 (least significant digit first)
+ *                   2..254    MTF index 1..253
+ *                   255 b     MTF index 254 + b (b = 0 or 1)
+ * The transform is built from a suffix array (SA-IS, linear time).
+ * Both directions allocate their working memory (about 9n bytes to encode,
+ * 8n to decode).
+ */
+
+/* Returns the payload size, or 0 if it would not fit in out_cap bytes or
+ * memory ran out */
+size_t bwt_encode(const uint8_t *in, size_t n, uint8_t *out, size_t out_cap);
+
+/* Returns 0 on success, 1 on a corrupted payload, one larger than out_cap,
+ * or out of memory */
+int bwt_decode(const uint8_t *in, size_t n, uint8_t *out, size_t out_cap, size_t *out_len);
+
+#endif /* BWT_H */
@@ -1,12 +1,32 @@
 #ifndef CLI_H
 #define CLI_H
 
+#define CLI_MAX_INPUTS 256
+#define CLI_MAX_PATTERN 4096 // RLE2_GREP_MAX_PATTERN
+
 typedef struct
 {
     char operation[4]; // e.g. "-c", "-d", "-ce"
-    char *input_path;
+    char *input_path; // el primer -i
+    char *input_paths[CLI_MAX_INPUTS]; // -i repetido (solo -j y -g)
+    int input_count;
     char *output_path;
     char *key;
+    int threads; // --threads N (0 = auto)
+    int seekable; // --seekable: escribir contenedor v3 con indice
+    int has_range; // --range off:len (solo -d sobre un archivo)
+    unsigned long long range_offset;
+    unsigned long long range_length;
+    unsigned long long block_size; // --block-size N[K|M] (0 = por defecto)
+    int run_threshold; // --threshold K (0 = por defecto)
+    int codec; // --codec fast|bwt (0 = fast)
+    int max_ratio; // --max-ratio: parse óptimo de PackBits
+    int shuffle; // --shuffle auto|off|N (0 = auto, 1 = off, N = bytes por elemento)
+    char *dict_path; // --dict FILE: diccionario compartido (-t lo crea)
+    int sparse; // --sparse: huecos en la salida de -d en vez de ceros
+    int append; // --append: -c añade al final de un .rle existente
+    unsigned char pattern[CLI_MAX_PATTERN]; // --pattern TEXT para -g, ya sin escapes
+    int pattern_len; // 0 = sin --pattern
 } ProgramOptions;
 
 int parse_arguments(int argc, char *argv[], ProgramOptions *opts);
@@ -7,12 +7,126 @@
 /*
  * RLE2 (PackBits + threshold + RAW/RLE block)
  * RLE1 has been completely removed.
+ * RLE2 v3 ("RLE3") adds a footer block index for random access.
+ * Header revision 1 stores each block's uncompressed size, so the decoder
+ * can size its output exactly and bound every packet; revision 0 files
+ * are still decoded.
+ * A stored file is just the header (with the STORED flag) and the input
+ * as is, for data that no block codec would shrink.
+ * A file compressed with a shared dictionary (dict.h) records its ID in
+ * the header and needs the same dictionary to be decompressed.
  */
 
-int rle2_compress_stream(int fd_in, int fd_out);
-int rle2_decompress_stream(int fd_in, int fd_out);
+typedef struct RLE2Dict RLE2Dict; /* see dict.h */
 
-/* Tunables */
+/* Options for the RLE2 stream API */
+typedef struct
+{
+    int threads;       /* worker threads: 0 = auto (one per CPU), 1 = serial */
+    int seekable;      /* write the v3 container with a block index */
+    size_t block_size; /* bytes per block, power of two (recorded in the header) */
+    int run_threshold; /* min run length to emit RUN (recorded in the header) */
+    int codec;         /* RLE2_CODEC_*: which block encodings to try (not recorded,
+                          every block carries its own tag) */
+    int max_ratio;     /* PackBits blocks use the optimal parse instead of the
+                          greedy one (slower encoder, same decoder) */
+    int shuffle;       /* byte-shuffle element size: RLE2_SHUFFLE_AUTO, _OFF or
+                          2..RLE2_MAX_SHUFFLE to try that size on every block */
+    const RLE2Dict *dict; /* shared dictionary primed into every LZ block, or
+                             NULL; required again to decompress */
+    int sparse;        /* decompression into a regular file: zero-filled
+                          filesystem blocks are left as holes */
+} RLE2Options;
+
+void rle2_default_options(RLE2Options *opts);
+
+/* Returns 0 if block_size / run_threshold are usable, otherwise prints the
+ * problem to stderr and returns 1. */
+int rle2_validate_options(const RLE2Options *opts);
+
+/* opts may be NULL (defaults). With more than one thread the output is
+ * byte-identical to the serial encoder. Holes of a sparse regular file
+ * (SEEK_HOLE) are not read and all-zero blocks skip the codecs; the output
+ * is the same as for the zeros. */
+int rle2_compress_stream(int fd_in, int fd_out, const RLE2Options *opts);
+
+/* Writes a stored file: header and the rest of fd_in unchanged. Between
+ * regular files the copy is done by the kernel (copy_file_range). Every
+ * decoder below reads it back. */
+int rle2_store_stream(int fd_in, int fd_out);
+
+/* Parallel decompression needs regular files on both sides (pread/pwrite);
+ * otherwise, or with threads = 1, blocks are decoded serially. With
+ * opts->sparse the output is not written where it is all zeros (holes are
+ * punched if the file had data there) and its length is set with
+ * ftruncate. */
+int rle2_decompress_stream(int fd_in, int fd_out, const RLE2Options *opts);
+
+/* Compresses fd_in onto the end of an existing stream (fd_rle, opened
+ * read/write) without touching its blocks. The new blocks use the block
+ * size, run threshold and dictionary recorded in its header (opts gives
+ * the rest); a v3 index is rewritten to cover them. On failure fd_rle is
+ * left as it was. Only for streams where rle2_append_in_place is 1. */
+int rle2_append_stream(int fd_in, int fd_rle, const RLE2Options *opts);
+
+/* 1 if rle2_append_stream can extend fd_rle, 0 if it is a stored or
+ * revision 0 stream that rle2_append_rewrite has to copy first, -1 (with
+ * a message) if it is not an RLE2 stream. */
+int rle2_append_in_place(int fd_rle);
+
+/* Writes fd_rle's blocks to fd_out in the current format (without
+ * recompressing them) followed by fd_in compressed as rle2_append_stream
+ * would. fd_rle is not modified. The data of a stored stream becomes RAW
+ * blocks; the header and the new blocks then follow opts. */
+int rle2_append_rewrite(int fd_in, int fd_rle, int fd_out, const RLE2Options *opts);
+
+/* Joins streams into fd_out without decoding: their blocks are copied as
+ * is, in order, under a header like the first one's (a v3 first input
+ * gives a v3 output indexing every block). Stored inputs are framed as
+ * RAW blocks and revision 0 blocks get revision 1 headers (their sizes
+ * come from the packet headers). Inputs with blocks must share the same
+ * dictionary (or none). */
+int rle2_concat_streams(const int *fds, size_t count, int fd_out);
+
+/* Write uncompressed bytes [offset, offset + length) to fd_out. On a v3
+ * file only the overlapping blocks are read; plain RLE2 is decoded
+ * sequentially up to the end of the range. opts may be NULL (only its
+ * dictionary is used). */
+int rle2_extract_range(int fd_in, int fd_out, uint64_t offset, uint64_t length,
+                       const RLE2Options *opts);
+
+/* Search hits: 'count' matches at consecutive offsets from 'offset' (e.g.
+ * inside a run, which is never expanded) */
+typedef struct
+{
+    uint64_t offset; /* uncompressed offset */
+    uint64_t count;
+} RLE2Match;
+
+#define RLE2_GREP_MAX_PATTERN 4096
+
+/* Finds every occurrence of pat (overlapping ones too) in the uncompressed
+ * content of a stream without writing it anywhere. Blocks are searched in
+ * parallel (opts->threads; opts may be NULL): RAW payloads in place, run
+ * packets without expanding long runs, other codecs decoded in memory.
+ * *matches (sorted by offset, malloc'ed) must be freed by the caller. fd
+ * must be a regular file. */
+int rle2_grep_stream(int fd, const uint8_t *pat, size_t m, const RLE2Options *opts,
+                     RLE2Match **matches, size_t *count);
+
+/* Total uncompressed size of an in-memory RLE2/RLE3 stream.
+ * Returns 0 if known, 1 for a revision 0 stream (sizes not recorded) or a
+ * stored one (better copied by rle2_decompress_stream), -1 if the buffer
+ * is not an RLE2 stream, -2 if it is truncated. */
+int rle2_buffer_raw_size(const uint8_t *in, size_t n, uint64_t *total);
+
+/* Decode an in-memory revision >= 1 stream straight into dst (e.g. a
+ * memory-mapped output file) without intermediate copies. dst_cap must be
+ * at least the size given by rle2_buffer_raw_size. */
+int rle2_decompress_buffer(const uint8_t *in, size_t n, uint8_t *dst, size_t dst_cap,
+                           size_t *out_len, const RLE2Options *opts);
+
+/* Tunables (defaults for RLE2Options) */
 #ifndef RLE2_BLOCK_SIZE
 #define RLE2_BLOCK_SIZE (64 * 1024) /* 64 KiB blocks */
 #endif
@@ -21,4 +135,23 @@ int rle2_decompress_stream(int fd_in, int fd_out);
 #define RLE2_RUN_THRESHOLD 3 /* min run length to emit RUN */
 #endif
 
+#define RLE2_MIN_BLOCK_SIZE (4 * 1024)
+#define RLE2_MAX_BLOCK_SIZE (4 * 1024 * 1024)
+#define RLE2_MAX_RUN_THRESHOLD 128 /* a RUN packet holds at most 128 bytes */
+
+/* Codecs: FAST tries PackBits / LZ / Huffman per block; BWT also tries the
+ * block-sorting codec (best ratio, much slower, meant for cold archives) */
+#define RLE2_CODEC_FAST 0
+#define RLE2_CODEC_BWT 1
+#define RLE2_BWT_BLOCK_SIZE (1024 * 1024) /* default block size for RLE2_CODEC_BWT */
+
+/* Byte shuffle for arrays of numbers: AUTO detects 2/4/8-byte elements per
+ * block, OFF never tries it */
+#define RLE2_SHUFFLE_AUTO 0
+#define RLE2_SHUFFLE_OFF 1
+#define RLE2_MAX_SHUFFLE 16
+
+#define RLE2_MAX_THREADS 8                      /* cap for threads = 0 (auto) */
+#define RLE2_PARALLEL_THRESHOLD (1 * 1024 * 1024) /* smaller inputs stay serial */
+
 #endif /* COMPRESSOR_H */
@@ -0,0 +1,30 @@
+#ifndef DELTA_H
+#define DELTA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Stride-delta filter for arrays of fixed-size records: every byte is
+ * replaced by its difference (or XOR) with the byte one record earlier.
+ * Fields that change slowly from record to record become runs of small
+ * values. The first 'stride' bytes are kept as they are.
+ */
+
+#define DELTA_SUB 0 /* byte - byte one record earlier (mod 256) */
+#define DELTA_XOR 1 /* byte ^ byte one record earlier */
+
+#define DELTA_MAX_STRIDE 256
+
+/* Estimates the record size from the autocorrelation of a sample of buf:
+ * the lag with the most small byte differences. Returns the stride (and
+ * the better mode in *mode), or 0 if no lag looks like a record. */
+size_t delta_detect(const uint8_t *buf, size_t n, int *mode);
+
+/* Filters buf in place */
+void delta_encode(uint8_t *buf, size_t n, size_t stride, int mode);
+
+/* Exact inverse of delta_encode, in place */
+void delta_decode(uint8_t *buf, size_t n, size_t stride, int mode);
+
+#endif /* DELTA_H */
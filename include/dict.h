@@ -0,0 +1,43 @@
+#ifndef DICT_H
+#define DICT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "compressor.h"
+#include "lz.h"
+
+/*
+ * Shared dictionary for many small similar files (configs, logs, JSON).
+ * It is raw content: the strings that repeat across the samples, primed
+ * into the LZ window of every block so even a 2 KB file has history to
+ * match against. Its ID is a hash of the content; a compressed file
+ * records it and can only be decoded with the same dictionary.
+ *
+ * File: "RLED" + ID u32 LE + content (at most DICT_MAX_SIZE bytes).
+ */
+
+#define DICT_HEADER_SIZE 8
+#define DICT_MAX_SIZE LZ_MAX_DICT
+#define DICT_DEFAULT_SIZE (48 * 1024)
+
+struct RLE2Dict
+{
+    uint32_t id;
+    uint8_t *data;
+    size_t size;
+    LZDict *lz; /* encoder tables */
+};
+
+/* Trains a dictionary of at most 'size' bytes from 'count' samples stored
+ * back to back in 'data' (lengths in sizes[]). Returns NULL, with a
+ * message, if nothing repeats across samples. */
+RLE2Dict *dict_train(const uint8_t *data, const size_t *sizes, size_t count, size_t size);
+
+/* Prints the problem and returns NULL / non-zero on failure */
+RLE2Dict *dict_load(const char *path);
+int dict_save(const RLE2Dict *d, const char *path);
+
+void dict_free(RLE2Dict *d);
+
+#endif /* DICT_H */
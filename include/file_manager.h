@@ -4,6 +4,8 @@
 #include <sys/types.h>
 #include <limits.h>
 
+#include "compressor.h"
+
 // Ensure PATH_MAX is defined
 #ifndef PATH_MAX
 #ifdef __linux__
@@ -14,13 +16,37 @@
 #define PATH_MAX 4096
 #endif
 
-// Single-file RLE (no table)
-int compress_file_rle(const char *src, const char *dest);
-int decompress_file_rle(const char *src, const char *dest);
+// Single-file RLE (no table). opts may be NULL (defaults)
+int compress_file_rle(const char *src, const char *dest, const RLE2Options *opts);
+int decompress_file_rle(const char *src, const char *dest, const RLE2Options *opts);
+
+// Extract uncompressed bytes [offset, offset + length) from a .rle file
+int extract_range_rle(const char *src, const char *dest,
+                      unsigned long long offset, unsigned long long length,
+                      const RLE2Options *opts);
+
+// Compress src onto the end of the .rle file dest (created if missing)
+int append_file_rle(const char *src, const char *dest, const RLE2Options *opts);
+
+// Join .rle files, in order, into dest without recompressing. A single src
+// that is a directory joins its regular files in name order. *input_size
+// gets the bytes read
+int join_files_rle(const char *const *srcs, size_t count, const char *dest, off_t *input_size);
+
+// Print every occurrence of pat in the uncompressed content of .rle files
+// (path:offset, a run of matches as path:first-last) without decompressing
+// them to disk. A single src that is a directory searches its regular files.
+// One file is searched block-parallel, several are searched one per thread
+int grep_files_rle(const char *const *srcs, size_t count, const uint8_t *pat, size_t pat_len,
+                   const RLE2Options *opts);
+
+// Train a shared dictionary (dict.h) from the files in src_dir; *samples_size
+// gets the bytes sampled
+int train_dictionary_rle(const char *src_dir, const char *dict_path, off_t *samples_size);
 
 // Directory RLE (no table)
-int compress_directory_rle(const char *src_dir, const char *dest_dir);
-int decompress_directory_rle(const char *src_dir, const char *dest_dir);
+int compress_directory_rle(const char *src_dir, const char *dest_dir, const RLE2Options *opts);
+int decompress_directory_rle(const char *src_dir, const char *dest_dir, const RLE2Options *opts);
 
 // ===== Reporting structs and API =====
 typedef struct
@@ -33,11 +59,17 @@ typedef struct
 } FMResult;
 
 // Single-file with table report
-int compress_file_rle_with_report(const char *src, const char *dest);
-int decompress_file_rle_with_report(const char *src, const char *dest);
+int compress_file_rle_with_report(const char *src, const char *dest, const RLE2Options *opts);
+int decompress_file_rle_with_report(const char *src, const char *dest, const RLE2Options *opts);
+int extract_range_rle_with_report(const char *src, const char *dest,
+                                  unsigned long long offset, unsigned long long length,
+                                  const RLE2Options *opts);
+int append_file_rle_with_report(const char *src, const char *dest, const RLE2Options *opts);
+int join_files_with_report(const char *const *srcs, size_t count, const char *dest);
+int train_dictionary_with_report(const char *src_dir, const char *dict_path);
 
 // Directory (concurrent) with consolidated table report
-int compress_directory_rle_with_report(const char *src_dir, const char *dest_dir);
-int decompress_directory_rle_with_report(const char *src_dir, const char *dest_dir);
+int compress_directory_rle_with_report(const char *src_dir, const char *dest_dir, const RLE2Options *opts);
+int decompress_directory_rle_with_report(const char *src_dir, const char *dest_dir, const RLE2Options *opts);
 
 #endif // FILE_MANAGER_H
@@ -0,0 +1,40 @@
+#ifndef HUFFMAN_H
+#define HUFFMAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Order-0 Huffman block codec with 4 interleaved streams.
+ * Payload layout:
+ *   n             u32 LE, decoded size
+ *   code lengths  128 bytes, 4 bits per symbol (0 = unused), max HUFFMAN_MAX_BITS
+ *   stream sizes  3 x u32 LE (the 4th stream takes the rest of the payload)
+ *   streams       the input is split in 4 quarters of ceil(n/4) bytes, each
+ *                 one coded LSB-first into its own byte-aligned stream
+ * Codes are canonical, so only the lengths are stored.
+ */
+
+#define HUFFMAN_MAX_BITS 11
+#define HUFFMAN_STREAMS 4
+#define HUFFMAN_HEADER_SIZE (4 + 128 + 4 * (HUFFMAN_STREAMS - 1))
+
+typedef struct
+{
+    uint8_t len[256];
+    uint16_t code[256];                    /* canonical code, bit-reversed */
+    uint32_t stream_size[HUFFMAN_STREAMS]; /* bytes per stream */
+    size_t size;                           /* exact payload size */
+} HuffmanPlan;
+
+/* Histogram + code lengths for 'in'. Returns the exact encoded size, so
+ * callers can skip huffman_encode when it does not pay off. */
+size_t huffman_plan(const uint8_t *in, size_t n, HuffmanPlan *plan);
+
+/* Writes plan->size bytes to out */
+size_t huffman_encode(const uint8_t *in, size_t n, const HuffmanPlan *plan, uint8_t *out);
+
+/* Returns 0 on success, 1 on a corrupted payload or one larger than out_cap */
+int huffman_decode(const uint8_t *in, size_t n, uint8_t *out, size_t out_cap, size_t *out_len);
+
+#endif /* HUFFMAN_H */
@@ -0,0 +1,46 @@
+#ifndef IMGFILTER_H
+#define IMGFILTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Reversible PNG-style row predictors for uncompressed pixel data.
+ * Every row gets one filter type:
+ *   0 None, 1 Sub (left), 2 Up, 3 Average (left, up), 4 Paeth
+ * Bytes left of the first pixel and above the first row count as 0, so a
+ * run of rows can be filtered on its own (one RLE2 block at a time).
+ */
+
+#define IMGFILTER_NONE 0
+#define IMGFILTER_SUB 1
+#define IMGFILTER_UP 2
+#define IMGFILTER_AVERAGE 3
+#define IMGFILTER_PAETH 4
+#define IMGFILTER_TYPES 5
+
+#define IMGFILTER_MAX_BPP 8
+
+/* Pixel rows found in a file header */
+typedef struct
+{
+    uint64_t offset; /* first pixel byte in the file */
+    size_t stride;   /* bytes per row, padding included (0 = not an image) */
+    uint64_t rows;
+    int bpp;         /* bytes per pixel */
+} ImageLayout;
+
+/* Recognizes 24/32-bit uncompressed BMP and binary PGM/PPM (8-bit) from the
+ * first bytes of a file. Returns 1 and fills img if found, 0 otherwise. */
+int imgfilter_sniff(const uint8_t *buf, size_t n, ImageLayout *img);
+
+/* Filters 'rows' rows of 'stride' bytes in place, choosing per row the type
+ * with the smallest sum of absolute residuals. Writes one type per row.
+ * Returns 1 if memory ran out (buf is then unchanged). */
+int imgfilter_encode(uint8_t *buf, size_t stride, size_t rows, int bpp, uint8_t *types);
+
+/* Exact inverse of imgfilter_encode, in place. Returns 1 on an unknown
+ * filter type. */
+int imgfilter_decode(uint8_t *buf, size_t stride, size_t rows, int bpp, const uint8_t *types);
+
+#endif /* IMGFILTER_H */
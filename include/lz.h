@@ -0,0 +1,55 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * LZ4-style byte-aligned LZ77 block codec (64 KiB window).
+ * Payload: a list of sequences
+ *   token         1 byte: literal count (high nibble), match length - 4 (low)
+ *                 a nibble of 15 is followed by extra bytes of 255 and a
+ *                 final byte < 255, all added to the count
+ *   literals      'literal count' bytes
+ *   offset        u16 LE, 1..65535 bytes back into the decoded output
+ *   match length  extra bytes when the low nibble is 15
+ * The last sequence has literals only (no offset), possibly zero of them.
+ *
+ * With a dictionary the window starts in its last bytes: an offset larger
+ * than the output decoded so far points back into the dictionary, and the
+ * match may run on into the output. Encoder and decoder must use the same
+ * dictionary.
+ */
+
+#define LZ_WINDOW 65536
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 14
+#define LZ_HASH_SIZE (1u << LZ_HASH_BITS)
+#define LZ_MAX_DICT (LZ_WINDOW - 1) /* only this many trailing bytes are reachable */
+
+/* Encoder tables for a dictionary, hashed once and copied at the start of
+ * every block. Read-only after lz_dict_init, so threads can share it. */
+typedef struct
+{
+    const uint8_t *data; /* last n bytes of the dictionary (not owned) */
+    size_t n;
+    uint32_t head[LZ_HASH_SIZE];
+    uint16_t chain[LZ_WINDOW];
+} LZDict;
+
+/* Returns the payload size, or 0 if it would not fit in out_cap bytes */
+size_t lz_encode(const uint8_t *in, size_t n, uint8_t *out, size_t out_cap);
+
+/* Returns 0 on success, 1 on a corrupted payload or one larger than out_cap */
+int lz_decode(const uint8_t *in, size_t n, uint8_t *out, size_t out_cap, size_t *out_len);
+
+/* 'dict' must stay alive while d is used */
+void lz_dict_init(LZDict *d, const uint8_t *dict, size_t n);
+
+size_t lz_encode_dict(const LZDict *d, const uint8_t *in, size_t n, uint8_t *out, size_t out_cap);
+
+/* dict / dict_n: the whole dictionary the block was encoded with */
+int lz_decode_dict(const uint8_t *dict, size_t dict_n, const uint8_t *in, size_t n, uint8_t *out,
+                   size_t out_cap, size_t *out_len);
+
+#endif /* LZ_H */
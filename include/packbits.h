@@ -0,0 +1,84 @@
+#ifndef PACKBITS_H
+#define PACKBITS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * PackBits kernels used by the RLE2 block codec.
+ *   control 0..127   -> (control+1) literals follow
+ *   control 128..255 -> ((control&0x7F)+1) repeats, followed by 1 value byte
+ * A run is only emitted when it is at least k_min_run bytes long.
+ */
+
+/* Worst-case encoded size of n input bytes with threshold k. With k >= 3
+ * a RUN never costs more than its input; with k < 3 short runs split the
+ * literals and the output can reach 2n. */
+#define PACKBITS_MAX_ENCODED(n, k) ((k) >= 3 ? (n) + (n) / 128 + 1 : 2 * (n) + 1)
+
+/* Encode with the fastest kernel for this CPU. 'out' needs
+ * PACKBITS_MAX_ENCODED(n, k_min_run) bytes. The output is identical for every kernel;
+ * thresholds 2..8 use instances specialized for a constant k. */
+size_t packbits_encode_threshold(const uint8_t *in, size_t n, uint8_t *out, int k_min_run);
+
+/* Same output, but gives up as soon as it would not fit in out_cap bytes
+ * (returns 0 then): an incompressible block stops at the cap instead of
+ * being encoded to the end. */
+size_t packbits_encode_capped(const uint8_t *in, size_t n, uint8_t *out, size_t out_cap, int k_min_run);
+
+/* Smallest possible packet sequence for the same format (dynamic
+ * programming over the parse, no threshold), decodable by packbits_decode.
+ * Never larger than PACKBITS_MAX_ENCODED(n, 3). Returns 0 if n == 0, if it
+ * would not fit in out_cap bytes or if memory ran out. */
+size_t packbits_encode_optimal(const uint8_t *in, size_t n, uint8_t *out, size_t out_cap);
+
+/* Portable single-pass encoder (also the fallback for k outside 2..32) */
+size_t packbits_encode_scalar(const uint8_t *in, size_t n, uint8_t *out, int k_min_run);
+
+/* Decodes at most out_cap bytes. Returns 0 on success, 1 on a truncated or
+ * corrupted payload, or one that would overflow out.
+ * Uses the fastest kernel for this CPU: short packets are over-copied in
+ * fixed-width chunks, so bytes of out past *out_len (but below out_cap)
+ * may be overwritten. */
+int packbits_decode(const uint8_t *in, size_t n, uint8_t *out, size_t out_cap, size_t *out_len);
+
+/* One packet at a time, exact copies only (reference for benchmarks) */
+int packbits_decode_simple(const uint8_t *in, size_t n, uint8_t *out, size_t out_cap, size_t *out_len);
+
+/*
+ * Long-run variant: same greedy parse without the 128-byte packet limit.
+ * Each packet starts with a LEB128 varint v: v & 1 selects RUN (1) or
+ * LITERAL (0) and the length is (v >> 1) + 1. A RUN is followed by its
+ * value byte, a LITERAL by its bytes.
+ */
+
+/* Returns the encoded size, or 0 if it would not fit in out_cap bytes */
+size_t packbits_encode_long(const uint8_t *in, size_t n, uint8_t *out, size_t out_cap, int k_min_run);
+
+/* Same contract as packbits_decode; each RUN is a single fill */
+int packbits_decode_long(const uint8_t *in, size_t n, uint8_t *out, size_t out_cap, size_t *out_len);
+
+/*
+ * Periodic runs: a pattern of 'period' bytes (2, 3, 4 or 8) repeated.
+ * Same packets as the long-run variant, but a RUN is followed by its
+ * 'period' pattern bytes and its length counts bytes (it may end inside
+ * the pattern). A run must cover at least max(k_min_run, 2) patterns.
+ */
+
+/* Period that repeats clearly more than single-byte runs in this block,
+ * or 0 if none does */
+int packbits_best_period(const uint8_t *in, size_t n);
+
+/* Returns the encoded size, or 0 if it would not fit in out_cap bytes */
+size_t packbits_encode_period(const uint8_t *in, size_t n, uint8_t *out, size_t out_cap,
+                              int period, int k_min_run);
+
+int packbits_decode_period(const uint8_t *in, size_t n, int period, uint8_t *out, size_t out_cap,
+                           size_t *out_len);
+
+/* Kernel selection (for benchmarks): "scalar", "sse2" or "avx2".
+ * Returns 0 if the kernel is not available on this CPU. */
+int packbits_set_kernel(const char *name);
+const char *packbits_kernel_name(void);
+
+#endif /* PACKBITS_H */
@@ -0,0 +1,25 @@
+#ifndef SHUFFLE_H
+#define SHUFFLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Byte-shuffle filter for arrays of numbers: n bytes seen as elements of
+ * 'elem' bytes are written as 'elem' byte planes (all first bytes, then all
+ * second bytes, ...). High-order bytes that are constant or zero end up as
+ * long runs. The n % elem trailing bytes are copied unchanged after the
+ * planes.
+ */
+
+#define SHUFFLE_MAX_ELEM 16
+
+/* Guesses the element size (2, 4 or 8) from how many byte lanes barely
+ * change between consecutive elements. Returns 0 if none looks numeric. */
+size_t shuffle_detect(const uint8_t *in, size_t n);
+
+/* in and out must not overlap */
+void shuffle_encode(const uint8_t *in, size_t n, size_t elem, uint8_t *out);
+void shuffle_decode(const uint8_t *in, size_t n, size_t elem, uint8_t *out);
+
+#endif /* SHUFFLE_H */
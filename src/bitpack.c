@@ -0,0 +1,303 @@
+#include "bitpack.h"
+
+#include <string.h>
+
+#if defined(__BMI2__)
+#include <immintrin.h>
+#define BITPACK_BMI2 1
+#endif
+
+static inline uint64_t load64le(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, 8);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+static inline void store64le(uint8_t *p, uint64_t v)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    memcpy(p, &v, 8);
+}
+
+static uint32_t u32le_get(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/* =======================
+ *  Plan
+ *  Solo importa qué símbolos aparecen, no cuántas veces: una tabla de
+ *  presencia no tiene la dependencia leer-sumar-escribir de un
+ *  histograma, así que el bucle (desenrollado x4) va a velocidad de
+ *  lectura. Cada 4 KiB se cuentan los símbolos vistos y se abandona en
+ *  cuanto pasan de BITPACK_MAX_SYMBOLS: los bloques binarios cuestan
+ *  una fracción del bloque.
+ * ======================= */
+
+#define BITPACK_CHECK_EVERY 4096
+
+static unsigned count_seen(const uint8_t seen[256])
+{
+    unsigned c = 0;
+    for (int s = 0; s < 256; s++)
+        c += seen[s];
+    return c;
+}
+
+size_t bitpack_plan(const uint8_t *in, size_t n, BitpackPlan *plan)
+{
+    uint8_t seen[256];
+    memset(seen, 0, sizeof(seen));
+
+    size_t i = 0;
+    while (i < n)
+    {
+        size_t end = (n - i > BITPACK_CHECK_EVERY) ? i + BITPACK_CHECK_EVERY : n;
+        for (; i + 4 <= end; i += 4)
+        {
+            seen[in[i]] = 1;
+            seen[in[i + 1]] = 1;
+            seen[in[i + 2]] = 1;
+            seen[in[i + 3]] = 1;
+        }
+        for (; i < end; i++)
+            seen[in[i]] = 1;
+        if (count_seen(seen) > BITPACK_MAX_SYMBOLS)
+            return 0;
+    }
+
+    plan->nsym = 0;
+    for (int s = 0; s < 256; s++)
+    {
+        plan->index[s] = (uint8_t)plan->nsym;
+        if (seen[s])
+            plan->symbols[plan->nsym++] = (uint8_t)s;
+    }
+    if (plan->nsym == 0)
+        return 0;
+
+    plan->bits = 1;
+    while ((1u << plan->bits) < plan->nsym)
+        plan->bits++;
+    plan->size = BITPACK_HEADER_SIZE + plan->nsym + ((uint64_t)n * plan->bits + 7) / 8;
+    return plan->size;
+}
+
+/* =======================
+ *  Empaquetado
+ *  Grupos de 8 índices (uno por byte de una palabra de 64 bits) <-> 8
+ *  campos de k bits, es decir k bytes. Con BMI2 es un único PEXT / PDEP
+ *  con la máscara de k bits por byte; sin BMI2, desplazamientos. Los
+ *  grupos se escriben y leen con accesos de 8 bytes mientras quede sitio.
+ * ======================= */
+
+static inline uint64_t pack8(uint64_t idx8, unsigned bits, uint64_t mask)
+{
+#ifdef BITPACK_BMI2
+    (void)bits;
+    return _pext_u64(idx8, mask);
+#else
+    /* desenrollado a mano: con el bucle, -O2 no fija los desplazamientos */
+    (void)mask;
+    return (idx8 & 0xFF) | ((idx8 >> 8) & 0xFF) << bits | ((idx8 >> 16) & 0xFF) << (2 * bits) |
+           ((idx8 >> 24) & 0xFF) << (3 * bits) | ((idx8 >> 32) & 0xFF) << (4 * bits) |
+           ((idx8 >> 40) & 0xFF) << (5 * bits) | ((idx8 >> 48) & 0xFF) << (6 * bits) |
+           (idx8 >> 56) << (7 * bits);
+#endif
+}
+
+static inline uint64_t unpack8(uint64_t w, unsigned bits, uint64_t mask)
+{
+#ifdef BITPACK_BMI2
+    (void)bits;
+    return _pdep_u64(w, mask);
+#else
+    uint64_t low = mask & 0xFF;
+    return (w & low) | (w >> bits & low) << 8 | (w >> (2 * bits) & low) << 16 |
+           (w >> (3 * bits) & low) << 24 | (w >> (4 * bits) & low) << 32 |
+           (w >> (5 * bits) & low) << 40 | (w >> (6 * bits) & low) << 48 |
+           (w >> (7 * bits) & low) << 56;
+#endif
+}
+
+static inline uint64_t lane_mask(unsigned bits)
+{
+    return 0x0101010101010101ull * ((1u << bits) - 1);
+}
+
+/* Los *_width llaman a los *_groups con 'bits' constante: el compilador
+ * genera un bucle por anchura con los desplazamientos fijos */
+static inline size_t pack_groups(const uint8_t *in, size_t n, const uint8_t *index,
+                                 unsigned bits, uint8_t *op, const uint8_t *oend)
+{
+    uint64_t mask = lane_mask(bits);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        uint64_t idx8 = 0;
+        for (unsigned j = 0; j < 8; j++)
+            idx8 |= (uint64_t)index[in[i + j]] << (8 * j);
+        uint64_t v = pack8(idx8, bits, mask);
+        if (oend - op >= 8)
+            store64le(op, v);
+        else
+        {
+            for (unsigned b = 0; b < bits; b++)
+                op[b] = (uint8_t)(v >> (8 * b));
+        }
+        op += bits;
+    }
+    return i;
+}
+
+static size_t pack_width(const uint8_t *in, size_t n, const uint8_t *index, unsigned bits,
+                         uint8_t *op, const uint8_t *oend)
+{
+    switch (bits)
+    {
+    case 1:
+        return pack_groups(in, n, index, 1, op, oend);
+    case 2:
+        return pack_groups(in, n, index, 2, op, oend);
+    case 3:
+        return pack_groups(in, n, index, 3, op, oend);
+    case 4:
+        return pack_groups(in, n, index, 4, op, oend);
+    case 5:
+        return pack_groups(in, n, index, 5, op, oend);
+    case 6:
+        return pack_groups(in, n, index, 6, op, oend);
+    default:
+        return pack_groups(in, n, index, 7, op, oend);
+    }
+}
+
+size_t bitpack_encode(const uint8_t *in, size_t n, const BitpackPlan *plan, uint8_t *out)
+{
+    unsigned bits = plan->bits;
+
+    out[0] = (uint8_t)n;
+    out[1] = (uint8_t)(n >> 8);
+    out[2] = (uint8_t)(n >> 16);
+    out[3] = (uint8_t)(n >> 24);
+    out[4] = (uint8_t)bits;
+    out[5] = (uint8_t)(plan->nsym - 1);
+    memcpy(out + BITPACK_HEADER_SIZE, plan->symbols, plan->nsym);
+
+    uint8_t *op = out + BITPACK_HEADER_SIZE + plan->nsym;
+    const uint8_t *oend = out + plan->size;
+    size_t i = pack_width(in, n, plan->index, bits, op, oend);
+    op += (i / 8) * bits;
+
+    /* último grupo incompleto */
+    uint64_t v = 0;
+    size_t rem = n - i;
+    for (size_t j = 0; j < rem; j++)
+        v |= (uint64_t)plan->index[in[i + j]] << (j * bits);
+    for (size_t b = 0; b < (rem * bits + 7) / 8; b++)
+        *op++ = (uint8_t)(v >> (8 * b));
+    return (size_t)(op - out);
+}
+
+static inline size_t unpack_groups(const uint8_t *ip, const uint8_t *iend, size_t count,
+                                   const uint8_t *symbols, int identity, uint64_t over,
+                                   unsigned bits, uint8_t *out, uint64_t *bad)
+{
+    uint64_t mask = lane_mask(bits);
+    uint64_t acc = 0;
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        uint64_t w = 0;
+        if (iend - ip >= 8)
+            w = load64le(ip);
+        else
+        {
+            for (unsigned b = 0; b < bits; b++)
+                w |= (uint64_t)ip[b] << (8 * b);
+        }
+        ip += bits;
+
+        uint64_t idx8 = unpack8(w, bits, mask);
+        acc |= idx8 + over;
+        if (identity)
+            store64le(out + i, idx8); /* la tabla es 0, 1, 2...: índice = byte */
+        else
+        {
+            for (unsigned j = 0; j < 8; j++)
+                out[i + j] = symbols[(idx8 >> (8 * j)) & 0x7F];
+        }
+    }
+    *bad |= acc;
+    return i;
+}
+
+static size_t unpack_width(const uint8_t *ip, const uint8_t *iend, size_t count,
+                           const uint8_t *symbols, int identity, uint64_t over, unsigned bits,
+                           uint8_t *out, uint64_t *bad)
+{
+    switch (bits)
+    {
+    case 1:
+        return unpack_groups(ip, iend, count, symbols, identity, over, 1, out, bad);
+    case 2:
+        return unpack_groups(ip, iend, count, symbols, identity, over, 2, out, bad);
+    case 3:
+        return unpack_groups(ip, iend, count, symbols, identity, over, 3, out, bad);
+    case 4:
+        return unpack_groups(ip, iend, count, symbols, identity, over, 4, out, bad);
+    case 5:
+        return unpack_groups(ip, iend, count, symbols, identity, over, 5, out, bad);
+    case 6:
+        return unpack_groups(ip, iend, count, symbols, identity, over, 6, out, bad);
+    default:
+        return unpack_groups(ip, iend, count, symbols, identity, over, 7, out, bad);
+    }
+}
+
+int bitpack_decode(const uint8_t *in, size_t n, uint8_t *out, size_t out_cap, size_t *out_len)
+{
+    if (n < BITPACK_HEADER_SIZE)
+        return 1;
+    size_t count = u32le_get(in);
+    unsigned bits = in[4];
+    unsigned nsym = (unsigned)in[5] + 1;
+    if (bits < 1 || bits > 7 || nsym > (1u << bits) || count > out_cap ||
+        n != BITPACK_HEADER_SIZE + nsym + ((uint64_t)count * bits + 7) / 8)
+        return 1;
+
+    /* Un índice >= nsym es un payload corrupto: sumando 128 - nsym a cada
+     * byte (índices < 128, sin acarreo entre bytes) queda en el bit alto */
+    const uint8_t *symbols = in + BITPACK_HEADER_SIZE;
+    int identity = 1;
+    for (unsigned s = 0; s < nsym; s++)
+        identity &= (symbols[s] == s);
+    uint64_t over = 0x0101010101010101ull * (128 - nsym);
+
+    const uint8_t *ip = in + BITPACK_HEADER_SIZE + nsym, *iend = in + n;
+    uint64_t bad = 0;
+    size_t i = unpack_width(ip, iend, count, symbols, identity, over, bits, out, &bad);
+    ip += (i / 8) * bits;
+
+    uint64_t w = 0;
+    for (size_t b = 0; ip + b < iend; b++)
+        w |= (uint64_t)ip[b] << (8 * b);
+    uint64_t low = (1u << bits) - 1;
+    for (size_t j = 0; i < count; i++, j++)
+    {
+        unsigned idx = (unsigned)((w >> (j * bits)) & low);
+        bad |= idx + (128 - nsym);
+        out[i] = symbols[idx & 0x7F];
+    }
+
+    if (bad & 0x8080808080808080ull)
+        return 1;
+    *out_len = count;
+    return 0;
+}
@@ -0,0 +1,119 @@
+#include "blockstat.h"
+
+#include <string.h>
+
+/* =======================
+ *  Muestra
+ *  Tramos de BLOCKSTAT_CHUNK bytes, uno de cada BLOCKSTAT_STRIDE (1/8 del
+ *  bloque); los bloques pequeños se miran enteros. Los tramos son lo
+ *  bastante largos para ver runs y cadenas repetidas, y al estar
+ *  repartidos por todo el bloque un trozo raro al principio no decide.
+ * ======================= */
+
+#define BLOCKSTAT_CHUNK 256
+#define BLOCKSTAT_STRIDE 2048
+#define BLOCKSTAT_FULL 16384
+
+/* Tabla de 4-gramas para contar repeticiones */
+#define BLOCKSTAT_HASH_BITS 12
+
+/* Menos muestra que esto no basta para descartar un bloque */
+#define BLOCKSTAT_MIN_SAMPLE 1024
+/* 7.9 bits por byte: como mucho un 1% de ganancia para Huffman */
+#define BLOCKSTAT_RAW_ENTROPY_Q8 2022
+
+static inline uint32_t load32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+/* log2(x) en punto fijo Q16, x >= 1: parte entera por la posición del bit
+ * alto y 16 bits de fracción elevando al cuadrado la mantisa */
+static uint32_t log2_q16(uint32_t x)
+{
+    unsigned e = 31u - (unsigned)__builtin_clz(x);
+    uint64_t m = ((uint64_t)x << 32) >> e; /* mantisa Q32 en [1, 2) */
+    uint32_t r = e << 16;
+    for (int b = 15; b >= 0; b--)
+    {
+        m = (m >> 16) * (m >> 16);
+        if (m >= (2ull << 32))
+        {
+            m >>= 1;
+            r |= 1u << b;
+        }
+    }
+    return r;
+}
+
+void blockstat_sample(const uint8_t *in, size_t n, int k_min_run, BlockStats *st)
+{
+    uint32_t freq[256];
+    uint32_t seen[1u << BLOCKSTAT_HASH_BITS];
+    memset(freq, 0, sizeof(freq));
+    /* una entrada vacía "coincide" con cuatro ceros: también se comprimen */
+    memset(seen, 0, sizeof(seen));
+    memset(st, 0, sizeof(*st));
+    if (k_min_run < 2)
+        k_min_run = 2;
+
+    size_t chunk = (n <= BLOCKSTAT_FULL) ? n : BLOCKSTAT_CHUNK;
+    size_t stride = (n <= BLOCKSTAT_FULL) ? n : BLOCKSTAT_STRIDE;
+    for (size_t off = 0; off < n; off += stride)
+    {
+        size_t end = (n - off > chunk) ? off + chunk : n;
+        size_t run = 1;
+        freq[in[off]]++;
+        for (size_t i = off + 1; i < end; i++)
+        {
+            freq[in[i]]++;
+            if (in[i] == in[i - 1])
+                run++;
+            else
+            {
+                if (run >= (size_t)k_min_run)
+                    st->run_bytes += run;
+                run = 1;
+            }
+        }
+        if (run >= (size_t)k_min_run)
+            st->run_bytes += run;
+
+        for (size_t i = off; i + 4 <= end; i++)
+        {
+            uint32_t v = load32(in + i);
+            uint32_t h = (v * 2654435761u) >> (32 - BLOCKSTAT_HASH_BITS);
+            st->repeats += (seen[h] == v);
+            seen[h] = v;
+        }
+        st->sampled += end - off;
+    }
+    if (st->sampled == 0)
+        return;
+
+    /* H = log2(N) - sum(c log2 c) / N, más la corrección de Miller-Madow
+     * ((distintos - 1) / (2 N ln 2)): con muestras cortas la entropía
+     * medida se queda corta y un bloque aleatorio no llegaría a 8 bits */
+    uint64_t total = (uint64_t)st->sampled;
+    uint64_t sum = 0;
+    for (int s = 0; s < 256; s++)
+    {
+        if (freq[s] == 0)
+            continue;
+        st->distinct++;
+        sum += (uint64_t)freq[s] * log2_q16(freq[s]);
+    }
+    uint64_t bits_q16 = total * log2_q16((uint32_t)total) - sum;
+    uint64_t q8 = bits_q16 / total / 256;
+    q8 += (uint64_t)(st->distinct - 1) * 256 * 10000 / (2 * total * 6931);
+    st->entropy_q8 = (unsigned)(q8 > 2048 ? 2048 : q8);
+    st->order0_size = (size_t)(((uint64_t)n * st->entropy_q8 + 2047) / 2048);
+}
+
+int blockstat_incompressible(const BlockStats *st)
+{
+    return st->sampled >= BLOCKSTAT_MIN_SAMPLE && st->entropy_q8 >= BLOCKSTAT_RAW_ENTROPY_Q8 &&
+           st->run_bytes * 32 < st->sampled && st->repeats * 32 < st->sampled;
+}
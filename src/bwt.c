@@ -0,0 +1,403 @@
+#include "bwt.h"
+#include "huffman.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static uint32_t u32le_get(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void u32le_put(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+/* =======================
+ *  Suffix array (SA-IS)
+ *  Nong, Zhang, Chan: tipos L/S, ordenación inducida a partir de los
+ *  sufijos LMS y recursión sobre los nombres de las subcadenas LMS.
+ *  's' termina en un centinela único y mínimo (0); alfabeto 0..k.
+ * ======================= */
+
+#define TYPE_GET(t, i) (((t)[(i) >> 3] >> ((i) & 7)) & 1)
+#define TYPE_SET(t, i, b)                                      \
+    do                                                         \
+    {                                                          \
+        if (b)                                                 \
+            (t)[(i) >> 3] |= (uint8_t)(1u << ((i) & 7));       \
+        else                                                   \
+            (t)[(i) >> 3] &= (uint8_t)~(1u << ((i) & 7));      \
+    } while (0)
+#define IS_LMS(t, i) ((i) > 0 && TYPE_GET(t, i) && !TYPE_GET(t, (i) - 1))
+
+/* Inicio (end = 0) o final (end = 1) de cada bucket */
+static void sais_buckets(const int32_t *s, int32_t n, int32_t *bkt, int32_t k, int end)
+{
+    int32_t sum = 0;
+    memset(bkt, 0, sizeof(int32_t) * (size_t)(k + 1));
+    for (int32_t i = 0; i < n; i++)
+        bkt[s[i]]++;
+    for (int32_t c = 0; c <= k; c++)
+    {
+        sum += bkt[c];
+        bkt[c] = end ? sum : sum - bkt[c];
+    }
+}
+
+static void sais_induce(const uint8_t *t, int32_t *sa, const int32_t *s, int32_t n, int32_t *bkt,
+                        int32_t k)
+{
+    /* tipo L de izquierda a derecha, tipo S de derecha a izquierda */
+    sais_buckets(s, n, bkt, k, 0);
+    for (int32_t i = 0; i < n; i++)
+    {
+        int32_t j = sa[i] - 1;
+        if (j >= 0 && !TYPE_GET(t, j))
+            sa[bkt[s[j]]++] = j;
+    }
+    sais_buckets(s, n, bkt, k, 1);
+    for (int32_t i = n - 1; i >= 0; i--)
+    {
+        int32_t j = sa[i] - 1;
+        if (j >= 0 && TYPE_GET(t, j))
+            sa[--bkt[s[j]]] = j;
+    }
+}
+
+static int sais(const int32_t *s, int32_t *sa, int32_t n, int32_t k)
+{
+    uint8_t *t = (uint8_t *)calloc((size_t)n / 8 + 1, 1);
+    int32_t *bkt = (int32_t *)malloc(sizeof(int32_t) * (size_t)(k + 1));
+    if (!t || !bkt)
+    {
+        free(t);
+        free(bkt);
+        return 1;
+    }
+
+    /* tipos: 1 = S, 0 = L */
+    TYPE_SET(t, n - 1, 1);
+    if (n >= 2)
+        TYPE_SET(t, n - 2, 0);
+    for (int32_t i = n - 3; i >= 0; i--)
+        TYPE_SET(t, i, s[i] < s[i + 1] || (s[i] == s[i + 1] && TYPE_GET(t, i + 1)));
+
+    /* paso 1: ordenar las subcadenas LMS */
+    sais_buckets(s, n, bkt, k, 1);
+    for (int32_t i = 0; i < n; i++)
+        sa[i] = -1;
+    for (int32_t i = 1; i < n; i++)
+        if (IS_LMS(t, i))
+            sa[--bkt[s[i]]] = i;
+    sais_induce(t, sa, s, n, bkt, k);
+
+    /* compactar las LMS ordenadas al principio y darles nombre */
+    int32_t n1 = 0;
+    for (int32_t i = 0; i < n; i++)
+        if (IS_LMS(t, sa[i]))
+            sa[n1++] = sa[i];
+    for (int32_t i = n1; i < n; i++)
+        sa[i] = -1;
+    int32_t name = 0, prev = -1;
+    for (int32_t i = 0; i < n1; i++)
+    {
+        int32_t pos = sa[i];
+        int diff = 0;
+        for (int32_t d = 0; d < n; d++)
+        {
+            if (prev == -1 || s[pos + d] != s[prev + d] || TYPE_GET(t, pos + d) != TYPE_GET(t, prev + d))
+            {
+                diff = 1;
+                break;
+            }
+            if (d > 0 && (IS_LMS(t, pos + d) || IS_LMS(t, prev + d)))
+                break;
+        }
+        if (diff)
+        {
+            name++;
+            prev = pos;
+        }
+        sa[n1 + pos / 2] = name - 1;
+    }
+    for (int32_t i = n - 1, j = n - 1; i >= n1; i--)
+        if (sa[i] >= 0)
+            sa[j--] = sa[i];
+
+    /* paso 2: orden de las LMS, recursivo si hay nombres repetidos */
+    int32_t *sa1 = sa, *s1 = sa + n - n1;
+    if (name < n1)
+    {
+        if (sais(s1, sa1, n1, name - 1) != 0)
+        {
+            free(t);
+            free(bkt);
+            return 1;
+        }
+    }
+    else
+    {
+        for (int32_t i = 0; i < n1; i++)
+            sa1[s1[i]] = i;
+    }
+
+    /* paso 3: inducir el SA completo desde las LMS ya ordenadas */
+    sais_buckets(s, n, bkt, k, 1);
+    for (int32_t i = 1, j = 0; i < n; i++)
+        if (IS_LMS(t, i))
+            s1[j++] = i;
+    for (int32_t i = 0; i < n1; i++)
+        sa1[i] = s1[sa1[i]];
+    for (int32_t i = n1; i < n; i++)
+        sa[i] = -1;
+    for (int32_t i = n1 - 1; i >= 0; i--)
+    {
+        int32_t j = sa[i];
+        sa[i] = -1;
+        sa[--bkt[s[j]]] = j;
+    }
+    sais_induce(t, sa, s, n, bkt, k);
+
+    free(t);
+    free(bkt);
+    return 0;
+}
+
+/* =======================
+ *  Encoder
+ *  Filas = sufijos de in + centinela, ordenados. La columna L es el byte
+ *  anterior a cada sufijo; la fila del sufijo completo (byte anterior =
+ *  centinela) no se guarda y su número es 'primary'.
+ * ======================= */
+
+#define BWT_RUNA 0
+#define BWT_RUNB 1
+#define BWT_ESCAPE 255
+
+/* Run de 'run' ceros MTF en base 2 biyectiva: RUNA = 1, RUNB = 2 */
+static uint8_t *put_zero_run(uint8_t *z, size_t run)
+{
+    while (run > 0)
+    {
+        if (run & 1)
+        {
+            *z++ = BWT_RUNA;
+            run = (run - 1) / 2;
+        }
+        else
+        {
+            *z++ = BWT_RUNB;
+            run = (run - 2) / 2;
+        }
+    }
+    return z;
+}
+
+size_t bwt_encode(const uint8_t *in, size_t n, uint8_t *out, size_t out_cap)
+{
+    if (n == 0 || n >= INT32_MAX || out_cap < 4)
+        return 0;
+
+    /* s: bytes + 1 y centinela 0. Tras el SA se reutiliza para L (n bytes)
+     * y los símbolos MTF (como mucho 2n), que caben en sus 4(n + 1). */
+    int32_t *s = (int32_t *)malloc(sizeof(int32_t) * (n + 1));
+    int32_t *sa = (int32_t *)malloc(sizeof(int32_t) * (n + 1));
+    if (!s || !sa)
+    {
+        free(s);
+        free(sa);
+        return 0;
+    }
+    for (size_t i = 0; i < n; i++)
+        s[i] = (int32_t)in[i] + 1;
+    s[n] = 0;
+    if (sais(s, sa, (int32_t)(n + 1), 256) != 0)
+    {
+        free(s);
+        free(sa);
+        return 0;
+    }
+
+    uint8_t *last = (uint8_t *)s;
+    uint8_t *z = last + n;
+    uint32_t primary = 0;
+    size_t j = 0;
+    for (size_t row = 0; row <= n; row++)
+    {
+        if (sa[row] == 0)
+            primary = (uint32_t)row;
+        else
+            last[j++] = in[sa[row] - 1];
+    }
+    free(sa);
+
+    /* MTF + runs de ceros */
+    uint8_t order[256];
+    for (int c = 0; c < 256; c++)
+        order[c] = (uint8_t)c;
+    uint8_t *zp = z;
+    size_t run = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        uint8_t c = last[i];
+        if (order[0] == c)
+        {
+            run++;
+            continue;
+        }
+        zp = put_zero_run(zp, run);
+        run = 0;
+
+        unsigned idx = 1;
+        uint8_t tmp = order[0];
+        while (order[idx] != c)
+        {
+            uint8_t t = order[idx];
+            order[idx] = tmp;
+            tmp = t;
+            idx++;
+        }
+        order[idx] = tmp;
+        order[0] = c;
+
+        if (idx < 254)
+            *zp++ = (uint8_t)(idx + 1);
+        else
+        {
+            *zp++ = BWT_ESCAPE;
+            *zp++ = (uint8_t)(idx - 254);
+        }
+    }
+    zp = put_zero_run(zp, run);
+
+    size_t zn = (size_t)(zp - z);
+    HuffmanPlan plan;
+    size_t size = 0;
+    if (huffman_plan(z, zn, &plan) <= out_cap - 4)
+    {
+        u32le_put(out, primary);
+        size = 4 + huffman_encode(z, zn, &plan, out + 4);
+    }
+    free(s);
+    return size;
+}
+
+/* =======================
+ *  Decoder
+ *  Huffman -> símbolos -> índices MTF -> columna L, y la inversa de la BWT
+ *  recorriendo LF (fila -> fila del sufijo anterior) desde la fila 0, la
+ *  del centinela, escribiendo la salida de atrás hacia delante.
+ * ======================= */
+
+/* Símbolos MTF / runs -> columna L. Devuelve 0 y su longitud en *len */
+static int bwt_unmtf(const uint8_t *z, size_t zn, uint8_t *last, size_t cap, size_t *len_out)
+{
+    uint8_t order[256];
+    for (int c = 0; c < 256; c++)
+        order[c] = (uint8_t)c;
+    size_t len = 0, run = 0, weight = 1;
+    for (size_t i = 0; i <= zn; i++)
+    {
+        unsigned sym = (i < zn) ? z[i] : 256u; /* 256: fin, vaciar el run */
+        if (sym == BWT_RUNA || sym == BWT_RUNB)
+        {
+            if (weight > cap)
+                return 1;
+            run += (sym == BWT_RUNA) ? weight : 2 * weight;
+            weight <<= 1;
+            if (run > cap - len)
+                return 1;
+            continue;
+        }
+        memset(last + len, order[0], run);
+        len += run;
+        run = 0;
+        weight = 1;
+        if (sym == 256)
+            break;
+
+        unsigned idx = sym - 1;
+        if (sym == BWT_ESCAPE)
+        {
+            if (++i >= zn || z[i] > 1)
+                return 1;
+            idx = 254 + z[i];
+        }
+        if (len >= cap)
+            return 1;
+        uint8_t c = order[idx];
+        memmove(order + 1, order, idx);
+        order[0] = c;
+        last[len++] = c;
+    }
+    *len_out = len;
+    return 0;
+}
+
+/* Inversa de la BWT. LF: C[c] = 1 (centinela) + bytes menores que c, más
+ * el rango de cada aparición en L; la fila 'primary' (centinela en L) no
+ * tiene LF. 'lf' tiene len + 1 entradas. */
+static int bwt_inverse(const uint8_t *last, size_t len, size_t primary, uint32_t *lf, uint8_t *out)
+{
+    uint32_t cnt[256];
+    memset(cnt, 0, sizeof(cnt));
+    for (size_t i = 0; i < len; i++)
+        cnt[last[i]]++;
+    uint32_t sum = 1;
+    for (int c = 0; c < 256; c++)
+    {
+        uint32_t f = cnt[c];
+        cnt[c] = sum;
+        sum += f;
+    }
+    for (size_t row = 0, i = 0; row <= len; row++)
+    {
+        if (row == primary)
+            continue;
+        lf[row] = cnt[last[i++]]++;
+    }
+
+    size_t row = 0;
+    for (size_t k = len; k-- > 0;)
+    {
+        if (row == primary)
+            return 1;
+        out[k] = last[row < primary ? row : row - 1];
+        row = lf[row];
+    }
+    return row != primary;
+}
+
+int bwt_decode(const uint8_t *in, size_t n, uint8_t *out, size_t out_cap, size_t *out_len)
+{
+    if (n < 4)
+        return 1;
+    uint32_t primary = u32le_get(in);
+
+    /* símbolos (como mucho 2 por byte) y columna L */
+    size_t z_cap = 2 * out_cap + 1;
+    uint8_t *z = (uint8_t *)malloc(z_cap + out_cap + 1);
+    if (!z)
+        return 1;
+    uint8_t *last = z + z_cap;
+
+    size_t zn, len;
+    int rc = huffman_decode(in + 4, n - 4, z, z_cap, &zn) != 0 ||
+             bwt_unmtf(z, zn, last, out_cap, &len) != 0 ||
+             len == 0 || primary == 0 || primary > len;
+    if (rc == 0)
+    {
+        uint32_t *lf = (uint32_t *)malloc(sizeof(uint32_t) * (len + 1));
+        rc = !lf || bwt_inverse(last, len, primary, lf, out) != 0;
+        free(lf);
+    }
+    free(z);
+    if (rc == 0)
+        *out_len = len;
+    return rc;
+}
@@ -1,8 +1,54 @@
+#include <ctype.h>
+#include <limits.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include "cli.h"
 
+// --pattern: texto con escapes \xHH, \n, \r, \t, \0 y \\ para bytes no imprimibles
+static int parse_pattern(const char *spec, ProgramOptions *opts)
+{
+    int n = 0;
+    while (*spec)
+    {
+        unsigned char c = (unsigned char)*spec++;
+        if (c == '\\')
+        {
+            char e = *spec;
+            if (e == '\0')
+                return 0;
+            spec++;
+            if (e == 'x')
+            {
+                char hex[3] = {0, 0, 0};
+                if (!isxdigit((unsigned char)spec[0]) || !isxdigit((unsigned char)spec[1]))
+                    return 0;
+                hex[0] = spec[0];
+                hex[1] = spec[1];
+                c = (unsigned char)strtoul(hex, NULL, 16);
+                spec += 2;
+            }
+            else if (e == 'n')
+                c = '\n';
+            else if (e == 'r')
+                c = '\r';
+            else if (e == 't')
+                c = '\t';
+            else if (e == '0')
+                c = '\0';
+            else if (e == '\\')
+                c = '\\';
+            else
+                return 0;
+        }
+        if (n == CLI_MAX_PATTERN)
+            return 0;
+        opts->pattern[n++] = c;
+    }
+    opts->pattern_len = n;
+    return n > 0;
+}
+
 int parse_arguments(int argc, char *argv[], ProgramOptions *opts)
 {
     if (argc < 5)
@@ -18,7 +64,8 @@ int parse_arguments(int argc, char *argv[], ProgramOptions *opts)
             // Procesar cada caracter del argumento
             for (int j = 1; arg[j]; j++)
             {
-                if (arg[j] == 'c' || arg[j] == 'd' || arg[j] == 'e' || arg[j] == 'u')
+                if (arg[j] == 'c' || arg[j] == 'd' || arg[j] == 'e' || arg[j] == 'u' || arg[j] == 't' ||
+                    arg[j] == 'j' || arg[j] == 'g')
                 {
                     char op[] = {arg[j], '\0'};
                     strcat(opts->operation, op);
@@ -27,7 +74,11 @@ int parse_arguments(int argc, char *argv[], ProgramOptions *opts)
         }
         else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc)
         {
-            opts->input_path = argv[++i];
+            if (opts->input_count == CLI_MAX_INPUTS)
+                return 0;
+            opts->input_paths[opts->input_count++] = argv[++i];
+            if (!opts->input_path)
+                opts->input_path = opts->input_paths[0];
         }
         else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
         {
@@ -37,14 +88,121 @@ int parse_arguments(int argc, char *argv[], ProgramOptions *opts)
         {
             opts->key = argv[++i];
         }
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            char *end;
+            const char *spec = argv[++i];
+            long n = strtol(spec, &end, 10);
+            if (end == spec || *end != '\0' || n < 0 || n > INT_MAX)
+                return 0;
+            opts->threads = (int)n;
+        }
+        else if (strcmp(argv[i], "--seekable") == 0)
+        {
+            opts->seekable = 1;
+        }
+        else if (strcmp(argv[i], "--range") == 0 && i + 1 < argc)
+        {
+            // formato off:len (decimal o 0x...)
+            char *end;
+            const char *spec = argv[++i];
+            opts->range_offset = strtoull(spec, &end, 0);
+            if (end == spec || *end != ':')
+                return 0;
+            spec = end + 1;
+            opts->range_length = strtoull(spec, &end, 0);
+            if (end == spec || *end != '\0')
+                return 0;
+            opts->has_range = 1;
+        }
+        else if (strcmp(argv[i], "--block-size") == 0 && i + 1 < argc)
+        {
+            // bytes, con sufijo opcional K o M (p.ej. 1M)
+            char *end;
+            const char *spec = argv[++i];
+            opts->block_size = strtoull(spec, &end, 0);
+            if (end == spec)
+                return 0;
+            if (*end == 'K' || *end == 'k')
+                opts->block_size <<= 10;
+            else if (*end == 'M' || *end == 'm')
+                opts->block_size <<= 20;
+            if (*end != '\0' && end[1] == '\0' && strchr("KkMm", *end))
+                end++;
+            if (*end != '\0' || opts->block_size == 0)
+                return 0;
+        }
+        else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc)
+        {
+            char *end;
+            const char *spec = argv[++i];
+            long n = strtol(spec, &end, 10);
+            if (end == spec || *end != '\0' || n <= 0 || n > INT_MAX)
+                return 0;
+            opts->run_threshold = (int)n;
+        }
+        else if (strcmp(argv[i], "--max-ratio") == 0)
+        {
+            opts->max_ratio = 1;
+        }
+        else if (strcmp(argv[i], "--shuffle") == 0 && i + 1 < argc)
+        {
+            const char *spec = argv[++i];
+            if (strcmp(spec, "auto") == 0)
+                opts->shuffle = 0;
+            else if (strcmp(spec, "off") == 0)
+                opts->shuffle = 1;
+            else
+            {
+                char *end;
+                long n = strtol(spec, &end, 10);
+                if (end == spec || *end != '\0' || n < 2 || n > 16)
+                    return 0;
+                opts->shuffle = (int)n;
+            }
+        }
+        else if (strcmp(argv[i], "--append") == 0)
+        {
+            opts->append = 1;
+        }
+        else if (strcmp(argv[i], "--sparse") == 0)
+        {
+            opts->sparse = 1;
+        }
+        else if (strcmp(argv[i], "--pattern") == 0 && i + 1 < argc)
+        {
+            if (!parse_pattern(argv[++i], opts))
+                return 0;
+        }
+        else if (strcmp(argv[i], "--dict") == 0 && i + 1 < argc)
+        {
+            opts->dict_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--codec") == 0 && i + 1 < argc)
+        {
+            const char *name = argv[++i];
+            if (strcmp(name, "fast") == 0)
+                opts->codec = 0;
+            else if (strcmp(name, "bwt") == 0)
+                opts->codec = 1;
+            else
+                return 0;
+        }
         else if (strcmp(argv[i], "--help") == 0)
         {
             return 0;
         }
     }
 
+    // buscar (-g) va solo, con --pattern y sin salida
+    int grep = strchr(opts->operation, 'g') != NULL;
+    if (grep && (strlen(opts->operation) > 1 || opts->pattern_len == 0))
+        return 0;
     // validar la existencia de input, output y minimo una operacion
-    if (!opts->input_path || !opts->output_path || strlen(opts->operation) == 0)
+    if (!opts->input_path || (!opts->output_path && !grep) || strlen(opts->operation) == 0)
+        return 0;
+    // varios -i solo para unir archivos o buscar
+    if (opts->input_count > 1 && !strchr(opts->operation, 'j') && !grep)
         return 0;
 
     return 1;
@@ -52,12 +210,33 @@ int parse_arguments(int argc, char *argv[], ProgramOptions *opts)
 
 void print_help(void)
 {
-    printf("Usage: gsea [operations] -i input -o output [-k key]\n");
+    printf("Usage: gsea [operations] -i input -o output [-k key] [options]\n");
     printf("Operations:\n");
     printf("  -c : compress\n");
     printf("  -d : decompress\n");
     printf("  -e : encrypt\n");
     printf("  -u : decrypt\n");
+    printf("  -t : train a shared dictionary from the files of the input directory\n");
+    printf("  -j : join .rle files without recompressing (repeat -i, or give a directory\n");
+    printf("       to join its files in name order)\n");
+    printf("  -g : search .rle files for --pattern without decompressing them (no -o;\n");
+    printf("       repeat -i, or give a directory to search its files)\n");
     printf("You can combine them (e.g. -ce)\n");
+    printf("Options:\n");
+    printf("  --threads N : threads per file for -c/-d (0 = auto, 1 = serial)\n");
+    printf("  --seekable : with -c, write the v3 container with a block index\n");
+    printf("  --range off:len : with -d on a file, extract only that byte range\n");
+    printf("  --block-size N[K|M] : with -c, block size (power of two, 4K..4M, default 64K)\n");
+    printf("  --threshold K : with -c, minimum run length to encode as a run (1..128, default 3)\n");
+    printf("  --codec fast|bwt : with -c, bwt adds a block-sorting codec for the best ratio\n");
+    printf("                     (much slower, 1M blocks unless --block-size is given)\n");
+    printf("  --max-ratio : with -c, smallest possible PackBits encoding per block (slower)\n");
+    printf("  --shuffle auto|off|N : with -c, byte-shuffle N-byte numbers (2..16) before coding\n");
+    printf("                         (2..16; auto detects 2/4/8 per block, the default)\n");
+    printf("  --dict FILE : with -c/-d, prime every block with a dictionary made by -t\n");
+    printf("                (the same one is needed to decompress)\n");
+    printf("  --sparse : with -d, leave zero-filled filesystem blocks as holes\n");
+    printf("  --append : with -c on a file, add it to the end of an existing .rle\n");
+    printf("  --pattern TEXT : with -g, the bytes to find (escapes: \\xHH \\n \\r \\t \\0 \\\\)\n");
     printf("Example: ./gsea -ce -i input.txt -o output.enc -k clave123\n");
 }
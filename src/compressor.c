@@ -1,11 +1,25 @@
+#define _GNU_SOURCE /* copy_file_range, SEEK_DATA / SEEK_HOLE, fallocate, memmem */
 #include "compressor.h"
+#include "packbits.h"
+#include "huffman.h"
+#include "lz.h"
+#include "bwt.h"
+#include "bitpack.h"
+#include "blockstat.h"
+#include "imgfilter.h"
+#include "delta.h"
+#include "shuffle.h"
+#include "dict.h"
 
 #include <unistd.h>
+#include <fcntl.h>
 #include <errno.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <pthread.h>
+#include <sys/stat.h>
 
 /* =======================
  *  Shared small helpers
@@ -58,297 +72,3466 @@ static uint32_t u32le_read(const uint8_t in[4])
     return (uint32_t)in[0] | ((uint32_t)in[1] << 8) | ((uint32_t)in[2] << 16) | ((uint32_t)in[3] << 24);
 }
 
+static void u64le_write(uint8_t out[8], uint64_t v)
+{
+    u32le_write(out, (uint32_t)(v & 0xFFFFFFFFu));
+    u32le_write(out + 4, (uint32_t)(v >> 32));
+}
+
+static uint64_t u64le_read(const uint8_t in[8])
+{
+    return (uint64_t)u32le_read(in) | ((uint64_t)u32le_read(in + 4) << 32);
+}
+
 /* =======================
  *  RLE2
- *  Header: "RLE2\0\0\0\0"
+ *  Header: "RLE2" + revision (1 byte) + block log2 (1 byte)
+ *          + run threshold (1 byte) + flags (1 byte)
+ *    revision 0: "RLE2\0\0\0\0", original format
+ *    revision 1: every block header also carries the decoded length
+ *    block log2 / threshold: encoder parameters, 0 = compile-time defaults
+ *      (RLE2_BLOCK_SIZE / RLE2_RUN_THRESHOLD)
+ *    flags: 0, or 0x01 STORED (revision >= 1, "RLE2" only): no blocks, the
+ *      rest of the file is the data as is
+ *      0x02 DICT (revision >= 1, not with STORED): the header goes on with
+ *      the dictionary ID (u32 LE); LZ blocks start with the dictionary in
+ *      their window
  *  Stream: repeated blocks
- *    tag: 1 byte (0x00 RAW, 0x01 RLE)
+ *    tag: 1 byte (0x00 RAW, 0x01 RLE, 0x02 RLE with varint lengths,
+ *                 0x03 periodic RLE, 0x04 Huffman, 0x05 LZ, 0x06 BWT)
  *    len: 4 bytes (LE) -> payload length
+ *    raw_len: 4 bytes (LE) -> decoded length (revision >= 1 only)
  *    payload: 'len' bytes
  *  RLE payload uses PackBits-like:
  *    control 0..127  -> (control+1) literals follow
  *    control 128..255-> ((control&0x7F)+1) repeats, followed by 1 value byte
  *  Run threshold: only emit RUN if run_len >= RLE2_RUN_THRESHOLD
+ *  0x02 payload: same parse, packets with varint lengths (see packbits.h)
+ *  0x03 payload: period (1 byte) + 0x02-style packets whose RUNs carry a
+ *    pattern of 'period' bytes
+ *  0x04 payload: order-0 Huffman, 4 interleaved streams (see huffman.h)
+ *  0x05 payload: LZ4-style sequences, 64 KiB window (see lz.h)
+ *  0x06 payload: BWT + MTF + zero runs + Huffman (see bwt.h)
+ *  0x07 payload: symbol table + k-bit packed indices (see bitpack.h)
+ *  0x40 | tag: image rows filtered before coding (see imgfilter.h)
+ *    bpp u8, stride u32, begin u32, rows u32 (LE), one filter type per
+ *    row, then the 'tag' payload of the filtered block. Rows start at
+ *    byte 'begin' of the block. Only in revision 1.
+ *  0x80 | tag: stride-delta filtered records (see delta.h)
+ *    stride u16 LE, mode u8 (0 = SUB, 1 = XOR), then the 'tag' payload
+ *    of the filtered block. Only in revision 1.
+ *  0x20 | tag: byte-shuffled numbers (see shuffle.h)
+ *    element size u8, then the 'tag' payload of the byte planes. Only in
+ *    revision 1. At most one of 0x20 / 0x40 / 0x80 is set.
+ *
+ *  RLE2 v3 (seekable): Header "RLE3" + revision, same blocks as RLE2, then
+ *    end block: tag 0xFF, len = index size, payload = index
+ *      index entry: raw_off u64, block_off u64, paylen u64 (LE)
+ *      (block_off points at the block's tag byte)
+ *    trailer (last 32 bytes of the file):
+ *      index_off u64 (offset of the end block), count u64,
+ *      total raw size u64, "RLE3IDX\0"
+ * ======================= */
+
+static const uint8_t RLE2_MAGIC[4] = {'R', 'L', 'E', '2'};
+static const uint8_t RLE3_MAGIC[4] = {'R', 'L', 'E', '3'};
+static const uint8_t RLE3_TRAILER_MAGIC[8] = {'R', 'L', 'E', '3', 'I', 'D', 'X', 0};
+
+#define RLE2_HEADER_SIZE 8
+#define RLE2_REV_ORIGINAL 0
+#define RLE2_REV_SIZED 1 /* cabecera de bloque con raw_len */
+#define RLE2_REV_CURRENT RLE2_REV_SIZED
+#define RLE2_FLAG_STORED 0x01 /* datos sin bloques tras la cabecera */
+#define RLE2_FLAG_DICT 0x02   /* ID de diccionario tras la cabecera */
+#define RLE2_HEADER_MAX (RLE2_HEADER_SIZE + 4)
+
+#define RLE2_TAG_RAW 0x00
+#define RLE2_TAG_RLE 0x01
+#define RLE2_TAG_RLE_LONG 0x02 /* runs largos, longitudes varint */
+#define RLE2_TAG_RLE_PERIOD 0x03 /* runs de un patrón de 2/3/4/8 bytes */
+#define RLE2_TAG_HUFFMAN 0x04 /* entropía orden 0, sin runs */
+#define RLE2_TAG_LZ 0x05 /* repeticiones de cadenas (LZ77) */
+#define RLE2_TAG_BWT 0x06 /* block-sorting, solo con RLE2_CODEC_BWT */
+#define RLE2_TAG_BITPACK 0x07 /* pocos símbolos distintos, índices de k bits */
+#define RLE2_TAG_FILTERED 0x40 /* flag: filas de imagen con predictores */
+#define RLE2_TAG_DELTA 0x80 /* flag: registros con delta por stride */
+#define RLE2_TAG_SHUFFLE 0x20 /* flag: planos de bytes de números */
+#define RLE2_TAG_FLAGS (RLE2_TAG_SHUFFLE | RLE2_TAG_FILTERED | RLE2_TAG_DELTA)
+#define RLE3_TAG_END 0xFF
+#define RLE3_INDEX_ENTRY_SIZE 24
+#define RLE3_TRAILER_SIZE 32
+
+/* Salida máxima de un bloque revisión 0 (no registra su tamaño) */
+#define RLE2_REV0_OUT_CAP (RLE2_BLOCK_SIZE * 4)
+
+/* Capacidad inicial de los buffers de decodificación; crecen si un bloque
+ * registra un tamaño mayor. */
+#define RLE2_DEC_IN_CAP(bs) (PACKBITS_MAX_ENCODED(bs, RLE2_RUN_THRESHOLD) + 9)
+#define RLE2_DEC_OUT_CAP(bs) ((bs) > RLE2_REV0_OUT_CAP ? (bs) : RLE2_REV0_OUT_CAP)
+
+typedef struct
+{
+    int v3;             /* contenedor con índice */
+    int rev;            /* revisión del formato de bloque */
+    size_t blk_hdr_len; /* 5 (rev 0) o 9 (rev >= 1) */
+    size_t block_size;  /* tamaño de bloque del encoder */
+    int run_threshold;  /* umbral del encoder (0 = no registrado) */
+    int stored;         /* RLE2_FLAG_STORED: sin bloques */
+    int has_dict;       /* RLE2_FLAG_DICT: dict_id es válido */
+    uint32_t dict_id;
+    size_t hdr_len;     /* RLE2_HEADER_SIZE, + 4 con diccionario */
+} RLE2Header;
+
+static unsigned log2_size(size_t v)
+{
+    unsigned l = 0;
+    while (((size_t)1 << l) < v)
+        l++;
+    return l;
+}
+
+static void rle2_header_write(uint8_t out[RLE2_HEADER_SIZE], int v3, int rev,
+                              size_t block_size, int run_threshold)
+{
+    memcpy(out, v3 ? RLE3_MAGIC : RLE2_MAGIC, 4);
+    out[4] = (uint8_t)rev;
+    out[5] = (uint8_t)log2_size(block_size);
+    out[6] = (uint8_t)run_threshold;
+    out[7] = 0;
+}
+
+/* 0 si es una cabecera RLE2/RLE3 conocida, 1 si no. Con diccionario
+ * faltan los 4 bytes del ID: los lee rle2_header_dict_id. */
+static int rle2_header_parse(const uint8_t in[RLE2_HEADER_SIZE], RLE2Header *h)
+{
+    if (memcmp(in, RLE2_MAGIC, 4) == 0)
+        h->v3 = 0;
+    else if (memcmp(in, RLE3_MAGIC, 4) == 0)
+        h->v3 = 1;
+    else
+        return 1;
+    if (in[4] > RLE2_REV_CURRENT || (in[7] & (uint8_t)~(RLE2_FLAG_STORED | RLE2_FLAG_DICT)) != 0)
+        return 1;
+    h->rev = in[4];
+    h->stored = (in[7] & RLE2_FLAG_STORED) != 0;
+    h->has_dict = (in[7] & RLE2_FLAG_DICT) != 0;
+    h->dict_id = 0;
+    h->hdr_len = RLE2_HEADER_SIZE + (h->has_dict ? 4 : 0);
+    if (h->stored && (h->v3 || h->rev < RLE2_REV_SIZED || in[5] != 0 || in[6] != 0 || h->has_dict))
+        return 1;
+    if (h->has_dict && h->rev < RLE2_REV_SIZED)
+        return 1;
+    h->blk_hdr_len = (h->rev >= RLE2_REV_SIZED) ? 9 : 5;
+
+    /* Parámetros del encoder (revisión 0: siempre los de compilación) */
+    if (h->rev < RLE2_REV_SIZED && (in[5] != 0 || in[6] != 0))
+        return 1;
+    h->block_size = RLE2_BLOCK_SIZE;
+    if (in[5] != 0)
+    {
+        if (((size_t)1 << in[5]) < RLE2_MIN_BLOCK_SIZE || ((size_t)1 << in[5]) > RLE2_MAX_BLOCK_SIZE)
+            return 1;
+        h->block_size = (size_t)1 << in[5];
+    }
+    h->run_threshold = in[6];
+    return 0;
+}
+
+static void rle2_header_dict_id(const uint8_t *ext, RLE2Header *h)
+{
+    h->dict_id = u32le_read(ext);
+}
+
+/* Diccionario con el que se decodifica: el de las opciones, que tiene que
+ * ser el que registra la cabecera. NULL si el archivo no usa ninguno. */
+static int rle2_header_dict(const RLE2Header *h, const RLE2Options *opts, const RLE2Dict **dict)
+{
+    *dict = NULL;
+    if (!h->has_dict)
+        return 0;
+    if (!opts || !opts->dict)
+    {
+        fprintf(stderr, "This file was compressed with dictionary %08X: pass it with --dict.\n",
+                h->dict_id);
+        return 1;
+    }
+    if (opts->dict->id != h->dict_id)
+    {
+        fprintf(stderr, "Wrong dictionary: the file needs %08X, got %08X.\n", h->dict_id,
+                opts->dict->id);
+        return 1;
+    }
+    *dict = opts->dict;
+    return 0;
+}
+
+/* Scratch por bloque: cuatro zonas de 'bs' bytes. 0 y 1 para los
+ * candidatos de los codecs (con tope de tamaño, así que caben), 2 para
+ * montar el bloque filtrado ganador y 3 para la copia con shuffle de la
+ * entrada */
+#define RLE2_SCRATCH_SIZE(bs) (4 * (bs))
+
+/* Prefijo de un bloque filtrado (sin los tipos de fila) */
+#define RLE2_FILTER_HEADER_SIZE 13
+/* Filas más estrechas no compensan el prefijo */
+#define RLE2_FILTER_MIN_STRIDE 16
+/* Prefijo de un bloque con delta: stride y modo */
+#define RLE2_DELTA_HEADER_SIZE 3
+/* Prefijo de un bloque con shuffle: tamaño de elemento */
+#define RLE2_SHUFFLE_HEADER_SIZE 1
+
+static uint8_t *rle2_scratch_zone(uint8_t *scratch, size_t in_n, int zone)
+{
+    return scratch + (size_t)zone * in_n;
+}
+
+/* Zona alternativa libre: la que no tiene el payload elegido hasta ahora,
+ * así un candidato que no cabe no estropea al anterior */
+static uint8_t *rle2_free_alt(uint8_t *scratch, size_t in_n, const uint8_t *payload)
+{
+    uint8_t *alt = rle2_scratch_zone(scratch, in_n, 0);
+    return (payload == alt) ? rle2_scratch_zone(scratch, in_n, 1) : alt;
+}
+
+static int rle2_tag_known(uint8_t tag)
+{
+    uint8_t flags = tag & RLE2_TAG_FLAGS;
+    return (tag & (uint8_t)~flags) <= RLE2_TAG_BITPACK && (flags & (flags - 1)) == 0;
+}
+
+/* =======================
+ *  Codecs de bloque
+ *  Antes de codificar se mira una muestra del bloque (blockstat.h):
+ *  entropía de orden 0, runs y cadenas repetidas. Si no hay nada que
+ *  aprovechar el bloque va directo a RAW; si no, se recorre la tabla de
+ *  codecs en orden y cada uno decide con la muestra y con el mejor
+ *  tamaño hasta ahora si merece la pena probarlo. Cada candidato recibe
+ *  como tope ese tamaño menos uno y abandona en cuanto lo pasa, así que
+ *  un codec que no va a ganar no codifica el bloque entero.
+ * ======================= */
+
+typedef struct
+{
+    const uint8_t *in;
+    size_t in_n;
+    const RLE2Options *opts;
+    BlockStats st;
+    /* mejor codificación hasta ahora */
+    uint8_t tag;
+    const uint8_t *payload;
+    uint32_t paylen;
+} RLE2Block;
+
+typedef struct
+{
+    uint8_t tag;
+    /* ¿puede ganar al mejor hasta ahora? */
+    int (*worth)(const RLE2Block *b);
+    /* escribe el payload en 'out' (como mucho 'cap' bytes); 0 si no cabe */
+    size_t (*encode)(const RLE2Block *b, uint8_t *out, size_t cap);
+} RLE2Codec;
+
+/* PackBits con umbral, o con el parse óptimo en modo max-ratio (si se
+ * queda sin memoria, el greedy). Sin runs en la muestra no baja del
+ * tamaño del bloque. */
+static int rle2_worth_rle(const RLE2Block *b)
+{
+    return b->opts->max_ratio || b->st.run_bytes != 0;
+}
+
+static size_t rle2_encode_rle(const RLE2Block *b, uint8_t *out, size_t cap)
+{
+    size_t enc_n = b->opts->max_ratio ? packbits_encode_optimal(b->in, b->in_n, out, cap) : 0;
+    if (enc_n == 0)
+        enc_n = packbits_encode_capped(b->in, b->in_n, out, cap, b->opts->run_threshold);
+    return enc_n;
+}
+
+/* Bloque dominado por runs: runs largos (un paquete por run en vez de
+ * uno cada 128 bytes) */
+static int rle2_worth_rle_long(const RLE2Block *b)
+{
+    return b->tag == RLE2_TAG_RLE && b->paylen < b->in_n / 2;
+}
+
+static size_t rle2_encode_rle_long(const RLE2Block *b, uint8_t *out, size_t cap)
+{
+    return packbits_encode_long(b->in, b->in_n, out, cap, b->opts->run_threshold);
+}
+
+/* Patrones de varios bytes (píxeles, palabras de 16/32/64 bits) */
+static int rle2_worth_rle_period(const RLE2Block *b)
+{
+    return b->paylen > 2;
+}
+
+static size_t rle2_encode_rle_period(const RLE2Block *b, uint8_t *out, size_t cap)
+{
+    int period = packbits_best_period(b->in, b->in_n);
+    if (period == 0)
+        return 0;
+    size_t per_n = packbits_encode_period(b->in, b->in_n, out + 1, cap - 1, period, b->opts->run_threshold);
+    if (per_n == 0)
+        return 0;
+    out[0] = (uint8_t)period;
+    return per_n + 1;
+}
+
+/* LZ: cadenas repetidas a cualquier distancia dentro de 64 KiB (código
+ * fuente, logs). Los bloques ya muy reducidos y los que no repiten nada
+ * en la muestra no se prueban, salvo con diccionario: las repeticiones
+ * pueden estar en él. */
+static int rle2_worth_lz(const RLE2Block *b)
+{
+    if (b->opts->max_ratio)
+        return 1;
+    return b->paylen > b->in_n / 16 && (b->st.repeats != 0 || b->opts->dict);
+}
+
+static size_t rle2_encode_lz(const RLE2Block *b, uint8_t *out, size_t cap)
+{
+    if (b->opts->dict)
+        return lz_encode_dict(b->opts->dict->lz, b->in, b->in_n, out, cap);
+    return lz_encode(b->in, b->in_n, out, cap);
+}
+
+/* Pocos símbolos distintos (texto ASCII, mapas de estado): tabla e
+ * índices de k bits. Huffman puede quedar por debajo, pero esto
+ * descomprime mucho más rápido. Si la muestra ya tiene más de 128
+ * símbolos el bloque también. */
+static int rle2_worth_bitpack(const RLE2Block *b)
+{
+    return b->paylen > b->in_n / 8 + BITPACK_HEADER_SIZE && b->st.distinct <= BITPACK_MAX_SYMBOLS;
+}
+
+static size_t rle2_encode_bitpack(const RLE2Block *b, uint8_t *out, size_t cap)
+{
+    BitpackPlan bp;
+    if (bitpack_plan(b->in, b->in_n, &bp) == 0 || bp.size > cap)
+        return 0;
+    return bitpack_encode(b->in, b->in_n, &bp, out);
+}
+
+/* Huffman: texto y datos con pocos símbolos frecuentes. No baja de 1 bit
+ * por byte ni de la entropía de la muestra (salvo en modo max-ratio, que
+ * siempre calcula el tamaño exacto). */
+static int rle2_worth_huffman(const RLE2Block *b)
+{
+    if (b->paylen <= b->in_n / 8 + HUFFMAN_HEADER_SIZE)
+        return 0;
+    return b->opts->max_ratio || b->st.order0_size + HUFFMAN_HEADER_SIZE < b->paylen;
+}
+
+static size_t rle2_encode_huffman(const RLE2Block *b, uint8_t *out, size_t cap)
+{
+    HuffmanPlan plan;
+    if (huffman_plan(b->in, b->in_n, &plan) > cap)
+        return 0;
+    return huffman_encode(b->in, b->in_n, &plan, out);
+}
+
+/* BWT: el mejor ratio en texto y datos estructurados, a cambio de mucha
+ * CPU. Se salta en bloques que siguen RAW y no tienen redundancia de
+ * orden 0 (datos ya comprimidos o cifrados). */
+static int rle2_worth_bwt(const RLE2Block *b)
+{
+    return b->opts->codec == RLE2_CODEC_BWT && b->paylen > 16 &&
+           (b->tag != RLE2_TAG_RAW || b->st.order0_size < b->in_n);
+}
+
+static size_t rle2_encode_bwt(const RLE2Block *b, uint8_t *out, size_t cap)
+{
+    return bwt_encode(b->in, b->in_n, out, cap);
+}
+
+/* En orden de prueba: los más baratos primero, para que el tope de los
+ * siguientes ya sea pequeño */
+static const RLE2Codec RLE2_CODECS[] = {
+    {RLE2_TAG_RLE, rle2_worth_rle, rle2_encode_rle},
+    {RLE2_TAG_RLE_LONG, rle2_worth_rle_long, rle2_encode_rle_long},
+    {RLE2_TAG_RLE_PERIOD, rle2_worth_rle_period, rle2_encode_rle_period},
+    {RLE2_TAG_LZ, rle2_worth_lz, rle2_encode_lz},
+    {RLE2_TAG_BITPACK, rle2_worth_bitpack, rle2_encode_bitpack},
+    {RLE2_TAG_HUFFMAN, rle2_worth_huffman, rle2_encode_huffman},
+    {RLE2_TAG_BWT, rle2_worth_bwt, rle2_encode_bwt},
+};
+
+/* Codifica un bloque y se queda con la codificación más pequeña.
+ * 'scratch' debe tener al menos RLE2_SCRATCH_SIZE(in_n) bytes. */
+static void rle2_encode_block(const uint8_t *in, size_t in_n, const RLE2Options *opts, uint8_t *scratch,
+                              uint8_t *tag, const uint8_t **payload, uint32_t *paylen)
+{
+    RLE2Block b;
+    b.in = in;
+    b.in_n = in_n;
+    b.opts = opts;
+    b.tag = RLE2_TAG_RAW;
+    b.payload = in;
+    b.paylen = (uint32_t)in_n;
+    blockstat_sample(in, in_n, opts->run_threshold, &b.st);
+
+    if (opts->max_ratio || !blockstat_incompressible(&b.st))
+    {
+        for (size_t c = 0; c < sizeof(RLE2_CODECS) / sizeof(RLE2_CODECS[0]); c++)
+        {
+            const RLE2Codec *codec = &RLE2_CODECS[c];
+            if (b.paylen <= 1 || !codec->worth(&b))
+                continue;
+            uint8_t *alt = rle2_free_alt(scratch, in_n, b.payload);
+            size_t n = codec->encode(&b, alt, b.paylen - 1);
+            if (n != 0)
+            {
+                b.tag = codec->tag;
+                b.payload = alt;
+                b.paylen = (uint32_t)n;
+            }
+        }
+    }
+
+    *tag = b.tag;
+    *payload = b.payload;
+    *paylen = b.paylen;
+}
+
+/* Escritor de bloques: lleva la posición del stream y, en el contenedor
+ * v3, el índice que se añade al final. */
+typedef struct
+{
+    uint64_t raw_off;
+    uint64_t block_off;
+    uint64_t paylen;
+} RLE3IndexEntry;
+
+typedef struct
+{
+    int fd;
+    int seekable;
+    size_t block_size;
+    int run_threshold;
+    const RLE2Options *opts; /* opciones del encoder, vivas durante la compresión */
+    ImageLayout img;         /* píxeles detectados en el primer bloque (stride 0 = no) */
+    uint64_t comp_pos; /* bytes escritos, cabecera incluida */
+    uint64_t raw_pos;  /* bytes sin comprimir cubiertos */
+    RLE3IndexEntry *index;
+    size_t count;
+    size_t cap;
+} RLE2Writer;
+
+/* =======================
+ *  Bloques de imagen
+ *  Si la cabecera del archivo describe píxeles sin comprimir (BMP, PGM,
+ *  PPM), las filas completas de cada bloque se filtran en su sitio con los
+ *  predictores de imgfilter.h antes de codificar. El bloque filtrado solo
+ *  se queda si su codificación no es RAW y, con el prefijo, es más
+ *  pequeña que la del bloque sin filtrar; si no, se deshace el filtro y
+ *  se usa esa.
+ * ======================= */
+
+/* Filas de la imagen que caen enteras en el bloque que empieza en raw_off */
+static size_t rle2_image_rows(const ImageLayout *img, uint64_t raw_off, size_t in_n, size_t *begin)
+{
+    size_t stride = img->stride;
+    if (stride < RLE2_FILTER_MIN_STRIDE || raw_off + in_n <= img->offset)
+        return 0;
+
+    uint64_t first = 0;
+    if (raw_off > img->offset)
+        first = (raw_off - img->offset + stride - 1) / stride;
+    if (first >= img->rows)
+        return 0;
+    uint64_t start = img->offset + first * stride - raw_off;
+    if (start >= in_n)
+        return 0;
+
+    uint64_t rows = (in_n - start) / stride;
+    if (rows > img->rows - first)
+        rows = img->rows - first;
+    *begin = (size_t)start;
+    return (size_t)rows;
+}
+
+static void rle2_encode_image_block(const RLE2Writer *w, uint8_t *in, size_t in_n, size_t begin,
+                                    size_t rows, uint8_t *scratch, uint8_t *tag,
+                                    const uint8_t **payload, uint32_t *paylen)
+{
+    const ImageLayout *img = &w->img;
+    uint8_t *out = rle2_scratch_zone(scratch, in_n, 2);
+
+    /* codificación normal primero, guardada en la zona 3 para compararla */
+    rle2_encode_block(in, in_n, w->opts, scratch, tag, payload, paylen);
+    uint8_t plain_tag = *tag;
+    uint32_t plain_len = *paylen;
+    uint8_t *plain = rle2_scratch_zone(scratch, in_n, 3);
+    if (plain_tag != RLE2_TAG_RAW)
+        memcpy(plain, *payload, plain_len);
+
+    if (imgfilter_encode(in + begin, img->stride, rows, img->bpp, out + RLE2_FILTER_HEADER_SIZE) != 0)
+    {
+        *payload = (plain_tag == RLE2_TAG_RAW) ? in : plain;
+        return;
+    }
+
+    rle2_encode_block(in, in_n, w->opts, scratch, tag, payload, paylen);
+    size_t prefix = RLE2_FILTER_HEADER_SIZE + rows;
+    if (*tag != RLE2_TAG_RAW && prefix + *paylen < plain_len)
+    {
+        out[0] = (uint8_t)img->bpp;
+        u32le_write(out + 1, (uint32_t)img->stride);
+        u32le_write(out + 5, (uint32_t)begin);
+        u32le_write(out + 9, (uint32_t)rows);
+        memcpy(out + prefix, *payload, *paylen);
+        *tag |= RLE2_TAG_FILTERED;
+        *payload = out;
+        *paylen = (uint32_t)(prefix + *paylen);
+        return;
+    }
+
+    /* sin ganancia: restaurar las filas y quedarse con la normal */
+    imgfilter_decode(in + begin, img->stride, rows, img->bpp, out + RLE2_FILTER_HEADER_SIZE);
+    *tag = plain_tag;
+    *paylen = plain_len;
+    *payload = (plain_tag == RLE2_TAG_RAW) ? in : plain;
+}
+
+/* =======================
+ *  Bloques de registros y números
+ *  Dos filtros para datos binarios, que se prueban tras la codificación
+ *  normal (salvo en bloques que ya quedan en menos de 1/8):
+ *    delta    delta.h estima el tamaño de registro por autocorrelación;
+ *             cada byte se resta (o XOR) del mismo byte del registro
+ *             anterior, en su sitio, y luego se restaura
+ *    shuffle  shuffle.h separa los elementos de 2/4/8 bytes (detectado o
+ *             fijado con --shuffle) en planos de bytes, en la zona 3
+ *  La mejor codificación se guarda en la zona 2 con su prefijo.
+ * ======================= */
+
+/* Se queda con la codificación filtrada si, con su prefijo, es más
+ * pequeña que la mejor hasta ahora (guardada en 'best') */
+static void rle2_keep_filtered(uint8_t flag, const uint8_t *prefix, size_t prefix_len, uint8_t tag,
+                               const uint8_t *payload, uint32_t paylen, uint8_t *best,
+                               uint8_t *best_tag, uint32_t *best_len)
+{
+    if (tag == RLE2_TAG_RAW || prefix_len + (size_t)paylen >= *best_len)
+        return;
+    memcpy(best, prefix, prefix_len);
+    memcpy(best + prefix_len, payload, paylen);
+    *best_tag = tag | flag;
+    *best_len = (uint32_t)(prefix_len + paylen);
+}
+
+static void rle2_encode_record_block(const RLE2Writer *w, uint8_t *in, size_t in_n, uint8_t *scratch,
+                                     uint8_t *tag, const uint8_t **payload, uint32_t *paylen)
+{
+    rle2_encode_block(in, in_n, w->opts, scratch, tag, payload, paylen);
+    if (*paylen <= in_n / 8)
+        return;
+
+    int mode = DELTA_SUB;
+    size_t stride = delta_detect(in, in_n, &mode);
+    size_t elem = 0;
+    if (w->opts->shuffle == RLE2_SHUFFLE_AUTO)
+        elem = shuffle_detect(in, in_n);
+    else if (w->opts->shuffle != RLE2_SHUFFLE_OFF)
+        elem = (size_t)w->opts->shuffle;
+    if (stride == 0 && elem == 0)
+        return;
+
+    uint8_t *best = rle2_scratch_zone(scratch, in_n, 2);
+    uint8_t best_tag = *tag;
+    uint32_t best_len = *paylen;
+    if (best_tag != RLE2_TAG_RAW)
+        memcpy(best, *payload, best_len);
+
+    if (stride != 0)
+    {
+        uint8_t prefix[RLE2_DELTA_HEADER_SIZE] = {(uint8_t)stride, (uint8_t)(stride >> 8), (uint8_t)mode};
+        delta_encode(in, in_n, stride, mode);
+        rle2_encode_block(in, in_n, w->opts, scratch, tag, payload, paylen);
+        rle2_keep_filtered(RLE2_TAG_DELTA, prefix, sizeof(prefix), *tag, *payload, *paylen, best,
+                           &best_tag, &best_len);
+        delta_decode(in, in_n, stride, mode);
+    }
+
+    if (elem != 0)
+    {
+        uint8_t prefix[RLE2_SHUFFLE_HEADER_SIZE] = {(uint8_t)elem};
+        uint8_t *planes = rle2_scratch_zone(scratch, in_n, 3);
+        shuffle_encode(in, in_n, elem, planes);
+        rle2_encode_block(planes, in_n, w->opts, scratch, tag, payload, paylen);
+        rle2_keep_filtered(RLE2_TAG_SHUFFLE, prefix, sizeof(prefix), *tag, *payload, *paylen, best,
+                           &best_tag, &best_len);
+    }
+
+    /* si gana la codificación normal y es RAW, el payload es 'in' */
+    *tag = best_tag;
+    *paylen = best_len;
+    *payload = (best_tag == RLE2_TAG_RAW) ? in : best;
+}
+
+/* Codifica un bloque probando antes el filtro que corresponda a los datos */
+static void rle2_encode_filtered_block(const RLE2Writer *w, uint64_t raw_off, uint8_t *in, size_t in_n,
+                                       uint8_t *scratch, uint8_t *tag, const uint8_t **payload,
+                                       uint32_t *paylen)
+{
+    size_t begin = 0;
+    size_t rows = rle2_image_rows(&w->img, raw_off, in_n, &begin);
+    if (rows >= 2)
+        rle2_encode_image_block(w, in, in_n, begin, rows, scratch, tag, payload, paylen);
+    else
+        rle2_encode_record_block(w, in, in_n, scratch, tag, payload, paylen);
+}
+
+static void rle2_writer_init(RLE2Writer *w, int fd_out, const RLE2Options *opts)
+{
+    memset(w, 0, sizeof(*w));
+    w->fd = fd_out;
+    w->seekable = opts->seekable;
+    w->block_size = opts->block_size;
+    w->run_threshold = opts->run_threshold;
+    w->opts = opts;
+}
+
+/* Cabecera del stream; dict_id solo cuenta con has_dict */
+static int rle2_writer_header(RLE2Writer *w, int has_dict, uint32_t dict_id)
+{
+    uint8_t hdr[RLE2_HEADER_MAX];
+    size_t hdr_len = RLE2_HEADER_SIZE;
+    rle2_header_write(hdr, w->seekable, RLE2_REV_CURRENT, w->block_size, w->run_threshold);
+    if (has_dict)
+    {
+        hdr[7] |= RLE2_FLAG_DICT;
+        u32le_write(hdr + RLE2_HEADER_SIZE, dict_id);
+        hdr_len += 4;
+    }
+    if (write_all(w->fd, hdr, hdr_len) != 0)
+        return 1;
+    w->comp_pos = hdr_len;
+    return 0;
+}
+
+static int rle2_writer_begin(RLE2Writer *w, int fd_out, const RLE2Options *opts)
+{
+    rle2_writer_init(w, fd_out, opts);
+    return rle2_writer_header(w, opts->dict != NULL, opts->dict ? opts->dict->id : 0);
+}
+
+static int rle2_index_push(RLE2Writer *w, uint64_t raw_off, uint64_t block_off, uint64_t paylen)
+{
+    if (w->count == w->cap)
+    {
+        size_t ncap = w->cap ? w->cap * 2 : 256;
+        RLE3IndexEntry *ni = (RLE3IndexEntry *)realloc(w->index, ncap * sizeof(RLE3IndexEntry));
+        if (!ni)
+        {
+            fprintf(stderr, "realloc failed\n");
+            return 1;
+        }
+        w->index = ni;
+        w->cap = ncap;
+    }
+    w->index[w->count].raw_off = raw_off;
+    w->index[w->count].block_off = block_off;
+    w->index[w->count].paylen = paylen;
+    w->count++;
+    return 0;
+}
+
+/* Cabecera de un bloque (y su entrada del índice en v3); el payload lo
+ * escribe el llamador justo detrás */
+static int rle2_write_block_header(RLE2Writer *w, uint8_t tag, uint32_t paylen, size_t raw_len)
+{
+    if (w->seekable && rle2_index_push(w, w->raw_pos, w->comp_pos, paylen) != 0)
+        return 1;
+
+    uint8_t header[9];
+    header[0] = tag;
+    u32le_write(header + 1, paylen);
+    u32le_write(header + 5, (uint32_t)raw_len);
+
+    if (write_all(w->fd, header, sizeof(header)) != 0)
+        return 3;
+    w->comp_pos += sizeof(header) + paylen;
+    w->raw_pos += raw_len;
+    return 0;
+}
+
+static int rle2_write_block(RLE2Writer *w, uint8_t tag, const uint8_t *payload,
+                            uint32_t paylen, size_t raw_len)
+{
+    int rc = rle2_write_block_header(w, tag, paylen, raw_len);
+    if (rc != 0)
+        return rc;
+    if (write_all(w->fd, payload, paylen) != 0)
+        return 4;
+    return 0;
+}
+
+/* Cierra el stream: en v3 escribe el bloque de índice y el trailer. */
+static int rle2_writer_finish(RLE2Writer *w)
+{
+    int rc = 0;
+    if (w->seekable)
+    {
+        size_t idx_len = w->count * RLE3_INDEX_ENTRY_SIZE;
+        uint8_t *buf = (uint8_t *)malloc(9 + idx_len + RLE3_TRAILER_SIZE);
+        if (!buf)
+        {
+            fprintf(stderr, "malloc failed\n");
+            free(w->index);
+            return 1;
+        }
+
+        uint8_t *p = buf;
+        *p++ = RLE3_TAG_END;
+        u32le_write(p, (uint32_t)idx_len);
+        u32le_write(p + 4, 0); /* raw_len */
+        p += 8;
+        for (size_t i = 0; i < w->count; i++)
+        {
+            u64le_write(p, w->index[i].raw_off);
+            u64le_write(p + 8, w->index[i].block_off);
+            u64le_write(p + 16, w->index[i].paylen);
+            p += RLE3_INDEX_ENTRY_SIZE;
+        }
+        u64le_write(p, w->comp_pos);
+        u64le_write(p + 8, w->count);
+        u64le_write(p + 16, w->raw_pos);
+        memcpy(p + 24, RLE3_TRAILER_MAGIC, 8);
+        p += RLE3_TRAILER_SIZE;
+
+        if (write_all(w->fd, buf, (size_t)(p - buf)) != 0)
+            rc = 5;
+        free(buf);
+    }
+    free(w->index);
+    w->index = NULL;
+    return rc;
+}
+
+void rle2_default_options(RLE2Options *opts)
+{
+    memset(opts, 0, sizeof(*opts));
+    opts->threads = 0; /* auto */
+    opts->block_size = RLE2_BLOCK_SIZE;
+    opts->run_threshold = RLE2_RUN_THRESHOLD;
+    opts->codec = RLE2_CODEC_FAST;
+    opts->max_ratio = 0;
+    opts->shuffle = RLE2_SHUFFLE_AUTO;
+}
+
+int rle2_validate_options(const RLE2Options *opts)
+{
+    size_t bs = opts->block_size;
+    if (bs < RLE2_MIN_BLOCK_SIZE || bs > RLE2_MAX_BLOCK_SIZE || (bs & (bs - 1)) != 0)
+    {
+        fprintf(stderr, "Invalid block size %zu: must be a power of two between %d KiB and %d MiB.\n",
+                bs, RLE2_MIN_BLOCK_SIZE / 1024, RLE2_MAX_BLOCK_SIZE / (1024 * 1024));
+        return 1;
+    }
+    if (opts->run_threshold < 1 || opts->run_threshold > RLE2_MAX_RUN_THRESHOLD)
+    {
+        fprintf(stderr, "Invalid run threshold %d: must be between 1 and %d.\n",
+                opts->run_threshold, RLE2_MAX_RUN_THRESHOLD);
+        return 1;
+    }
+    if (opts->codec != RLE2_CODEC_FAST && opts->codec != RLE2_CODEC_BWT)
+    {
+        fprintf(stderr, "Invalid codec %d.\n", opts->codec);
+        return 1;
+    }
+    if (opts->shuffle < 0 || opts->shuffle > RLE2_MAX_SHUFFLE)
+    {
+        fprintf(stderr, "Invalid shuffle element size %d: must be between 2 and %d.\n",
+                opts->shuffle, RLE2_MAX_SHUFFLE);
+        return 1;
+    }
+    return 0;
+}
+
+/* Número de hilos efectivo: 0 = uno por CPU (limitado a RLE2_MAX_THREADS). */
+static int rle2_resolve_threads(const RLE2Options *opts)
+{
+    int n = opts ? opts->threads : 0;
+    if (n <= 0)
+    {
+        long nproc = sysconf(_SC_NPROCESSORS_ONLN);
+        n = (nproc < 1) ? 1 : (int)nproc;
+    }
+    if (n > RLE2_MAX_THREADS)
+        n = RLE2_MAX_THREADS;
+    return n;
+}
+
+/* =======================
+ *  Archivos dispersos
+ *  En la entrada regular se pregunta al sistema de archivos dónde hay
+ *  datos (lseek SEEK_DATA / SEEK_HOLE, dos llamadas por extent). Un bloque
+ *  completo que cae dentro de un hueco no se lee: se salta con el offset y
+ *  se emite la codificación de un bloque de ceros, calculada una sola vez
+ *  con el mismo encoder, así que la salida es idéntica a la de leer los
+ *  ceros. Los bloques leídos que son todo ceros (páginas reservadas pero
+ *  vacías) reutilizan esa codificación sin pasar por los codecs.
  * ======================= */
 
-static const uint8_t RLE2_MAGIC[8] = {'R', 'L', 'E', '2', 0, 0, 0, 0};
+typedef struct
+{
+    int enabled;  /* entrada regular: se consultan los huecos */
+    int moved;    /* el offset del fd no está en 'pos' */
+    off_t pos;    /* offset del archivo del siguiente bloque */
+    off_t size;
+    off_t data;   /* [.., data) es hueco */
+    off_t hole;   /* [data, hole) tiene datos */
+    uint8_t zero_tag; /* codificación de un bloque de ceros, o paylen 0 */
+    uint8_t *zero_payload;
+    uint32_t zero_paylen;
+} RLE2Sparse;
+
+static void rle2_sparse_begin(RLE2Sparse *s, int fd)
+{
+    memset(s, 0, sizeof(*s));
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+        return;
+    s->pos = lseek(fd, 0, SEEK_CUR);
+    if (s->pos < 0)
+        return;
+    s->size = st.st_size;
+    s->hole = s->pos; /* fuerza la primera consulta */
+    s->enabled = 1;
+}
+
+/* Antes de leer un bloque de 'n' bytes: 1 si entero es un hueco (queda
+ * saltado), 0 si hay que leerlo con read(). Sin soporte en el sistema de
+ * archivos todo el archivo es un extent de datos. */
+static int rle2_sparse_skip(RLE2Sparse *s, int fd, size_t n)
+{
+    if (!s->enabled)
+        return 0;
+    if (s->pos >= s->hole && s->pos + (off_t)n <= s->size)
+    {
+        off_t d = lseek(fd, s->pos, SEEK_DATA);
+        if (d < 0 && errno == ENXIO)
+            d = s->size; /* solo hueco hasta el final */
+        off_t h = (d >= 0 && d < s->size) ? lseek(fd, d, SEEK_HOLE) : s->size;
+        if (d < 0 || h < 0)
+        {
+            d = s->pos; /* sin respuesta: el resto se lee */
+            h = s->size;
+        }
+        s->data = d;
+        s->hole = h;
+        s->moved = 1;
+    }
+    if (s->pos + (off_t)n <= s->data)
+    {
+        s->pos += (off_t)n;
+        s->moved = 1;
+        return 1;
+    }
+    if (s->moved && lseek(fd, s->pos, SEEK_SET) == s->pos)
+        s->moved = 0;
+    return 0;
+}
+
+/* Deja el offset del fd al final de lo comprimido, como con read() */
+static void rle2_sparse_end(RLE2Sparse *s, int fd)
+{
+    if (s->enabled && s->moved)
+        lseek(fd, s->pos, SEEK_SET);
+    free(s->zero_payload);
+    s->zero_payload = NULL;
+}
+
+static int rle2_all_zero(const uint8_t *p, size_t n)
+{
+    return n > 0 && p[0] == 0 && memcmp(p, p + 1, n - 1) == 0;
+}
+
+/* Codificación del bloque de ceros de w->block_size bytes, la primera vez
+ * que hace falta (un archivo sin ceros no la paga) */
+static int rle2_sparse_zero(RLE2Sparse *s, const RLE2Writer *w, uint8_t *tag,
+                            const uint8_t **payload, uint32_t *paylen)
+{
+    if (s->zero_paylen == 0)
+    {
+        uint8_t *zeros = (uint8_t *)calloc(1, w->block_size);
+        uint8_t *scratch = (uint8_t *)malloc(RLE2_SCRATCH_SIZE(w->block_size));
+        const uint8_t *p = NULL;
+        uint32_t n = 0;
+        if (zeros && scratch)
+        {
+            rle2_encode_block(zeros, w->block_size, w->opts, scratch, &s->zero_tag, &p, &n);
+            s->zero_payload = (uint8_t *)malloc(n);
+        }
+        if (!s->zero_payload)
+        {
+            fprintf(stderr, "malloc failed\n");
+            free(zeros);
+            free(scratch);
+            return 1;
+        }
+        memcpy(s->zero_payload, p, n);
+        s->zero_paylen = n;
+        free(zeros);
+        free(scratch);
+    }
+    *tag = s->zero_tag;
+    *payload = s->zero_payload;
+    *paylen = s->zero_paylen;
+    return 0;
+}
+
+static int rle2_compress_serial(int fd_in, RLE2Writer *w, RLE2Sparse *sp)
+{
+    uint8_t *inbuf = (uint8_t *)malloc(w->block_size);
+    /* En el peor de los casos PackBits se expande ≈1/128 */
+    uint8_t *rlebuf = (uint8_t *)malloc(RLE2_SCRATCH_SIZE(w->block_size));
+    if (!inbuf || !rlebuf)
+    {
+        fprintf(stderr, "malloc failed\n");
+        free(inbuf);
+        free(rlebuf);
+        return 1;
+    }
+
+    int rc = 0;
+    while (rc == 0)
+    {
+        uint8_t tag;
+        const uint8_t *payload;
+        uint32_t paylen;
+        size_t n = w->block_size;
+
+        if (rle2_sparse_skip(sp, fd_in, n))
+        {
+            rc = rle2_sparse_zero(sp, w, &tag, &payload, &paylen);
+        }
+        else
+        {
+            ssize_t r = read(fd_in, inbuf, w->block_size);
+            if (r < 0)
+            {
+                perror("read");
+                rc = 2;
+                break;
+            }
+            if (r == 0)
+                break;
+            n = (size_t)r;
+            sp->pos += r;
+
+            if (w->raw_pos == 0)
+                imgfilter_sniff(inbuf, n, &w->img);
+
+            if (n == w->block_size && rle2_all_zero(inbuf, n))
+                rc = rle2_sparse_zero(sp, w, &tag, &payload, &paylen);
+            else
+                rle2_encode_filtered_block(w, w->raw_pos, inbuf, n, rlebuf, &tag, &payload, &paylen);
+        }
+
+        if (rc == 0)
+            rc = rle2_write_block(w, tag, payload, paylen, n);
+    }
+
+    free(inbuf);
+    free(rlebuf);
+    return rc;
+}
+
+/* =======================
+ *  RLE2 paralelo (un archivo)
+ *  El hilo llamador lee bloques a un anillo de slots, N workers los
+ *  codifican y un hilo escritor los emite en orden de secuencia.
+ *  El formato de salida es idéntico al de la versión secuencial.
+ * ======================= */
+
+enum
+{
+    SLOT_FREE = 0, /* disponible para el lector */
+    SLOT_FILLED,   /* leído, pendiente de codificar */
+    SLOT_ENCODED   /* codificado, pendiente de escribir */
+};
+
+typedef struct
+{
+    uint8_t *in;
+    uint8_t *enc;
+    size_t in_n;
+    uint64_t raw_off; /* posición del bloque en la entrada */
+    uint8_t tag;
+    const uint8_t *payload;
+    uint32_t paylen;
+    int zero; /* bloque de ceros: payload ya puesto por el lector */
+    int state;
+} RLE2Slot;
+
+typedef struct
+{
+    pthread_mutex_t mu;
+    pthread_cond_t cv_free;    /* lector espera slot libre */
+    pthread_cond_t cv_filled;  /* workers esperan bloque leído */
+    pthread_cond_t cv_encoded; /* escritor espera el siguiente bloque */
+
+    RLE2Slot *slots;
+    size_t nslots;
+
+    uint64_t read_seq;   /* bloques entregados por el lector */
+    uint64_t encode_seq; /* siguiente bloque a codificar */
+    uint64_t write_seq;  /* siguiente bloque a escribir */
+    int eof;
+    int rc; /* primer error (0 = OK) */
+
+    RLE2Writer *w;
+} RLE2Pipeline;
+
+static void pipeline_fail(RLE2Pipeline *p, int rc)
+{
+    if (p->rc == 0)
+        p->rc = rc;
+    pthread_cond_broadcast(&p->cv_free);
+    pthread_cond_broadcast(&p->cv_filled);
+    pthread_cond_broadcast(&p->cv_encoded);
+}
+
+static void *rle2_worker_thread(void *arg)
+{
+    RLE2Pipeline *p = (RLE2Pipeline *)arg;
+
+    pthread_mutex_lock(&p->mu);
+    for (;;)
+    {
+        while (p->rc == 0 && p->encode_seq == p->read_seq && !p->eof)
+            pthread_cond_wait(&p->cv_filled, &p->mu);
+        if (p->rc != 0 || p->encode_seq == p->read_seq)
+            break; /* error o no quedan bloques */
+
+        RLE2Slot *s = &p->slots[p->encode_seq % p->nslots];
+        p->encode_seq++;
+        pthread_mutex_unlock(&p->mu);
+
+        if (!s->zero)
+            rle2_encode_filtered_block(p->w, s->raw_off, s->in, s->in_n, s->enc, &s->tag,
+                                       &s->payload, &s->paylen);
+
+        pthread_mutex_lock(&p->mu);
+        s->state = SLOT_ENCODED;
+        pthread_cond_broadcast(&p->cv_encoded);
+    }
+    pthread_mutex_unlock(&p->mu);
+    return NULL;
+}
+
+static void *rle2_writer_thread(void *arg)
+{
+    RLE2Pipeline *p = (RLE2Pipeline *)arg;
+
+    pthread_mutex_lock(&p->mu);
+    for (;;)
+    {
+        RLE2Slot *s = &p->slots[p->write_seq % p->nslots];
+        while (p->rc == 0 && s->state != SLOT_ENCODED &&
+               !(p->eof && p->write_seq == p->read_seq))
+            pthread_cond_wait(&p->cv_encoded, &p->mu);
+        if (p->rc != 0 || s->state != SLOT_ENCODED)
+            break; /* error o fin del stream */
+        pthread_mutex_unlock(&p->mu);
+
+        int rc = rle2_write_block(p->w, s->tag, s->payload, s->paylen, s->in_n);
+
+        pthread_mutex_lock(&p->mu);
+        if (rc != 0)
+        {
+            pipeline_fail(p, rc);
+            break;
+        }
+        s->state = SLOT_FREE;
+        p->write_seq++;
+        pthread_cond_signal(&p->cv_free);
+    }
+    pthread_mutex_unlock(&p->mu);
+    return NULL;
+}
+
+/* Lee hasta 'n' bytes (menos solo en EOF). Devuelve bytes leídos o -1. */
+static ssize_t read_block(int fd, uint8_t *buf, size_t n)
+{
+    size_t off = 0;
+    while (off < n)
+    {
+        ssize_t r = read(fd, buf + off, n - off);
+        if (r < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("read");
+            return -1;
+        }
+        if (r == 0)
+            break;
+        off += (size_t)r;
+    }
+    return (ssize_t)off;
+}
+
+static int rle2_compress_parallel(int fd_in, RLE2Writer *w, RLE2Sparse *sp, int nthreads)
+{
+    RLE2Pipeline p;
+    memset(&p, 0, sizeof(p));
+    p.w = w;
+    p.nslots = (size_t)nthreads * 2;
+
+    p.slots = (RLE2Slot *)calloc(p.nslots, sizeof(RLE2Slot));
+    pthread_t *workers = (pthread_t *)calloc((size_t)nthreads, sizeof(pthread_t));
+    if (!p.slots || !workers)
+    {
+        fprintf(stderr, "malloc failed\n");
+        free(p.slots);
+        free(workers);
+        return 1;
+    }
+    for (size_t i = 0; i < p.nslots; i++)
+    {
+        p.slots[i].in = (uint8_t *)malloc(w->block_size);
+        p.slots[i].enc = (uint8_t *)malloc(RLE2_SCRATCH_SIZE(w->block_size));
+        if (!p.slots[i].in || !p.slots[i].enc)
+        {
+            fprintf(stderr, "malloc failed\n");
+            for (size_t j = 0; j <= i; j++)
+            {
+                free(p.slots[j].in);
+                free(p.slots[j].enc);
+            }
+            free(p.slots);
+            free(workers);
+            return 1;
+        }
+    }
+
+    pthread_mutex_init(&p.mu, NULL);
+    pthread_cond_init(&p.cv_free, NULL);
+    pthread_cond_init(&p.cv_filled, NULL);
+    pthread_cond_init(&p.cv_encoded, NULL);
+
+    pthread_t writer;
+    int started = 0;
+    int writer_started = (pthread_create(&writer, NULL, rle2_writer_thread, &p) == 0);
+    if (writer_started)
+    {
+        for (; started < nthreads; started++)
+        {
+            if (pthread_create(&workers[started], NULL, rle2_worker_thread, &p) != 0)
+                break;
+        }
+    }
+    if (!writer_started || started == 0)
+    {
+        perror("pthread_create");
+        pthread_mutex_lock(&p.mu);
+        pipeline_fail(&p, 1);
+        pthread_mutex_unlock(&p.mu);
+    }
+
+    /* Lector: el hilo llamador. La cabecera de imagen se busca en el primer
+     * bloque antes de publicarlo, así los workers ya la ven. Los huecos y
+     * los bloques de ceros llevan ya su codificación. */
+    uint64_t raw_off = 0;
+    pthread_mutex_lock(&p.mu);
+    while (p.rc == 0)
+    {
+        RLE2Slot *s = &p.slots[p.read_seq % p.nslots];
+        while (p.rc == 0 && s->state != SLOT_FREE)
+            pthread_cond_wait(&p.cv_free, &p.mu);
+        if (p.rc != 0)
+            break;
+        pthread_mutex_unlock(&p.mu);
+
+        ssize_t r = (ssize_t)w->block_size;
+        int hole = rle2_sparse_skip(sp, fd_in, w->block_size);
+        if (!hole)
+        {
+            r = read_block(fd_in, s->in, w->block_size);
+            if (r > 0)
+                sp->pos += r;
+        }
+        s->zero = hole || ((size_t)r == w->block_size && rle2_all_zero(s->in, (size_t)r));
+        int zrc = s->zero ? rle2_sparse_zero(sp, w, &s->tag, &s->payload, &s->paylen) : 0;
+
+        pthread_mutex_lock(&p.mu);
+        if (r < 0 || zrc != 0)
+        {
+            pipeline_fail(&p, r < 0 ? 2 : 1);
+            break;
+        }
+        if (r == 0)
+        {
+            p.eof = 1;
+            pthread_cond_broadcast(&p.cv_filled);
+            pthread_cond_broadcast(&p.cv_encoded);
+            break;
+        }
+        if (p.read_seq == 0 && !hole)
+            imgfilter_sniff(s->in, (size_t)r, &w->img);
+        s->in_n = (size_t)r;
+        s->raw_off = raw_off;
+        raw_off += (size_t)r;
+        s->state = SLOT_FILLED;
+        p.read_seq++;
+        pthread_cond_signal(&p.cv_filled);
+    }
+    pthread_mutex_unlock(&p.mu);
+
+    for (int i = 0; i < started; i++)
+        pthread_join(workers[i], NULL);
+    if (writer_started)
+        pthread_join(writer, NULL);
+
+    int rc = p.rc;
+
+    pthread_cond_destroy(&p.cv_encoded);
+    pthread_cond_destroy(&p.cv_filled);
+    pthread_cond_destroy(&p.cv_free);
+    pthread_mutex_destroy(&p.mu);
+    for (size_t i = 0; i < p.nslots; i++)
+    {
+        free(p.slots[i].in);
+        free(p.slots[i].enc);
+    }
+    free(p.slots);
+    free(workers);
+    return rc;
+}
+
+/* Codifica fd_in hasta EOF con el escritor ya preparado y cierra el stream */
+static int rle2_compress_blocks(int fd_in, RLE2Writer *w)
+{
+    int nthreads = rle2_resolve_threads(w->opts);
+
+    /* Archivos pequeños: secuencial para evitar el overhead de hilos */
+    struct stat st;
+    if (fstat(fd_in, &st) == 0 && S_ISREG(st.st_mode) &&
+        st.st_size < RLE2_PARALLEL_THRESHOLD)
+        nthreads = 1;
+
+    RLE2Sparse sp;
+    rle2_sparse_begin(&sp, fd_in);
+    int rc = (nthreads <= 1) ? rle2_compress_serial(fd_in, w, &sp)
+                             : rle2_compress_parallel(fd_in, w, &sp, nthreads);
+    rle2_sparse_end(&sp, fd_in);
+    if (rc != 0)
+    {
+        free(w->index);
+        return rc;
+    }
+    return rle2_writer_finish(w);
+}
+
+int rle2_compress_stream(int fd_in, int fd_out, const RLE2Options *opts)
+{
+    RLE2Options defaults;
+    if (!opts)
+    {
+        rle2_default_options(&defaults);
+        opts = &defaults;
+    }
+    if (rle2_validate_options(opts) != 0)
+        return 1;
+
+    RLE2Writer w;
+    if (rle2_writer_begin(&w, fd_out, opts) != 0)
+        return 1;
+    return rle2_compress_blocks(fd_in, &w);
+}
+
+/* =======================
+ *  Archivos almacenados
+ *  Para datos que ya vienen comprimidos (el llamador decide, ver
+ *  file_manager.c): cabecera con RLE2_FLAG_STORED y detrás los bytes tal
+ *  cual, sin cabeceras de bloque. En Linux la copia la hace el kernel con
+ *  copy_file_range (sin pasar por espacio de usuario, y con reflink en
+ *  los sistemas de archivos que lo tienen); si no se puede (pipes,
+ *  sistemas de archivos distintos en kernels antiguos) se copia con
+ *  read/write.
+ * ======================= */
+
+#define RLE2_COPY_CHUNK (1024 * 1024)
+
+/* Copia hasta 'len' bytes (UINT64_MAX = hasta EOF) desde la posición
+ * actual de fd_in a la de fd_out */
+static int rle2_copy_fd(int fd_in, int fd_out, uint64_t len)
+{
+    int kernel = 1;
+    uint8_t *buf = NULL;
+    while (len > 0)
+    {
+        size_t want = (len > RLE2_COPY_CHUNK * 64) ? RLE2_COPY_CHUNK * 64 : (size_t)len;
+        ssize_t n;
+#ifdef __linux__
+        if (kernel)
+        {
+            n = copy_file_range(fd_in, NULL, fd_out, NULL, want, 0);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0 && (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EBADF ||
+                          errno == EOPNOTSUPP))
+            {
+                kernel = 0;
+                continue;
+            }
+            if (n < 0)
+            {
+                perror("copy_file_range");
+                return 1;
+            }
+            if (n == 0)
+                break;
+            len -= (uint64_t)n;
+            continue;
+        }
+#else
+        kernel = 0;
+#endif
+        if (!buf)
+        {
+            buf = (uint8_t *)malloc(RLE2_COPY_CHUNK);
+            if (!buf)
+            {
+                fprintf(stderr, "malloc failed\n");
+                return 1;
+            }
+        }
+        n = read(fd_in, buf, (want < RLE2_COPY_CHUNK) ? want : RLE2_COPY_CHUNK);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+        {
+            perror("read");
+            free(buf);
+            return 1;
+        }
+        if (n == 0)
+            break;
+        if (write_all(fd_out, buf, (size_t)n) != 0)
+        {
+            free(buf);
+            return 1;
+        }
+        len -= (uint64_t)n;
+    }
+    free(buf);
+    return 0;
+}
+
+int rle2_store_stream(int fd_in, int fd_out)
+{
+    uint8_t hdr[RLE2_HEADER_SIZE];
+    rle2_header_write(hdr, 0, RLE2_REV_CURRENT, 0, 0); /* sin bloques: ni tamaño ni umbral */
+    hdr[7] = RLE2_FLAG_STORED;
+    if (write_all(fd_out, hdr, sizeof(hdr)) != 0)
+        return 1;
+    return rle2_copy_fd(fd_in, fd_out, UINT64_MAX);
+}
+
+/* Datos de un archivo almacenado en [skip, skip + limit), con fd_in justo
+ * después de la cabecera */
+static int rle2_extract_stored(int fd_in, int fd_out, uint64_t skip, uint64_t limit)
+{
+    if (skip > 0 && lseek(fd_in, (off_t)skip, SEEK_CUR) < 0)
+    {
+        if (errno != ESPIPE)
+        {
+            perror("lseek");
+            return 1;
+        }
+        /* pipe: leer y descartar */
+        uint8_t buf[4096];
+        while (skip > 0)
+        {
+            ssize_t n = read(fd_in, buf, (skip < sizeof(buf)) ? (size_t)skip : sizeof(buf));
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0)
+            {
+                perror("read");
+                return 1;
+            }
+            if (n == 0)
+                return 0;
+            skip -= (uint64_t)n;
+        }
+    }
+    return rle2_copy_fd(fd_in, fd_out, limit);
+}
+
+/* =======================
+ *  Decodificación de bloques
+ * ======================= */
+
+static int pread_all(int fd, uint8_t *buf, size_t n, off_t off)
+{
+    size_t done = 0;
+    while (done < n)
+    {
+        ssize_t r = pread(fd, buf + done, n - done, off + (off_t)done);
+        if (r < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("pread");
+            return -1;
+        }
+        if (r == 0)
+            return 1; /* EOF antes de n bytes */
+        done += (size_t)r;
+    }
+    return 0;
+}
+
+/* Cabecera completa (con el ID de diccionario) leída con pread */
+static int rle2_header_pread(int fd, RLE2Header *h)
+{
+    uint8_t hdr[RLE2_HEADER_MAX];
+    if (pread_all(fd, hdr, RLE2_HEADER_SIZE, 0) != 0 || rle2_header_parse(hdr, h) != 0)
+        return 1;
+    if (h->has_dict)
+    {
+        if (pread_all(fd, hdr + RLE2_HEADER_SIZE, 4, RLE2_HEADER_SIZE) != 0)
+            return 1;
+        rle2_header_dict_id(hdr + RLE2_HEADER_SIZE, h);
+    }
+    return 0;
+}
+
+static int pwrite_all(int fd, const uint8_t *buf, size_t n, off_t off)
+{
+    size_t done = 0;
+    while (done < n)
+    {
+        ssize_t w = pwrite(fd, buf + done, n - done, off + (off_t)done);
+        if (w < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("pwrite");
+            return -1;
+        }
+        done += (size_t)w;
+    }
+    return 0;
+}
+
+/* =======================
+ *  Salida dispersa
+ *  Con opts->sparse y salida regular, los bloques del sistema de archivos
+ *  (st_blksize, alineados al offset) que salen enteros a cero no se
+ *  escriben y quedan como huecos. Donde el archivo ya tenía datos se
+ *  perforan con fallocate(PUNCH_HOLE), o se escriben los ceros si el
+ *  sistema de archivos no lo admite. La longitud final la fija un
+ *  ftruncate, por si el archivo acaba en hueco.
+ * ======================= */
+
+typedef struct
+{
+    size_t unit;  /* bloque del sistema de archivos; 0 = se escribe todo */
+    off_t filled; /* tamaño previo del archivo: por debajo hay que perforar */
+} RLE2Holes;
+
+static void rle2_holes_begin(RLE2Holes *hs, int fd, const RLE2Options *opts)
+{
+    memset(hs, 0, sizeof(*hs));
+    struct stat st;
+    if (!opts || !opts->sparse || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+        return;
+    hs->unit = (st.st_blksize >= 512) ? (size_t)st.st_blksize : 4096;
+    hs->filled = st.st_size;
+}
+
+/* Tramo a cero [off, off + n) de la salida */
+static int rle2_hole(const RLE2Holes *hs, int fd, const uint8_t *zeros, size_t n, off_t off)
+{
+    if (off >= hs->filled)
+        return 0;
+    size_t len = (off + (off_t)n > hs->filled) ? (size_t)(hs->filled - off) : n;
+    if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, off, (off_t)len) == 0)
+        return 0;
+    return pwrite_all(fd, zeros, len, off);
+}
+
+/* pwrite_all que deja como huecos los bloques enteros a cero */
+static int rle2_write_out(const RLE2Holes *hs, int fd, const uint8_t *buf, size_t n, off_t off)
+{
+    if (hs->unit == 0)
+        return pwrite_all(fd, buf, n, off);
+
+    size_t unit = hs->unit;
+    size_t start = 0; /* datos pendientes desde aquí */
+    size_t i = (unit - (size_t)((uint64_t)off % unit)) % unit;
+    while (i + unit <= n)
+    {
+        if (!rle2_all_zero(buf + i, unit))
+        {
+            i += unit;
+            continue;
+        }
+        size_t z = i + unit;
+        while (z + unit <= n && rle2_all_zero(buf + z, unit))
+            z += unit;
+        if (i > start && pwrite_all(fd, buf + start, i - start, off + (off_t)start) != 0)
+            return -1;
+        if (rle2_hole(hs, fd, buf + i, z - i, off + (off_t)i) != 0)
+            return -1;
+        start = i = z;
+    }
+    if (n > start)
+        return pwrite_all(fd, buf + start, n - start, off + (off_t)start);
+    return 0;
+}
+
+/* Tras la escritura secuencial: longitud final (por si acaba en hueco) y
+ * offset del fd al final de la salida, como lo habría dejado write() */
+static int rle2_holes_finish(int fd, off_t end)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (st.st_size < end && ftruncate(fd, end) != 0) ||
+        lseek(fd, end, SEEK_SET) < 0)
+    {
+        perror("ftruncate");
+        return 1;
+    }
+    return 0;
+}
+
+/* Prefijo de un bloque filtrado: valida la geometría contra raw_len y
+ * deja en *types los tipos de fila y en *inner el payload interno. */
+static int rle2_filter_prefix(const uint8_t *payload, uint32_t paylen, uint32_t raw_len,
+                              ImageLayout *img, size_t *begin, const uint8_t **types,
+                              const uint8_t **inner, uint32_t *inner_len)
+{
+    if (paylen < RLE2_FILTER_HEADER_SIZE || raw_len == 0)
+        return 1;
+    uint32_t stride = u32le_read(payload + 1);
+    uint32_t start = u32le_read(payload + 5);
+    uint32_t rows = u32le_read(payload + 9);
+    img->bpp = payload[0];
+    if (img->bpp < 1 || img->bpp > IMGFILTER_MAX_BPP || stride < (uint32_t)img->bpp ||
+        rows > paylen - RLE2_FILTER_HEADER_SIZE ||
+        (uint64_t)start + (uint64_t)rows * stride > raw_len)
+        return 1;
+
+    img->offset = 0;
+    img->stride = stride;
+    img->rows = rows;
+    *begin = start;
+    *types = payload + RLE2_FILTER_HEADER_SIZE;
+    *inner = *types + rows;
+    *inner_len = paylen - RLE2_FILTER_HEADER_SIZE - rows;
+    return 0;
+}
+
+static int rle2_decode_shuffled(uint8_t tag, const uint8_t *payload, uint32_t paylen,
+                                uint32_t raw_len, uint8_t *dst, const RLE2Dict *dict,
+                                const uint8_t **data, size_t *data_len);
+
+/* Decodifica un payload. raw_len es el tamaño registrado en la cabecera
+ * (0 en revisión 0) y acota la salida junto con dst_cap. Un bloque RAW no
+ * se copia: *data apunta al payload; uno RLE se decodifica en dst. Un
+ * bloque filtrado se decodifica siempre en dst y se le quita el filtro.
+ * 'dict' es el diccionario del archivo (NULL si no tiene). */
+static int rle2_decode_payload(uint8_t tag, const uint8_t *payload, uint32_t paylen,
+                               uint32_t raw_len, uint8_t *dst, size_t dst_cap,
+                               const RLE2Dict *dict, const uint8_t **data, size_t *data_len)
+{
+    if (raw_len != 0)
+    {
+        if (raw_len > dst_cap)
+        {
+            fprintf(stderr, "RLE2 block larger than its destination.\n");
+            return 6;
+        }
+        dst_cap = raw_len;
+    }
+    if (tag & RLE2_TAG_SHUFFLE)
+        return rle2_decode_shuffled(tag, payload, paylen, raw_len, dst, dict, data, data_len);
+
+    ImageLayout img;
+    size_t begin = 0;
+    const uint8_t *types = NULL;
+    size_t stride = 0;
+    int mode = DELTA_SUB;
+    if (tag & RLE2_TAG_DELTA)
+    {
+        if (paylen < RLE2_DELTA_HEADER_SIZE || raw_len == 0 || payload[2] > DELTA_XOR ||
+            (tag & RLE2_TAG_FLAGS) != RLE2_TAG_DELTA)
+        {
+            fprintf(stderr, "Corrupted RLE2 block payload.\n");
+            return 6;
+        }
+        stride = (size_t)payload[0] | ((size_t)payload[1] << 8);
+        mode = payload[2];
+        payload += RLE2_DELTA_HEADER_SIZE;
+        paylen -= RLE2_DELTA_HEADER_SIZE;
+        tag &= (uint8_t)~RLE2_TAG_DELTA;
+    }
+    if (tag & RLE2_TAG_FILTERED)
+    {
+        if (rle2_filter_prefix(payload, paylen, raw_len, &img, &begin, &types, &payload, &paylen) != 0)
+        {
+            fprintf(stderr, "Corrupted RLE2 block payload.\n");
+            return 6;
+        }
+        tag &= (uint8_t)~RLE2_TAG_FILTERED;
+    }
+
+    if (tag == RLE2_TAG_RAW)
+    {
+        if (paylen > dst_cap)
+        {
+            fprintf(stderr, "RLE2 block larger than its destination.\n");
+            return 6;
+        }
+        *data = payload;
+        *data_len = paylen;
+    }
+    else if (tag == RLE2_TAG_RLE || tag == RLE2_TAG_RLE_LONG || tag == RLE2_TAG_RLE_PERIOD ||
+             tag == RLE2_TAG_HUFFMAN || tag == RLE2_TAG_LZ || tag == RLE2_TAG_BWT ||
+             tag == RLE2_TAG_BITPACK)
+    {
+        int bad;
+        if (tag == RLE2_TAG_RLE)
+            bad = packbits_decode(payload, paylen, dst, dst_cap, data_len);
+        else if (tag == RLE2_TAG_RLE_LONG)
+            bad = packbits_decode_long(payload, paylen, dst, dst_cap, data_len);
+        else if (tag == RLE2_TAG_HUFFMAN)
+            bad = huffman_decode(payload, paylen, dst, dst_cap, data_len);
+        else if (tag == RLE2_TAG_LZ && dict)
+            bad = lz_decode_dict(dict->data, dict->size, payload, paylen, dst, dst_cap, data_len);
+        else if (tag == RLE2_TAG_LZ)
+            bad = lz_decode(payload, paylen, dst, dst_cap, data_len);
+        else if (tag == RLE2_TAG_BWT)
+            bad = bwt_decode(payload, paylen, dst, dst_cap, data_len);
+        else if (tag == RLE2_TAG_BITPACK)
+            bad = bitpack_decode(payload, paylen, dst, dst_cap, data_len);
+        else
+            bad = paylen == 0 || packbits_decode_period(payload + 1, paylen - 1, payload[0],
+                                                         dst, dst_cap, data_len);
+        if (bad)
+        {
+            fprintf(stderr, "Corrupted RLE2 block payload.\n");
+            return 6;
+        }
+        *data = dst;
+    }
+    else
+    {
+        fprintf(stderr, "Unknown block tag: 0x%02X\n", tag);
+        return 8;
+    }
+
+    if (raw_len != 0 && *data_len != raw_len)
+    {
+        fprintf(stderr, "RLE2 block size does not match its header.\n");
+        return 6;
+    }
+
+    if ((types || stride) && *data != dst)
+    {
+        memcpy(dst, *data, *data_len);
+        *data = dst;
+    }
+    if (stride)
+        delta_decode(dst, *data_len, stride, mode);
+    if (types && imgfilter_decode(dst + begin, img.stride, (size_t)img.rows, img.bpp, types) != 0)
+    {
+        fprintf(stderr, "Corrupted RLE2 block payload.\n");
+        return 6;
+    }
+    return 0;
+}
+
+/* Bloque con shuffle: los planos se decodifican en un buffer aparte
+ * (raw_len bytes) y se vuelven a intercalar en dst. */
+static int rle2_decode_shuffled(uint8_t tag, const uint8_t *payload, uint32_t paylen,
+                                uint32_t raw_len, uint8_t *dst, const RLE2Dict *dict,
+                                const uint8_t **data, size_t *data_len)
+{
+    if (paylen < RLE2_SHUFFLE_HEADER_SIZE || raw_len == 0 || payload[0] < 2 ||
+        payload[0] > SHUFFLE_MAX_ELEM || (tag & RLE2_TAG_FLAGS) != RLE2_TAG_SHUFFLE)
+    {
+        fprintf(stderr, "Corrupted RLE2 block payload.\n");
+        return 6;
+    }
+    size_t elem = payload[0];
+
+    uint8_t *planes = (uint8_t *)malloc(raw_len);
+    if (!planes)
+    {
+        fprintf(stderr, "malloc failed\n");
+        return 3;
+    }
+    const uint8_t *inner;
+    size_t inner_len;
+    int rc = rle2_decode_payload(tag & (uint8_t)~RLE2_TAG_SHUFFLE, payload + RLE2_SHUFFLE_HEADER_SIZE,
+                                 paylen - RLE2_SHUFFLE_HEADER_SIZE, raw_len, planes, raw_len, dict,
+                                 &inner, &inner_len);
+    if (rc == 0)
+    {
+        shuffle_decode(inner, inner_len, elem, dst);
+        *data = dst;
+        *data_len = inner_len;
+    }
+    free(planes);
+    return rc;
+}
+
+/* Decodifica el stream en secuencial. Solo se escribe la parte de la
+ * salida que cae en [skip, skip + limit); con skip = 0 y limit = UINT64_MAX
+ * es la descompresión completa. */
+static int rle2_decompress_serial_range(int fd_in, int fd_out, uint64_t skip, uint64_t limit,
+                                        const RLE2Options *opts)
+{
+    uint8_t hdr[RLE2_HEADER_MAX];
+    RLE2Header h;
+    if (read_all(fd_in, hdr, RLE2_HEADER_SIZE) != 0)
+    {
+        fprintf(stderr, "Invalid or short header for RLE2.\n");
+        return 1;
+    }
+    if (rle2_header_parse(hdr, &h) != 0)
+    {
+        fprintf(stderr, "Not an RLE2 file.\n");
+        return 1;
+    }
+    if (h.stored)
+        return rle2_extract_stored(fd_in, fd_out, skip, limit);
+    if (h.has_dict)
+    {
+        if (read_all(fd_in, hdr + RLE2_HEADER_SIZE, 4) != 0)
+        {
+            fprintf(stderr, "Invalid or short header for RLE2.\n");
+            return 1;
+        }
+        rle2_header_dict_id(hdr + RLE2_HEADER_SIZE, &h);
+    }
+    const RLE2Dict *dict;
+    if (rle2_header_dict(&h, opts, &dict) != 0)
+        return 1;
+
+    RLE2Holes hs;
+    rle2_holes_begin(&hs, fd_out, opts);
+    off_t out_off = hs.unit ? lseek(fd_out, 0, SEEK_CUR) : 0;
+    if (out_off < 0)
+    {
+        hs.unit = 0;
+        out_off = 0;
+    }
+
+    /* Buffers for a block */
+    size_t in_cap = RLE2_DEC_IN_CAP(h.block_size);
+    size_t out_cap = RLE2_DEC_OUT_CAP(h.block_size);
+    uint8_t *inbuf = (uint8_t *)malloc(in_cap);
+    uint8_t *outbuf = (uint8_t *)malloc(out_cap);
+    if (!inbuf || !outbuf)
+    {
+        fprintf(stderr, "malloc failed\n");
+        free(inbuf);
+        free(outbuf);
+        return 1;
+    }
+
+    uint64_t end = (limit > UINT64_MAX - skip) ? UINT64_MAX : skip + limit;
+    uint64_t pos = 0; /* offset de salida del bloque actual */
+    int rc = 0;
+
+    while (pos < end)
+    {
+        uint8_t blk_hdr[9];
+        int r = read_all(fd_in, blk_hdr, h.blk_hdr_len);
+        if (r != 0)
+        {
+            if (r != 1) /* 1 = EOF cleanly; otherwise error already printed */
+                rc = 2;
+            break;
+        }
+
+        uint8_t tag = blk_hdr[0];
+        uint32_t paylen = u32le_read(&blk_hdr[1]);
+        uint32_t raw_len = (h.blk_hdr_len == 9) ? u32le_read(&blk_hdr[5]) : 0;
+
+        if (h.v3 && tag == RLE3_TAG_END)
+            break; /* índice: fin de los bloques de datos */
+        if (paylen == 0)
+            continue; /* empty block */
+        if (paylen > in_cap || raw_len > out_cap)
+        {
+            size_t ni = (paylen > in_cap) ? paylen : in_cap;
+            size_t no = (raw_len > out_cap) ? raw_len : out_cap;
+            uint8_t *nb_in = (uint8_t *)realloc(inbuf, ni);
+            if (nb_in)
+                inbuf = nb_in;
+            uint8_t *nb_out = nb_in ? (uint8_t *)realloc(outbuf, no) : NULL;
+            if (nb_out)
+                outbuf = nb_out;
+            if (!nb_in || !nb_out)
+            {
+                fprintf(stderr, "realloc failed\n");
+                rc = 3;
+                break;
+            }
+            in_cap = ni;
+            out_cap = no;
+        }
+
+        if (read_all(fd_in, inbuf, paylen) != 0)
+        {
+            fprintf(stderr, "Truncated RLE2 block payload.\n");
+            rc = 4;
+            break;
+        }
+
+        const uint8_t *data;
+        size_t data_len;
+        rc = rle2_decode_payload(tag, inbuf, paylen, raw_len, outbuf, out_cap, dict, &data, &data_len);
+        if (rc != 0)
+            break;
+
+        /* Recortar el bloque al rango pedido */
+        uint64_t b_start = pos, b_end = pos + data_len;
+        pos = b_end;
+        if (b_end <= skip)
+            continue;
+        uint64_t from = (b_start < skip) ? skip - b_start : 0;
+        uint64_t to = (b_end > end) ? end - b_start : data_len;
+        size_t len = (size_t)(to - from);
+        int wr = hs.unit ? rle2_write_out(&hs, fd_out, data + from, len, out_off)
+                         : write_all(fd_out, data + from, len);
+        out_off += (off_t)len;
+        if (wr != 0)
+        {
+            rc = (tag == RLE2_TAG_RAW) ? 5 : 7;
+            break;
+        }
+    }
+    if (rc == 0 && hs.unit && rle2_holes_finish(fd_out, out_off) != 0)
+        rc = 7;
+
+    free(inbuf);
+    free(outbuf);
+    return rc;
+}
+
+static int rle2_decompress_serial(int fd_in, int fd_out, const RLE2Options *opts)
+{
+    return rle2_decompress_serial_range(fd_in, fd_out, 0, UINT64_MAX, opts);
+}
+
+/* =======================
+ *  RLE2 paralelo (descompresión)
+ *  1) Se obtiene la posición de cada bloque y su offset de salida:
+ *     - v3: directamente del índice.
+ *     - resto: recorriendo las cabeceras con pread, saltando los payloads.
+ *       Desde la revisión 1 cada cabecera trae el tamaño decodificado; en
+ *       revisión 0 RAW conoce su tamaño y un bloque RLE que no es el último
+ *       ocupa un bloque completo (el compresor siempre los emite llenos).
+ *  2) Los workers decodifican bloques y los escriben con pwrite en su sitio.
+ *  Si un bloque de revisión 0 no cumple la suposición (p.ej. un stream
+ *  generado desde un pipe con lecturas cortas) se repite en secuencial.
+ * ======================= */
+
+typedef struct
+{
+    off_t block_off; /* offset de la cabecera del bloque (tag) */
+    off_t out_off;   /* offset de salida */
+    uint32_t paylen;
+    uint32_t raw_len; /* 0 = desconocido (revisión 0) */
+} RLE2BlockRef;
+
+typedef struct
+{
+    RLE2BlockRef *blocks;
+    size_t count;
+    size_t blk_hdr_len;
+    size_t block_size;
+    int exact;          /* 1 si out_off/raw_len son exactos para todos los bloques */
+    uint64_t total_raw; /* tamaño descomprimido total (solo si exact) */
+    off_t blocks_end;   /* fin de los bloques de datos (bloque de índice en v3) */
+    const RLE2Dict *dict;
+} RLE2BlockMap;
+
+typedef struct
+{
+    int fd_in;
+    int fd_out;
+    RLE2Holes holes;
+    const RLE2BlockMap *map;
+
+    pthread_mutex_t mu;
+    size_t next; /* siguiente bloque a repartir */
+    int rc;
+    int layout_mismatch;
+    off_t out_end; /* fin real del último bloque */
+} RLE2DecodeJob;
+
+static int rle2_map_push(RLE2BlockMap *map, size_t *cap, const RLE2BlockRef *ref)
+{
+    if (map->count == *cap)
+    {
+        size_t ncap = *cap ? *cap * 2 : 256;
+        RLE2BlockRef *nb = (RLE2BlockRef *)realloc(map->blocks, ncap * sizeof(RLE2BlockRef));
+        if (!nb)
+        {
+            fprintf(stderr, "realloc failed\n");
+            return 3;
+        }
+        map->blocks = nb;
+        *cap = ncap;
+    }
+    map->blocks[map->count++] = *ref;
+    return 0;
+}
+
+/* v3: un pread del trailer y otro del índice. */
+static int rle3_load_index(int fd_in, off_t file_size, const RLE2Header *h, RLE2BlockMap *map)
+{
+    uint8_t tr[RLE3_TRAILER_SIZE];
+    if (file_size < (off_t)(h->hdr_len + h->blk_hdr_len + RLE3_TRAILER_SIZE) ||
+        pread_all(fd_in, tr, sizeof(tr), file_size - RLE3_TRAILER_SIZE) != 0 ||
+        memcmp(tr + 24, RLE3_TRAILER_MAGIC, 8) != 0)
+    {
+        fprintf(stderr, "Missing or corrupted RLE3 index trailer.\n");
+        return 2;
+    }
+    uint64_t index_off = u64le_read(tr);
+    uint64_t count = u64le_read(tr + 8);
+    uint64_t total = u64le_read(tr + 16);
+    if (count > (uint64_t)file_size / RLE3_INDEX_ENTRY_SIZE ||
+        index_off + h->blk_hdr_len + count * RLE3_INDEX_ENTRY_SIZE + RLE3_TRAILER_SIZE != (uint64_t)file_size)
+    {
+        fprintf(stderr, "Corrupted RLE3 index.\n");
+        return 2;
+    }
+
+    size_t idx_len = (size_t)count * RLE3_INDEX_ENTRY_SIZE;
+    uint8_t *idx = (uint8_t *)malloc(idx_len ? idx_len : 1);
+    RLE2BlockRef *blocks = (RLE2BlockRef *)malloc((count ? count : 1) * sizeof(RLE2BlockRef));
+    if (!idx || !blocks)
+    {
+        fprintf(stderr, "malloc failed\n");
+        free(idx);
+        free(blocks);
+        return 3;
+    }
+    if (pread_all(fd_in, idx, idx_len, (off_t)(index_off + h->blk_hdr_len)) != 0)
+    {
+        fprintf(stderr, "Truncated RLE3 index.\n");
+        free(idx);
+        free(blocks);
+        return 2;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const uint8_t *e = idx + i * RLE3_INDEX_ENTRY_SIZE;
+        uint64_t raw_off = u64le_read(e);
+        uint64_t block_off = u64le_read(e + 8);
+        uint64_t paylen = u64le_read(e + 16);
+        uint64_t raw_end = (i + 1 < count) ? u64le_read(e + RLE3_INDEX_ENTRY_SIZE) : total;
+        if (raw_end < raw_off || raw_end - raw_off > UINT32_MAX || paylen > UINT32_MAX ||
+            block_off + h->blk_hdr_len + paylen > index_off)
+        {
+            fprintf(stderr, "Corrupted RLE3 index entry %zu.\n", i);
+            free(idx);
+            free(blocks);
+            return 2;
+        }
+        blocks[i].block_off = (off_t)block_off;
+        blocks[i].out_off = (off_t)raw_off;
+        blocks[i].paylen = (uint32_t)paylen;
+        blocks[i].raw_len = (uint32_t)(raw_end - raw_off);
+    }
+    free(idx);
+
+    map->blocks = blocks;
+    map->count = (size_t)count;
+    map->exact = 1;
+    map->total_raw = total;
+    map->blocks_end = (off_t)index_off;
+    return 0;
+}
+
+/* Recorre las cabeceras sin leer payloads. */
+static int rle2_scan_blocks(int fd_in, off_t file_size, const RLE2Header *h, RLE2BlockMap *map)
+{
+    size_t cap = 0;
+    off_t pos = (off_t)h->hdr_len;
+    off_t out_off = 0;
+    map->exact = (h->rev >= RLE2_REV_SIZED);
+
+    while (pos < file_size)
+    {
+        uint8_t blk_hdr[9];
+        if (pread_all(fd_in, blk_hdr, h->blk_hdr_len, pos) != 0)
+        {
+            fprintf(stderr, "Truncated RLE2 block header.\n");
+            return 2;
+        }
+        uint8_t tag = blk_hdr[0];
+        uint32_t paylen = u32le_read(&blk_hdr[1]);
+        uint32_t raw_len = map->exact ? u32le_read(&blk_hdr[5]) : 0;
+
+        if (!rle2_tag_known(tag))
+        {
+            fprintf(stderr, "Unknown block tag: 0x%02X\n", tag);
+            return 8;
+        }
+        if (pos + (off_t)h->blk_hdr_len + (off_t)paylen > file_size)
+        {
+            fprintf(stderr, "Truncated RLE2 block payload.\n");
+            return 4;
+        }
+
+        if (paylen > 0)
+        {
+            RLE2BlockRef ref = {pos, out_off, paylen, raw_len};
+            if (rle2_map_push(map, &cap, &ref) != 0)
+                return 3;
+            if (map->exact)
+                out_off += raw_len;
+            else
+                out_off += (tag == RLE2_TAG_RAW) ? (off_t)paylen : (off_t)h->block_size;
+        }
+        pos += (off_t)h->blk_hdr_len + (off_t)paylen;
+    }
+
+    map->total_raw = map->exact ? (uint64_t)out_off : 0;
+    map->blocks_end = pos;
+    return 0;
+}
+
+/* Construye el mapa de bloques según el contenedor. */
+static int rle2_build_block_map(int fd_in, off_t file_size, const RLE2Header *h,
+                                const RLE2Dict *dict, RLE2BlockMap *map)
+{
+    memset(map, 0, sizeof(*map));
+    map->blk_hdr_len = h->blk_hdr_len;
+    map->block_size = h->block_size;
+    map->dict = dict;
+    int rc = h->v3 ? rle3_load_index(fd_in, file_size, h, map)
+                   : rle2_scan_blocks(fd_in, file_size, h, map);
+    if (rc != 0)
+    {
+        free(map->blocks);
+        map->blocks = NULL;
+    }
+    return rc;
+}
+
+/* Lee un bloque (cabecera + payload) con pread y lo decodifica en *outbuf,
+ * que crece si el bloque registra un tamaño mayor. */
+static int rle2_read_block_at(int fd_in, const RLE2BlockMap *map, const RLE2BlockRef *b,
+                              uint8_t **inbuf, size_t *in_cap, uint8_t **outbuf, size_t *out_cap,
+                              const uint8_t **data, size_t *data_len)
+{
+    size_t need = map->blk_hdr_len + (size_t)b->paylen;
+    if (need > *in_cap)
+    {
+        uint8_t *nb = (uint8_t *)realloc(*inbuf, need);
+        if (!nb)
+        {
+            fprintf(stderr, "realloc failed\n");
+            return 3;
+        }
+        *inbuf = nb;
+        *in_cap = need;
+    }
+    if (b->raw_len > *out_cap)
+    {
+        uint8_t *nb = (uint8_t *)realloc(*outbuf, b->raw_len);
+        if (!nb)
+        {
+            fprintf(stderr, "realloc failed\n");
+            return 3;
+        }
+        *outbuf = nb;
+        *out_cap = b->raw_len;
+    }
+    if (pread_all(fd_in, *inbuf, need, b->block_off) != 0)
+        return 4;
+
+    const uint8_t *bh = *inbuf;
+    if (u32le_read(bh + 1) != b->paylen ||
+        (map->blk_hdr_len == 9 && u32le_read(bh + 5) != b->raw_len))
+    {
+        fprintf(stderr, "Block header does not match the index.\n");
+        return 6;
+    }
+    return rle2_decode_payload(bh[0], bh + map->blk_hdr_len, b->paylen, b->raw_len,
+                               *outbuf, *out_cap, map->dict, data, data_len);
+}
+
+static void *rle2_decode_worker(void *arg)
+{
+    RLE2DecodeJob *job = (RLE2DecodeJob *)arg;
+    const RLE2BlockMap *map = job->map;
+
+    size_t in_cap = RLE2_DEC_IN_CAP(map->block_size);
+    size_t out_cap = RLE2_DEC_OUT_CAP(map->block_size);
+    uint8_t *inbuf = (uint8_t *)malloc(in_cap);
+    uint8_t *outbuf = (uint8_t *)malloc(out_cap);
+    int rc = 0;
+    if (!inbuf || !outbuf)
+    {
+        fprintf(stderr, "malloc failed\n");
+        rc = 1;
+    }
+
+    while (rc == 0)
+    {
+        pthread_mutex_lock(&job->mu);
+        int stop = (job->rc != 0 || job->layout_mismatch || job->next >= map->count);
+        size_t idx = job->next++;
+        pthread_mutex_unlock(&job->mu);
+        if (stop)
+            break;
+
+        const RLE2BlockRef *b = &map->blocks[idx];
+        int is_last = (idx + 1 == map->count);
+
+        const uint8_t *data;
+        size_t data_len;
+        rc = rle2_read_block_at(job->fd_in, map, b, &inbuf, &in_cap, &outbuf, &out_cap,
+                                &data, &data_len);
+        if (rc != 0)
+            break;
+
+        if (!map->exact && !is_last && data == outbuf && data_len != map->block_size)
+        {
+            /* bloque RLE corto en medio del stream: offsets inválidos */
+            pthread_mutex_lock(&job->mu);
+            job->layout_mismatch = 1;
+            pthread_mutex_unlock(&job->mu);
+            break;
+        }
+
+        if (rle2_write_out(&job->holes, job->fd_out, data, data_len, b->out_off) != 0)
+        {
+            rc = 7;
+            break;
+        }
+        if (is_last)
+        {
+            pthread_mutex_lock(&job->mu);
+            job->out_end = b->out_off + (off_t)data_len;
+            pthread_mutex_unlock(&job->mu);
+        }
+    }
+
+    if (rc != 0)
+    {
+        pthread_mutex_lock(&job->mu);
+        if (job->rc == 0)
+            job->rc = rc;
+        pthread_mutex_unlock(&job->mu);
+    }
+    free(inbuf);
+    free(outbuf);
+    return NULL;
+}
+
+/* Lanza hasta nthreads hilos con fn(arg); sin hilos, ejecuta fn en el llamador. */
+static void rle2_run_workers(void *(*fn)(void *), void *arg, int nthreads)
+{
+    pthread_t *threads = (pthread_t *)calloc((size_t)nthreads, sizeof(pthread_t));
+    int started = 0;
+    if (threads)
+    {
+        for (; started < nthreads; started++)
+        {
+            if (pthread_create(&threads[started], NULL, fn, arg) != 0)
+            {
+                perror("pthread_create");
+                break;
+            }
+        }
+    }
+    if (started == 0)
+        fn(arg);
+    for (int i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+    free(threads);
+}
+
+/* Devuelve 0 OK, -1 si hay que repetir en secuencial, >0 error. */
+static int rle2_decompress_parallel(int fd_in, int fd_out, const RLE2BlockMap *map, int nthreads,
+                                   const RLE2Options *opts)
+{
+    RLE2DecodeJob job;
+    memset(&job, 0, sizeof(job));
+    job.fd_in = fd_in;
+    job.fd_out = fd_out;
+    rle2_holes_begin(&job.holes, fd_out, opts);
+    job.map = map;
+    job.out_end = (off_t)map->total_raw;
+    pthread_mutex_init(&job.mu, NULL);
+
+    if ((size_t)nthreads > map->count)
+        nthreads = (map->count > 0) ? (int)map->count : 1;
+    rle2_run_workers(rle2_decode_worker, &job, nthreads);
+
+    int rc = job.rc;
+    if (rc == 0 && job.layout_mismatch)
+        rc = -1;
+    if (rc == 0 && ftruncate(fd_out, job.out_end) != 0)
+    {
+        perror("ftruncate");
+        rc = 7;
+    }
+
+    pthread_mutex_destroy(&job.mu);
+    return rc;
+}
+
+int rle2_decompress_stream(int fd_in, int fd_out, const RLE2Options *opts)
+{
+    int nthreads = rle2_resolve_threads(opts);
+
+    /* El modo paralelo necesita pread/pwrite: ambos deben ser archivos
+     * regulares y la entrada debe estar al inicio del stream */
+    struct stat st_in, st_out;
+    if (nthreads <= 1 ||
+        fstat(fd_in, &st_in) != 0 || !S_ISREG(st_in.st_mode) ||
+        fstat(fd_out, &st_out) != 0 || !S_ISREG(st_out.st_mode) ||
+        lseek(fd_in, 0, SEEK_CUR) != 0)
+        return rle2_decompress_serial(fd_in, fd_out, opts);
+
+    RLE2Header h;
+    if (rle2_header_pread(fd_in, &h) != 0 || h.stored)
+        return rle2_decompress_serial(fd_in, fd_out, opts); /* reporta el error o copia */
+    const RLE2Dict *dict;
+    if (rle2_header_dict(&h, opts, &dict) != 0)
+        return 1;
+
+    RLE2BlockMap map;
+    int rc = rle2_build_block_map(fd_in, st_in.st_size, &h, dict, &map);
+    if (rc != 0)
+        return rc;
+
+    rc = rle2_decompress_parallel(fd_in, fd_out, &map, nthreads, opts);
+    free(map.blocks);
+    if (rc == -1)
+    {
+        /* Bloques de tamaño irregular: descartar y repetir en secuencial */
+        if (ftruncate(fd_out, 0) != 0 || lseek(fd_out, 0, SEEK_SET) < 0)
+        {
+            perror("ftruncate");
+            return 1;
+        }
+        return rle2_decompress_serial(fd_in, fd_out, opts);
+    }
+    return rc;
+}
+
+/* =======================
+ *  Decodificación en memoria
+ *  Con revisión >= 1 (o el índice v3) el tamaño de cada bloque es conocido,
+ *  así que se decodifica directamente en el destino del llamador (p.ej. un
+ *  archivo mapeado) sin buffers intermedios, y en paralelo si se pide.
+ * ======================= */
+
+typedef struct
+{
+    const uint8_t *payload;
+    size_t out_off;
+    uint32_t paylen;
+    uint32_t raw_len;
+    uint8_t tag;
+} RLE2MemBlock;
+
+typedef struct
+{
+    const RLE2MemBlock *blocks;
+    size_t count;
+    uint8_t *dst;
+    const RLE2Dict *dict;
+
+    pthread_mutex_t mu;
+    size_t next;
+    int rc;
+} RLE2MemJob;
+
+static int rle2_mem_decode_block(const RLE2MemBlock *b, uint8_t *dst, const RLE2Dict *dict)
+{
+    const uint8_t *data;
+    size_t data_len;
+    int rc = rle2_decode_payload(b->tag, b->payload, b->paylen, b->raw_len,
+                                 dst + b->out_off, b->raw_len, dict, &data, &data_len);
+    if (rc == 0 && data != dst + b->out_off)
+        memcpy(dst + b->out_off, data, data_len); /* RAW */
+    return rc;
+}
+
+static void *rle2_mem_worker(void *arg)
+{
+    RLE2MemJob *job = (RLE2MemJob *)arg;
+    for (;;)
+    {
+        pthread_mutex_lock(&job->mu);
+        int stop = (job->rc != 0 || job->next >= job->count);
+        size_t idx = job->next++;
+        pthread_mutex_unlock(&job->mu);
+        if (stop)
+            break;
+
+        int rc = rle2_mem_decode_block(&job->blocks[idx], job->dst, job->dict);
+        if (rc != 0)
+        {
+            pthread_mutex_lock(&job->mu);
+            if (job->rc == 0)
+                job->rc = rc;
+            pthread_mutex_unlock(&job->mu);
+            break;
+        }
+    }
+    return NULL;
+}
+
+/* Recorre los bloques de un stream en memoria. Con blocks == NULL solo
+ * valida y suma tamaños (-1 = no es RLE2, -2 = stream corrupto,
+ * 1 = revisión 0 o almacenado). */
+static int rle2_mem_walk(const uint8_t *in, size_t n, RLE2MemBlock *blocks, size_t *count,
+                         uint64_t *total)
+{
+    RLE2Header h;
+    if (n < RLE2_HEADER_SIZE || rle2_header_parse(in, &h) != 0)
+        return -1;
+    if (h.rev < RLE2_REV_SIZED || h.stored)
+        return 1;
+    if (n < h.hdr_len)
+        return -2;
+
+    size_t pos = h.hdr_len, nb = 0;
+    uint64_t out = 0;
+    while (pos < n)
+    {
+        if (n - pos < h.blk_hdr_len)
+            return -2;
+        uint8_t tag = in[pos];
+        uint32_t paylen = u32le_read(in + pos + 1);
+        uint32_t raw_len = u32le_read(in + pos + 5);
+        if (h.v3 && tag == RLE3_TAG_END)
+            break;
+        if (paylen > n - pos - h.blk_hdr_len)
+            return -2;
+        if (paylen > 0)
+        {
+            if (blocks)
+            {
+                blocks[nb].payload = in + pos + h.blk_hdr_len;
+                blocks[nb].out_off = (size_t)out;
+                blocks[nb].paylen = paylen;
+                blocks[nb].raw_len = raw_len;
+                blocks[nb].tag = tag;
+            }
+            nb++;
+            out += raw_len;
+        }
+        pos += h.blk_hdr_len + paylen;
+    }
+    *count = nb;
+    *total = out;
+    return 0;
+}
+
+int rle2_buffer_raw_size(const uint8_t *in, size_t n, uint64_t *total)
+{
+    size_t count;
+    return rle2_mem_walk(in, n, NULL, &count, total);
+}
+
+int rle2_decompress_buffer(const uint8_t *in, size_t n, uint8_t *dst, size_t dst_cap,
+                           size_t *out_len, const RLE2Options *opts)
+{
+    RLE2Header h;
+    if (n >= RLE2_HEADER_SIZE && rle2_header_parse(in, &h) == 0 && h.stored)
+    {
+        if (n - RLE2_HEADER_SIZE > dst_cap)
+        {
+            fprintf(stderr, "Destination buffer too small for RLE2 stream.\n");
+            return 1;
+        }
+        memcpy(dst, in + RLE2_HEADER_SIZE, n - RLE2_HEADER_SIZE);
+        *out_len = n - RLE2_HEADER_SIZE;
+        return 0;
+    }
+
+    size_t count;
+    uint64_t total;
+    int rc = rle2_mem_walk(in, n, NULL, &count, &total);
+    if (rc != 0)
+    {
+        fprintf(stderr, rc == -1   ? "Not an RLE2 file.\n"
+                        : rc == -2 ? "Truncated RLE2 stream.\n"
+                                   : "RLE2 revision 0 stream has no block sizes.\n");
+        return 1;
+    }
+    if (total > dst_cap)
+    {
+        fprintf(stderr, "Destination buffer too small for RLE2 stream.\n");
+        return 1;
+    }
+    const RLE2Dict *dict;
+    rle2_header_parse(in, &h);
+    if (h.has_dict)
+        rle2_header_dict_id(in + RLE2_HEADER_SIZE, &h);
+    if (rle2_header_dict(&h, opts, &dict) != 0)
+        return 1;
+
+    RLE2MemBlock *blocks = (RLE2MemBlock *)malloc((count ? count : 1) * sizeof(RLE2MemBlock));
+    if (!blocks)
+    {
+        fprintf(stderr, "malloc failed\n");
+        return 1;
+    }
+    rle2_mem_walk(in, n, blocks, &count, &total);
+
+    RLE2MemJob job;
+    memset(&job, 0, sizeof(job));
+    job.blocks = blocks;
+    job.count = count;
+    job.dst = dst;
+    job.dict = dict;
+    pthread_mutex_init(&job.mu, NULL);
+
+    int nthreads = rle2_resolve_threads(opts);
+    if ((size_t)nthreads > count)
+        nthreads = (count > 0) ? (int)count : 1;
+    if (nthreads <= 1)
+        rle2_mem_worker(&job);
+    else
+        rle2_run_workers(rle2_mem_worker, &job, nthreads);
+
+    pthread_mutex_destroy(&job.mu);
+    free(blocks);
+    if (job.rc == 0)
+        *out_len = (size_t)total;
+    return job.rc;
+}
+
+/* =======================
+ *  Extracción de un rango sin comprimir
+ *  v3: búsqueda binaria en el índice y solo se decodifican los bloques
+ *  que solapan el rango. RLE2 no tiene índice: se decodifica en secuencial
+ *  descartando la salida anterior al rango.
+ * ======================= */
+
+int rle2_extract_range(int fd_in, int fd_out, uint64_t offset, uint64_t length,
+                       const RLE2Options *opts)
+{
+    RLE2Header h;
+    struct stat st;
+    if (fstat(fd_in, &st) != 0 || !S_ISREG(st.st_mode) ||
+        rle2_header_pread(fd_in, &h) != 0 || !h.v3)
+    {
+        if (lseek(fd_in, 0, SEEK_SET) < 0 && errno != ESPIPE)
+        {
+            perror("lseek");
+            return 1;
+        }
+        return rle2_decompress_serial_range(fd_in, fd_out, offset, length, opts);
+    }
+    const RLE2Dict *dict;
+    if (rle2_header_dict(&h, opts, &dict) != 0)
+        return 1;
+
+    RLE2BlockMap map;
+    int rc = rle2_build_block_map(fd_in, st.st_size, &h, dict, &map);
+    if (rc != 0)
+        return rc;
+
+    /* Un rango que pasa del final se recorta (como dd) */
+    uint64_t end = offset;
+    if (offset < map.total_raw)
+        end = offset + ((length < map.total_raw - offset) ? length : map.total_raw - offset);
+
+    /* Primer bloque con out_off <= offset */
+    size_t lo = 0, hi = map.count;
+    while (hi - lo > 1)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if ((uint64_t)map.blocks[mid].out_off <= offset)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    size_t in_cap = RLE2_DEC_IN_CAP(map.block_size);
+    size_t out_cap = RLE2_DEC_OUT_CAP(map.block_size);
+    uint8_t *inbuf = (uint8_t *)malloc(in_cap);
+    uint8_t *outbuf = (uint8_t *)malloc(out_cap);
+    if (!inbuf || !outbuf)
+    {
+        fprintf(stderr, "malloc failed\n");
+        free(inbuf);
+        free(outbuf);
+        free(map.blocks);
+        return 1;
+    }
+
+    for (size_t i = lo; rc == 0 && i < map.count && (uint64_t)map.blocks[i].out_off < end; i++)
+    {
+        const uint8_t *data;
+        size_t data_len;
+        rc = rle2_read_block_at(fd_in, &map, &map.blocks[i], &inbuf, &in_cap, &outbuf, &out_cap,
+                                &data, &data_len);
+        if (rc != 0)
+            break;
+        if (h.rev < RLE2_REV_SIZED)
+        {
+            uint64_t next = (i + 1 < map.count) ? (uint64_t)map.blocks[i + 1].out_off : map.total_raw;
+            if (data_len != next - (uint64_t)map.blocks[i].out_off)
+            {
+                fprintf(stderr, "Block size does not match the index.\n");
+                rc = 6;
+                break;
+            }
+        }
+
+        uint64_t b_start = (uint64_t)map.blocks[i].out_off;
+        uint64_t from = (b_start < offset) ? offset - b_start : 0;
+        uint64_t to = (b_start + data_len > end) ? end - b_start : data_len;
+        if (to > from && write_all(fd_out, data + from, (size_t)(to - from)) != 0)
+            rc = 7;
+    }
+
+    free(inbuf);
+    free(outbuf);
+    free(map.blocks);
+    return rc;
+}
+
+/* =======================
+ *  Añadir y concatenar
+ *  Los bloques son independientes y, desde la revisión 1, cada uno lleva
+ *  su tamaño decodificado, así que un stream se alarga o se une a otros
+ *  sin decodificar nada:
+ *    append  los bloques nuevos van tras el último, con el tamaño de
+ *            bloque, el umbral y el diccionario de la cabecera. En v3 se
+ *            cargan las entradas del índice y los bloques nuevos se
+ *            escriben sobre el bloque de índice; al cerrar se escribe uno
+ *            que lo cubre todo. Si algo falla, el índice y el tamaño
+ *            originales se restauran.
+ *    concat  se copia la zona de bloques de cada entrada (copy_file_range)
+ *            bajo una cabecera nueva, como la de la primera; un índice v3
+ *            se rehace con los offsets desplazados. Los archivos
+ *            almacenados se enmarcan en bloques RAW.
+ *  La revisión 0 no registra el tamaño de cada bloque (fuera de v3, donde
+ *  sale del índice): se saca de las cabeceras de paquete de los bloques
+ *  RLE, sin decodificarlos, y sus bloques se copian con una cabecera de
+ *  revisión 1. Para alargarlo hay que reescribirlo así en otro archivo
+ *  (rle2_append_rewrite), igual que un almacenado, cuyos datos pasan a
+ *  bloques RAW; sigue sin recomprimirse nada.
+ * ======================= */
+
+/* Bytes que produce un payload PackBits, sumando las longitudes de sus
+ * paquetes sin escribirlos. 0 si está corrupto. */
+static uint64_t rle2_packbits_len(const uint8_t *in, size_t n)
+{
+    uint64_t len = 0;
+    size_t i = 0;
+    while (i < n)
+    {
+        uint8_t c = in[i++];
+        if (c < 128)
+        {
+            len += (uint64_t)c + 1;
+            i += (size_t)c + 1;
+        }
+        else
+        {
+            len += (uint64_t)(c & 0x7F) + 1;
+            i++;
+        }
+    }
+    return (i == n) ? len : 0;
+}
+
+/* Revisión 0 sin índice: tamaño decodificado de cada bloque, y con él los
+ * offsets de salida exactos */
+static int rle2_size_blocks(int fd, RLE2BlockMap *map)
+{
+    size_t in_cap = RLE2_DEC_IN_CAP(map->block_size);
+    size_t out_cap = RLE2_DEC_OUT_CAP(map->block_size);
+    uint8_t *inbuf = (uint8_t *)malloc(in_cap);
+    uint8_t *outbuf = (uint8_t *)malloc(out_cap);
+    int rc = 0;
+    if (!inbuf || !outbuf)
+    {
+        fprintf(stderr, "malloc failed\n");
+        rc = 3;
+    }
+
+    uint64_t out_off = 0;
+    for (size_t i = 0; rc == 0 && i < map->count; i++)
+    {
+        RLE2BlockRef *b = &map->blocks[i];
+        size_t need = map->blk_hdr_len + (size_t)b->paylen;
+        uint64_t len = b->paylen; /* RAW */
+        if (need > in_cap)
+        {
+            uint8_t *nb = (uint8_t *)realloc(inbuf, need);
+            if (!nb)
+            {
+                fprintf(stderr, "realloc failed\n");
+                rc = 3;
+                break;
+            }
+            inbuf = nb;
+            in_cap = need;
+        }
+        if (pread_all(fd, inbuf, 1, b->block_off) != 0)
+        {
+            rc = 4;
+            break;
+        }
+        if (inbuf[0] != RLE2_TAG_RAW && pread_all(fd, inbuf, need, b->block_off) != 0)
+        {
+            rc = 4;
+            break;
+        }
+        if (inbuf[0] == RLE2_TAG_RLE)
+        {
+            len = rle2_packbits_len(inbuf + map->blk_hdr_len, b->paylen);
+        }
+        else if (inbuf[0] != RLE2_TAG_RAW)
+        {
+            const uint8_t *data;
+            size_t n = 0;
+            if (rle2_decode_payload(inbuf[0], inbuf + map->blk_hdr_len, b->paylen, 0, outbuf, out_cap,
+                                    NULL, &data, &n) != 0)
+            {
+                rc = 6;
+                break;
+            }
+            len = n;
+        }
+        if (len == 0 || len > UINT32_MAX)
+        {
+            fprintf(stderr, "Corrupted RLE2 block payload.\n");
+            rc = 6;
+            break;
+        }
+        b->out_off = (off_t)out_off;
+        b->raw_len = (uint32_t)len;
+        out_off += len;
+    }
+    if (rc == 4)
+        fprintf(stderr, "Truncated RLE2 block payload.\n");
+
+    free(inbuf);
+    free(outbuf);
+    if (rc == 0)
+    {
+        map->exact = 1;
+        map->total_raw = out_off;
+    }
+    return rc;
+}
+
+/* Cabecera y mapa de bloques (sin payloads) de un stream a alargar o unir */
+static int rle2_open_joinable(int fd, const char *what, RLE2Header *h, RLE2BlockMap *map)
+{
+    struct stat st;
+    memset(map, 0, sizeof(*map));
+    if (fstat(fd, &st) != 0)
+    {
+        perror("fstat");
+        return 1;
+    }
+    if (rle2_header_pread(fd, h) != 0)
+    {
+        fprintf(stderr, "%s is not an RLE2 file.\n", what);
+        return 1;
+    }
+    if (h->stored)
+    {
+        map->exact = 1;
+        map->total_raw = (uint64_t)(st.st_size - (off_t)h->hdr_len);
+        map->blocks_end = st.st_size;
+        return 0;
+    }
+    int rc = rle2_build_block_map(fd, st.st_size, h, NULL, map);
+    if (rc == 0 && !map->exact)
+        rc = rle2_size_blocks(fd, map);
+    if (rc != 0)
+    {
+        free(map->blocks);
+        map->blocks = NULL;
+    }
+    return rc;
+}
+
+/* Opciones de los bloques que se añaden a un stream: las de su cabecera.
+ * Un almacenado no tiene: sus datos pasan a bloques RAW con las del
+ * llamador. */
+static int rle2_append_options(const RLE2Header *h, const RLE2Options *opts, RLE2Options *o)
+{
+    const RLE2Dict *dict = NULL;
+    if (opts)
+        *o = *opts;
+    else
+        rle2_default_options(o);
+
+    if (h->stored)
+        return rle2_validate_options(o);
+    if (!h->has_dict && o->dict)
+    {
+        fprintf(stderr, "The output was compressed without a dictionary: drop --dict to extend it.\n");
+        return 1;
+    }
+    if (rle2_header_dict(h, o, &dict) != 0)
+        return 1;
+
+    o->dict = dict;
+    o->seekable = h->v3;
+    o->block_size = h->block_size;
+    o->run_threshold = h->run_threshold ? h->run_threshold : RLE2_RUN_THRESHOLD;
+    return rle2_validate_options(o);
+}
 
-static size_t packbits_encode_threshold(const uint8_t *in, size_t n, uint8_t *out, int k_min_run)
+int rle2_append_in_place(int fd_rle)
 {
-    size_t i = 0, o = 0;
+    RLE2Header h;
+    if (rle2_header_pread(fd_rle, &h) != 0)
+    {
+        fprintf(stderr, "The output is not an RLE2 file.\n");
+        return -1;
+    }
+    return h.rev >= RLE2_REV_SIZED && !h.stored;
+}
 
-    while (i < n)
+int rle2_append_stream(int fd_in, int fd_rle, const RLE2Options *opts)
+{
+    RLE2Header h;
+    RLE2BlockMap map;
+    RLE2Options o;
+    if (rle2_open_joinable(fd_rle, "The output", &h, &map) != 0)
+        return 1;
+    int rc = 0;
+    if (h.rev < RLE2_REV_SIZED || h.stored)
+    {
+        fprintf(stderr, "The output is a %s file: it has to be rewritten to be extended.\n",
+                h.stored ? "stored" : "revision 0");
+        rc = 1;
+    }
+    else
+    {
+        rc = rle2_append_options(&h, opts, &o);
+    }
+    if (rc != 0)
     {
-        /* Try to find a run starting at i */
-        size_t run = 1;
-        while (i + run < n && in[i + run] == in[i] && run < 128)
-            run++;
+        free(map.blocks);
+        return rc;
+    }
 
-        if (run >= (size_t)k_min_run)
+    /* Lo que hay tras los bloques (índice y trailer en v3) se guarda: los
+     * bloques nuevos lo pisan y, si fallan, se vuelve a dejar como estaba */
+    struct stat st;
+    uint8_t *tail = NULL;
+    size_t tail_len = 0;
+    if (fstat(fd_rle, &st) != 0)
+    {
+        perror("fstat");
+        rc = 1;
+    }
+    else if (st.st_size > map.blocks_end)
+    {
+        tail_len = (size_t)(st.st_size - map.blocks_end);
+        tail = (uint8_t *)malloc(tail_len);
+        if (!tail)
         {
-            /* flush this run as RUN blocks of up to 128 */
-            while (run > 0)
-            {
-                size_t chunk = (run > 128) ? 128 : run;
-                uint8_t ctrl = 0x80 | (uint8_t)(chunk - 1); /* MSB=1, length-1 */
-                out[o++] = ctrl;
-                out[o++] = in[i];
-                i += chunk;
-                run -= chunk;
-
-                /* If more of the same value continues, recompute for next loop */
-                if (run == 0)
-                {
-                    size_t more = 0;
-                    while (i + more < n && in[i + more] == in[i] && more < 128)
-                        more++;
-                    if (more >= (size_t)k_min_run)
-                    {
-                        run = more;
-                    }
-                }
-            }
-            continue;
+            fprintf(stderr, "malloc failed\n");
+            rc = 1;
         }
+        else if (pread_all(fd_rle, tail, tail_len, map.blocks_end) != 0)
+        {
+            perror("read index");
+            rc = 1;
+        }
+    }
 
-        /* Otherwise, accumulate a LITERAL packet up to 128 bytes,
-           but stop before a long enough run would start. */
-        size_t lit_start = i;
-        size_t lit_len = 1; /* at least in[i] */
+    RLE2Writer w;
+    rle2_writer_init(&w, fd_rle, &o);
+    w.comp_pos = (uint64_t)map.blocks_end;
+    w.raw_pos = map.total_raw;
+    for (size_t i = 0; w.seekable && rc == 0 && i < map.count; i++)
+        rc = rle2_index_push(&w, (uint64_t)map.blocks[i].out_off, (uint64_t)map.blocks[i].block_off,
+                             map.blocks[i].paylen);
+    free(map.blocks);
+    if (rc == 0 && lseek(fd_rle, map.blocks_end, SEEK_SET) < 0)
+    {
+        perror("lseek");
+        rc = 1;
+    }
+    if (rc != 0)
+    {
+        free(w.index);
+        free(tail);
+        return rc;
+    }
 
-        while (i + lit_len < n && lit_len < 128)
+    rc = rle2_compress_blocks(fd_in, &w);
+    if (rc == 0)
+    {
+        /* el índice nuevo puede acabar antes que el viejo */
+        off_t end = lseek(fd_rle, 0, SEEK_CUR);
+        if (end < 0 || ftruncate(fd_rle, end) != 0)
         {
-            /* peek if a run would start at i+lit_len */
-            size_t r = 1;
-            while (i + lit_len + r < n &&
-                   in[i + lit_len + r] == in[i + lit_len] &&
-                   r < 128)
-            {
-                r++;
-            }
-            if (r >= (size_t)k_min_run)
-                break; /* stop literal before the run */
-            lit_len++;
+            perror("ftruncate");
+            rc = 1;
         }
+    }
+    else if ((tail_len > 0 && pwrite_all(fd_rle, tail, tail_len, map.blocks_end) != 0) ||
+             ftruncate(fd_rle, st.st_size) != 0)
+    {
+        perror("The output could not be restored");
+    }
+    free(tail);
+    return rc;
+}
 
-        /* emit LITERAL packet: ctrl = (len-1) with MSB=0 */
-        uint8_t ctrl = (uint8_t)(lit_len - 1);
-        out[o++] = ctrl;
-        memcpy(out + o, in + lit_start, lit_len);
-        o += lit_len;
-        i += lit_len;
+/* Datos de un archivo almacenado, en bloques RAW de w->block_size */
+static int rle2_concat_stored(RLE2Writer *w, int fd, const RLE2Header *h, uint64_t len)
+{
+    if (lseek(fd, (off_t)h->hdr_len, SEEK_SET) < 0)
+    {
+        perror("lseek");
+        return 1;
+    }
+    while (len > 0)
+    {
+        uint32_t n = (len > w->block_size) ? (uint32_t)w->block_size : (uint32_t)len;
+        int rc = rle2_write_block_header(w, RLE2_TAG_RAW, n, n);
+        if (rc != 0)
+            return rc;
+        if (rle2_copy_fd(fd, w->fd, n) != 0)
+            return 4;
+        len -= n;
     }
-    return o;
+    return 0;
 }
 
-static int packbits_decode(const uint8_t *in, size_t n, uint8_t *out, size_t *out_len)
+/* Zona de bloques de un stream copiada tal cual; en v3 sus bloques entran
+ * en el índice desplazados a la posición actual */
+static int rle2_concat_blocks(RLE2Writer *w, int fd, const RLE2Header *h, const RLE2BlockMap *map)
 {
-    size_t i = 0, o = 0;
-    while (i < n)
+    for (size_t i = 0; w->seekable && i < map->count; i++)
     {
-        uint8_t ctrl = in[i++];
-        if ((ctrl & 0x80) == 0)
-        {
-            /* LITERAL: len = ctrl+1 */
-            size_t len = (size_t)ctrl + 1;
-            if (i + len > n)
-                return 1; /* truncated */
-            memcpy(out + o, in + i, len);
-            o += len;
-            i += len;
-        }
-        else
+        const RLE2BlockRef *b = &map->blocks[i];
+        if (rle2_index_push(w, w->raw_pos + (uint64_t)b->out_off,
+                            w->comp_pos + (uint64_t)(b->block_off - (off_t)h->hdr_len), b->paylen) != 0)
+            return 1;
+    }
+    uint64_t len = (uint64_t)(map->blocks_end - (off_t)h->hdr_len);
+    if (lseek(fd, (off_t)h->hdr_len, SEEK_SET) < 0)
+    {
+        perror("lseek");
+        return 1;
+    }
+    if (rle2_copy_fd(fd, w->fd, len) != 0)
+        return 4;
+    w->comp_pos += len;
+    w->raw_pos += map->total_raw;
+    return 0;
+}
+
+/* Bloques de revisión 0, uno a uno, con cabecera de revisión 1 */
+static int rle2_concat_reframed(RLE2Writer *w, int fd, const RLE2Header *h, const RLE2BlockMap *map)
+{
+    for (size_t i = 0; i < map->count; i++)
+    {
+        const RLE2BlockRef *b = &map->blocks[i];
+        uint8_t tag;
+        if (pread_all(fd, &tag, 1, b->block_off) != 0 ||
+            lseek(fd, b->block_off + (off_t)h->blk_hdr_len, SEEK_SET) < 0)
         {
-            /* RUN: len = (ctrl&0x7F)+1, then one value */
-            size_t len = (size_t)(ctrl & 0x7F) + 1;
-            if (i >= n)
-                return 1; /* missing value */
-            uint8_t val = in[i++];
-            memset(out + o, val, len);
-            o += len;
+            perror("read block");
+            return 4;
         }
+        int rc = rle2_write_block_header(w, tag, b->paylen, b->raw_len);
+        if (rc != 0)
+            return rc;
+        if (rle2_copy_fd(fd, w->fd, b->paylen) != 0)
+            return 4;
     }
-    *out_len = o;
     return 0;
 }
 
-int rle2_compress_stream(int fd_in, int fd_out)
+/* Bloques de una entrada a la salida, en el formato actual */
+static int rle2_concat_input(RLE2Writer *w, int fd, const RLE2Header *h, const RLE2BlockMap *map)
+{
+    if (h->stored)
+        return rle2_concat_stored(w, fd, h, map->total_raw);
+    if (h->rev < RLE2_REV_SIZED)
+        return rle2_concat_reframed(w, fd, h, map);
+    return rle2_concat_blocks(w, fd, h, map);
+}
+
+int rle2_append_rewrite(int fd_in, int fd_rle, int fd_out, const RLE2Options *opts)
 {
-    if (write_all(fd_out, RLE2_MAGIC, sizeof(RLE2_MAGIC)) != 0)
+    RLE2Header h;
+    RLE2BlockMap map;
+    RLE2Options o;
+    if (rle2_open_joinable(fd_rle, "The output", &h, &map) != 0)
         return 1;
+    int rc = rle2_append_options(&h, opts, &o);
 
-    uint8_t *inbuf = (uint8_t *)malloc(RLE2_BLOCK_SIZE);
-    /* En el peor de los casos PackBits se expande ≈1/128, pero por seguridad asignamos 2× */
-    uint8_t *rlebuf = (uint8_t *)malloc(RLE2_BLOCK_SIZE * 2);
-    if (!inbuf || !rlebuf)
+    RLE2Writer w;
+    rle2_writer_init(&w, fd_out, &o);
+    if (rc == 0 && h.stored)
+        rc = rle2_writer_header(&w, o.dict != NULL, o.dict ? o.dict->id : 0);
+    else if (rc == 0)
+        rc = rle2_writer_header(&w, h.has_dict, h.dict_id);
+    if (rc == 0)
+        rc = rle2_concat_input(&w, fd_rle, &h, &map);
+    free(map.blocks);
+    if (rc != 0)
     {
-        fprintf(stderr, "malloc failed\n");
-        free(inbuf);
-        free(rlebuf);
-        return 1;
+        free(w.index);
+        return rc;
     }
+    return rle2_compress_blocks(fd_in, &w);
+}
 
-    for (;;)
+int rle2_concat_streams(const int *fds, size_t count, int fd_out)
+{
+    /* Cabecera de salida: contenedor, umbral y diccionario de la primera
+     * entrada con bloques; el tamaño de bloque mayor de todas */
+    RLE2Options o;
+    rle2_default_options(&o);
+    int found = 0;
+    int has_dict = 0;
+    uint32_t dict_id = 0;
+    size_t max_block = 0;
+    char what[32];
+    for (size_t i = 0; i < count; i++)
     {
-        ssize_t r = read(fd_in, inbuf, RLE2_BLOCK_SIZE);
-        if (r < 0)
+        RLE2Header h;
+        snprintf(what, sizeof(what), "Input %zu", i + 1);
+        if (rle2_header_pread(fds[i], &h) != 0)
         {
-            perror("read");
-            free(inbuf);
-            free(rlebuf);
-            return 2;
+            fprintf(stderr, "%s is not an RLE2 file.\n", what);
+            return 1;
         }
-        if (r == 0)
-            break;
+        if (h.stored)
+            continue;
+        if (!found)
+        {
+            found = 1;
+            o.seekable = (i == 0) && h.v3;
+            o.run_threshold = h.run_threshold ? h.run_threshold : RLE2_RUN_THRESHOLD;
+            has_dict = h.has_dict;
+            dict_id = h.dict_id;
+        }
+        else if (h.has_dict != has_dict || h.dict_id != dict_id)
+        {
+            fprintf(stderr, "%s uses a different dictionary than the inputs before it.\n", what);
+            return 1;
+        }
+        if (h.block_size > max_block)
+            max_block = h.block_size;
+    }
+    if (found)
+        o.block_size = max_block; /* si no, solo almacenados: los valores por defecto */
+
+    RLE2Writer w;
+    rle2_writer_init(&w, fd_out, &o);
+    int rc = rle2_writer_header(&w, has_dict, dict_id);
+    for (size_t i = 0; rc == 0 && i < count; i++)
+    {
+        RLE2Header h;
+        RLE2BlockMap map;
+        snprintf(what, sizeof(what), "Input %zu", i + 1);
+        rc = rle2_open_joinable(fds[i], what, &h, &map);
+        if (rc == 0)
+            rc = rle2_concat_input(&w, fds[i], &h, &map);
+        free(map.blocks);
+    }
+    if (rc != 0)
+    {
+        free(w.index);
+        return rc;
+    }
+    return rle2_writer_finish(&w);
+}
 
-        size_t in_n = (size_t)r;
+/* =======================
+ *  Búsqueda sin descomprimir
+ *  Cada bloque se busca por separado, en paralelo, y nada se escribe:
+ *    RAW      el payload es el dato y se busca en su sitio
+ *    RLE      (0x01 y 0x02 sin flags) se recorren los paquetes: los
+ *             literales se copian a un buffer compacto y de un run largo
+ *             solo quedan sus primeros y últimos m-1 bytes, los únicos que
+ *             pueden formar una coincidencia con lo que lo rodea. Las
+ *             coincidencias que cruzan un corte no existen; las que caen
+ *             dentro del run (patrón de un solo byte repetido) se cuentan
+ *             sin expandirlo.
+ *    resto    Huffman, LZ, BWT, filtros...: se decodifica en memoria
+ *  La búsqueda es memmem (Two-Way de glibc, con memchr/SIMD para el primer
+ *  byte). Las coincidencias que pasan de un bloque al siguiente se buscan
+ *  al final, en orden, con los m-1 primeros y últimos bytes de cada uno.
+ * ======================= */
 
-        /* Codificar usando PackBits con umbral */
-        size_t enc_n = packbits_encode_threshold(inbuf, in_n, rlebuf, RLE2_RUN_THRESHOLD);
+#define RLE2_GREP_CHUNK (1024 * 1024) /* bloques virtuales de un almacenado */
 
-        /* Decidir bloque RAW o RLE */
-        uint8_t tag;
-        const uint8_t *payload;
-        uint32_t paylen;
-        if (enc_n >= in_n)
+typedef struct
+{
+    size_t compact;   /* en esta posición del buffer compacto... */
+    uint64_t skipped; /* ...faltan estos bytes del run */
+} RLE2Cut;
+
+typedef struct
+{
+    RLE2Match *matches; /* offsets relativos al bloque */
+    size_t count;
+    size_t cap;
+    uint64_t len;     /* bytes sin comprimir del bloque */
+    uint8_t *edge;    /* primeros y últimos edge_len bytes */
+    size_t edge_len;  /* min(m - 1, len) */
+} RLE2GrepBlock;
+
+typedef struct
+{
+    int fd;
+    const RLE2BlockMap *map;
+    int stored; /* bloques virtuales sin cabecera */
+    const uint8_t *pat;
+    size_t m;
+    int uniform; /* patrón de un solo byte repetido */
+    RLE2GrepBlock *res;
+
+    pthread_mutex_t mu;
+    size_t next;
+    int rc;
+} RLE2GrepJob;
+
+static int rle2_match_push(RLE2Match **v, size_t *count, size_t *cap, uint64_t offset, uint64_t n)
+{
+    if (*count == *cap)
+    {
+        size_t ncap = *cap ? *cap * 2 : 64;
+        RLE2Match *nv = (RLE2Match *)realloc(*v, ncap * sizeof(RLE2Match));
+        if (!nv)
+        {
+            fprintf(stderr, "realloc failed\n");
+            return 1;
+        }
+        *v = nv;
+        *cap = ncap;
+    }
+    (*v)[*count].offset = offset;
+    (*v)[*count].count = n;
+    (*count)++;
+    return 0;
+}
+
+static int match_by_offset(const void *a, const void *b)
+{
+    const RLE2Match *x = (const RLE2Match *)a, *y = (const RLE2Match *)b;
+    return (x->offset > y->offset) - (x->offset < y->offset);
+}
+
+/* Paquetes de un bloque 0x01 / 0x02 al buffer compacto 'out' (ver arriba).
+ * Los runs cortados quedan en *cuts y sus coincidencias internas en res. */
+static int rle2_grep_packets(const RLE2GrepJob *job, int long_form, const uint8_t *in, size_t n,
+                             uint8_t *out, size_t out_cap, RLE2Cut **cuts, size_t *ncuts,
+                             size_t *cuts_cap, RLE2GrepBlock *res, size_t *out_len)
+{
+    size_t keep = job->m - 1;
+    size_t i = 0, o = 0;
+    uint64_t real = 0;
+    *ncuts = 0;
+    while (i < n)
+    {
+        uint64_t len;
+        int run;
+        if (long_form)
         {
-            tag = 0x00;
-            payload = inbuf;
-            paylen = (uint32_t)in_n;
+            uint64_t v = 0;
+            unsigned shift = 0;
+            uint8_t c;
+            do
+            {
+                if (i >= n || shift > 56)
+                    return 1;
+                c = in[i++];
+                v |= (uint64_t)(c & 0x7F) << shift;
+                shift += 7;
+            } while (c & 0x80);
+            run = (int)(v & 1);
+            len = (v >> 1) + 1;
         }
         else
         {
-            tag = 0x01;
-            payload = rlebuf;
-            paylen = (uint32_t)enc_n;
+            run = in[i] >= 128;
+            len = (uint64_t)(in[i++] & 0x7F) + 1;
         }
+        if (len > out_cap - real)
+            return 1;
 
-        uint8_t header[5];
-        header[0] = tag;
-        u32le_write(header + 1, paylen);
-
-        if (write_all(fd_out, header, sizeof(header)) != 0)
+        if (!run)
         {
-            free(inbuf);
-            free(rlebuf);
-            return 3;
+            if (len > n - i)
+                return 1;
+            memcpy(out + o, in + i, (size_t)len);
+            i += (size_t)len;
+            o += (size_t)len;
         }
-        if (write_all(fd_out, payload, paylen) != 0)
+        else if (i >= n)
         {
-            free(inbuf);
-            free(rlebuf);
-            return 4;
+            return 1;
         }
+        else if (len <= 2 * (uint64_t)keep)
+        {
+            memset(out + o, in[i++], (size_t)len);
+            o += (size_t)len;
+        }
+        else
+        {
+            uint8_t v = in[i++];
+            memset(out + o, v, 2 * keep);
+            if (*ncuts == *cuts_cap)
+            {
+                size_t ncap = *cuts_cap ? *cuts_cap * 2 : 64;
+                RLE2Cut *nc = (RLE2Cut *)realloc(*cuts, ncap * sizeof(RLE2Cut));
+                if (!nc)
+                    return 1;
+                *cuts = nc;
+                *cuts_cap = ncap;
+            }
+            (*cuts)[*ncuts].compact = o + keep;
+            (*cuts)[*ncuts].skipped = len - 2 * keep;
+            (*ncuts)++;
+            o += 2 * keep;
+            if (job->uniform && v == job->pat[0] &&
+                rle2_match_push(&res->matches, &res->count, &res->cap, real, len - job->m + 1) != 0)
+                return 1;
+        }
+        real += len;
     }
-
-    free(inbuf);
-    free(rlebuf);
+    res->len = real;
+    *out_len = o;
     return 0;
 }
 
-int rle2_decompress_stream(int fd_in, int fd_out)
+/* Coincidencias en el buffer (compacto si hay cortes) */
+static int rle2_grep_buffer(const RLE2GrepJob *job, const uint8_t *d, size_t n, const RLE2Cut *cuts,
+                            size_t ncuts, RLE2GrepBlock *res)
 {
-    uint8_t hdr[8];
-    if (read_all(fd_in, hdr, sizeof(hdr)) != 0)
-    {
-        fprintf(stderr, "Invalid or short header for RLE2.\n");
-        return 1;
-    }
-    if (memcmp(hdr, RLE2_MAGIC, sizeof(hdr)) != 0)
+    size_t c = 0;
+    uint64_t skipped = 0;
+    const uint8_t *p = d, *end = d + n;
+    while ((size_t)(end - p) >= job->m && (p = (const uint8_t *)memmem(p, (size_t)(end - p), job->pat,
+                                                                      job->m)) != NULL)
     {
-        fprintf(stderr, "Not an RLE2 file.\n");
-        return 1;
+        size_t pos = (size_t)(p - d);
+        while (c < ncuts && cuts[c].compact <= pos)
+            skipped += cuts[c++].skipped;
+        if (!(c < ncuts && cuts[c].compact < pos + job->m) &&
+            rle2_match_push(&res->matches, &res->count, &res->cap, pos + skipped, 1) != 0)
+            return 1;
+        p++;
     }
+    return 0;
+}
 
-    /* Buffers for a block */
-    uint8_t *inbuf = (uint8_t *)malloc(RLE2_BLOCK_SIZE * 2);  /* payload can be RLE, choose 2x */
-    uint8_t *outbuf = (uint8_t *)malloc(RLE2_BLOCK_SIZE * 4); /* decompressed may expand; be generous */
+static void *rle2_grep_worker(void *arg)
+{
+    RLE2GrepJob *job = (RLE2GrepJob *)arg;
+    const RLE2BlockMap *map = job->map;
+
+    size_t in_cap = RLE2_DEC_IN_CAP(map->block_size);
+    size_t out_cap = RLE2_DEC_OUT_CAP(map->block_size);
+    uint8_t *inbuf = (uint8_t *)malloc(in_cap);
+    uint8_t *outbuf = (uint8_t *)malloc(out_cap);
+    RLE2Cut *cuts = NULL;
+    size_t cuts_cap = 0;
+    int rc = 0;
     if (!inbuf || !outbuf)
     {
         fprintf(stderr, "malloc failed\n");
-        free(inbuf);
-        free(outbuf);
-        return 1;
+        rc = 1;
     }
 
-    for (;;)
+    while (rc == 0)
     {
-        uint8_t blk_hdr[5];
-        int rc = read_all(fd_in, blk_hdr, sizeof(blk_hdr));
-        if (rc != 0)
-        {
-            if (rc == 1)
-            { /* EOF cleanly */
-                break;
-            }
-            /* error already printed */
-            free(inbuf);
-            free(outbuf);
-            return 2;
-        }
-
-        uint8_t tag = blk_hdr[0];
-        uint32_t paylen = u32le_read(&blk_hdr[1]);
+        pthread_mutex_lock(&job->mu);
+        int stop = (job->rc != 0 || job->next >= map->count);
+        size_t idx = job->next++;
+        pthread_mutex_unlock(&job->mu);
+        if (stop)
+            break;
 
-        if (paylen == 0)
-            continue; /* empty block */
-        if (paylen > RLE2_BLOCK_SIZE * 2)
+        const RLE2BlockRef *b = &map->blocks[idx];
+        RLE2GrepBlock *res = &job->res[idx];
+        size_t hdr = job->stored ? 0 : map->blk_hdr_len;
+        size_t need = hdr + (size_t)b->paylen;
+        if (need > in_cap || b->raw_len > out_cap)
         {
-            /* sanity guard; adjust if you expect bigger payloads */
-            inbuf = (uint8_t *)realloc(inbuf, paylen);
-            if (!inbuf)
+            size_t ni = (need > in_cap) ? need : in_cap;
+            size_t no = (b->raw_len > out_cap) ? b->raw_len : out_cap;
+            uint8_t *nb_in = (uint8_t *)realloc(inbuf, ni);
+            if (nb_in)
+                inbuf = nb_in;
+            uint8_t *nb_out = nb_in ? (uint8_t *)realloc(outbuf, no) : NULL;
+            if (nb_out)
+                outbuf = nb_out;
+            if (!nb_in || !nb_out)
             {
                 fprintf(stderr, "realloc failed\n");
-                free(outbuf);
-                return 3;
+                rc = 3;
+                break;
             }
+            in_cap = ni;
+            out_cap = no;
         }
-
-        if (read_all(fd_in, inbuf, paylen) != 0)
+        if (pread_all(job->fd, inbuf, need, b->block_off) != 0)
         {
-            free(inbuf);
-            free(outbuf);
-            return 4;
+            fprintf(stderr, "Truncated RLE2 block payload.\n");
+            rc = 4;
+            break;
         }
 
-        if (tag == 0x00)
+        uint8_t tag = job->stored ? RLE2_TAG_RAW : inbuf[0];
+        const uint8_t *payload = inbuf + hdr;
+        const uint8_t *data;
+        size_t n;
+        size_t ncuts = 0;
+        if (!job->stored && (u32le_read(inbuf + 1) != b->paylen ||
+                             (hdr == 9 && u32le_read(inbuf + 5) != b->raw_len)))
         {
-            /* RAW */
-            if (write_all(fd_out, inbuf, paylen) != 0)
-            {
-                free(inbuf);
-                free(outbuf);
-                return 5;
-            }
+            fprintf(stderr, "Block header does not match the index.\n");
+            rc = 6;
+            break;
         }
-        else if (tag == 0x01)
+        if (tag == RLE2_TAG_RLE || tag == RLE2_TAG_RLE_LONG)
         {
-            /* RLE payload */
-            size_t out_len = 0;
-            if (packbits_decode(inbuf, paylen, outbuf, &out_len) != 0)
+            size_t cap = b->raw_len ? b->raw_len : out_cap;
+            if (rle2_grep_packets(job, tag == RLE2_TAG_RLE_LONG, payload, b->paylen, outbuf, cap, &cuts,
+                                  &ncuts, &cuts_cap, res, &n) != 0 ||
+                (b->raw_len && res->len != b->raw_len))
             {
                 fprintf(stderr, "Corrupted RLE2 block payload.\n");
-                free(inbuf);
-                free(outbuf);
-                return 6;
-            }
-            if (write_all(fd_out, outbuf, out_len) != 0)
-            {
-                free(inbuf);
-                free(outbuf);
-                return 7;
+                rc = 6;
+                break;
             }
+            data = outbuf;
         }
         else
         {
-            fprintf(stderr, "Unknown block tag: 0x%02X\n", tag);
-            free(inbuf);
-            free(outbuf);
-            return 8;
+            rc = rle2_decode_payload(tag, payload, b->paylen, b->raw_len, outbuf, out_cap, map->dict,
+                                     &data, &n);
+            if (rc != 0)
+                break;
+            res->len = n;
+        }
+
+        rc = rle2_grep_buffer(job, data, n, cuts, ncuts, res);
+        if (rc != 0)
+            break;
+        if (res->count > 1)
+            qsort(res->matches, res->count, sizeof(RLE2Match), match_by_offset);
+
+        /* Bordes: los cortes quedan a m-1 bytes o más de cada extremo */
+        res->edge_len = (res->len < job->m - 1) ? (size_t)res->len : job->m - 1;
+        if (res->edge_len > 0)
+        {
+            res->edge = (uint8_t *)malloc(2 * res->edge_len);
+            if (!res->edge)
+            {
+                fprintf(stderr, "malloc failed\n");
+                rc = 1;
+                break;
+            }
+            memcpy(res->edge, data, res->edge_len);
+            memcpy(res->edge + res->edge_len, data + n - res->edge_len, res->edge_len);
         }
     }
 
+    if (rc != 0)
+    {
+        pthread_mutex_lock(&job->mu);
+        if (job->rc == 0)
+            job->rc = rc;
+        pthread_mutex_unlock(&job->mu);
+    }
     free(inbuf);
     free(outbuf);
-    return 0;
+    free(cuts);
+    return NULL;
+}
+
+/* Une los resultados por bloque en orden: offsets absolutos y las
+ * coincidencias que empiezan en un bloque y acaban en otro */
+static int rle2_grep_merge(const RLE2GrepJob *job, RLE2Match **out, size_t *count)
+{
+    size_t keep = job->m - 1;
+    size_t cap = 0;
+    uint8_t *carry = (uint8_t *)malloc(keep * 3 + 1); /* carry + borde, y espacio para rehacerlo */
+    size_t clen = 0;
+    uint64_t base = 0;
+    int rc = 0;
+    *out = NULL;
+    *count = 0;
+    if (!carry)
+    {
+        fprintf(stderr, "malloc failed\n");
+        return 1;
+    }
+
+    for (size_t k = 0; rc == 0 && k < job->map->count; k++)
+    {
+        const RLE2GrepBlock *r = &job->res[k];
+        for (size_t i = 0; rc == 0 && i < r->count; i++)
+            rc = rle2_match_push(out, count, &cap, base + r->matches[i].offset, r->matches[i].count);
+
+        if (keep == 0)
+        {
+            base += r->len;
+            continue;
+        }
+        /* ventana: lo que queda de los bloques anteriores + principio de este */
+        memcpy(carry + clen, r->edge, r->edge_len);
+        size_t wlen = clen + r->edge_len;
+        for (size_t p = 0; rc == 0 && p < clen; p++)
+        {
+            if (p + job->m > clen && p + job->m <= wlen && memcmp(carry + p, job->pat, job->m) == 0)
+                rc = rle2_match_push(out, count, &cap, base - clen + p, 1);
+        }
+        /* nuevo carry: últimos m-1 bytes de carry + final de este bloque */
+        memcpy(carry + clen, r->edge + r->edge_len, r->edge_len);
+        size_t total = clen + r->edge_len;
+        size_t nlen = (total < keep) ? total : keep;
+        memmove(carry, carry + total - nlen, nlen);
+        clen = nlen;
+        base += r->len;
+    }
+    free(carry);
+    if (rc == 0 && *count > 1)
+    {
+        /* en orden, y las coincidencias seguidas (un run partido en bloques,
+         * las que cruzan sus bordes) en un solo grupo */
+        qsort(*out, *count, sizeof(RLE2Match), match_by_offset);
+        size_t n = 0;
+        for (size_t i = 1; i < *count; i++)
+        {
+            if ((*out)[i].offset == (*out)[n].offset + (*out)[n].count)
+                (*out)[n].count += (*out)[i].count;
+            else
+                (*out)[++n] = (*out)[i];
+        }
+        *count = n + 1;
+    }
+    return rc;
+}
+
+int rle2_grep_stream(int fd, const uint8_t *pat, size_t m, const RLE2Options *opts,
+                     RLE2Match **matches, size_t *count)
+{
+    *matches = NULL;
+    *count = 0;
+    if (m == 0 || m > RLE2_GREP_MAX_PATTERN)
+    {
+        fprintf(stderr, "The pattern must have between 1 and %d bytes.\n", RLE2_GREP_MAX_PATTERN);
+        return 1;
+    }
+    struct stat st;
+    RLE2Header h;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        fprintf(stderr, "Searching needs a regular file.\n");
+        return 1;
+    }
+    if (rle2_header_pread(fd, &h) != 0)
+    {
+        fprintf(stderr, "Not an RLE2 file.\n");
+        return 1;
+    }
+
+    RLE2BlockMap map;
+    memset(&map, 0, sizeof(map));
+    int rc = 0;
+    if (h.stored)
+    {
+        /* almacenado: trozos de RLE2_GREP_CHUNK leídos tal cual */
+        uint64_t len = (uint64_t)(st.st_size - (off_t)h.hdr_len);
+        size_t n = (size_t)((len + RLE2_GREP_CHUNK - 1) / RLE2_GREP_CHUNK);
+        map.blocks = (RLE2BlockRef *)calloc(n ? n : 1, sizeof(RLE2BlockRef));
+        if (!map.blocks)
+        {
+            fprintf(stderr, "malloc failed\n");
+            return 1;
+        }
+        map.block_size = RLE2_GREP_CHUNK;
+        for (size_t i = 0; i < n; i++)
+        {
+            uint64_t off = (uint64_t)i * RLE2_GREP_CHUNK;
+            uint32_t part = (uint32_t)((len - off < RLE2_GREP_CHUNK) ? len - off : RLE2_GREP_CHUNK);
+            map.blocks[i].block_off = (off_t)(h.hdr_len + off);
+            map.blocks[i].out_off = (off_t)off;
+            map.blocks[i].paylen = part;
+            map.blocks[i].raw_len = part;
+        }
+        map.count = n;
+    }
+    else
+    {
+        const RLE2Dict *dict;
+        rc = rle2_header_dict(&h, opts, &dict);
+        if (rc == 0)
+            rc = rle2_build_block_map(fd, st.st_size, &h, dict, &map);
+        if (rc != 0)
+            return rc;
+    }
+
+    RLE2GrepJob job;
+    memset(&job, 0, sizeof(job));
+    job.fd = fd;
+    job.map = &map;
+    job.stored = h.stored;
+    job.pat = pat;
+    job.m = m;
+    job.uniform = 1;
+    for (size_t i = 1; i < m; i++)
+        job.uniform &= (pat[i] == pat[0]);
+    job.res = (RLE2GrepBlock *)calloc(map.count ? map.count : 1, sizeof(RLE2GrepBlock));
+    if (!job.res)
+    {
+        fprintf(stderr, "malloc failed\n");
+        free(map.blocks);
+        return 1;
+    }
+    pthread_mutex_init(&job.mu, NULL);
+
+    int nthreads = rle2_resolve_threads(opts);
+    if ((size_t)nthreads > map.count)
+        nthreads = (map.count > 0) ? (int)map.count : 1;
+    rle2_run_workers(rle2_grep_worker, &job, nthreads);
+
+    rc = job.rc;
+    if (rc == 0)
+        rc = rle2_grep_merge(&job, matches, count);
+    if (rc != 0)
+    {
+        free(*matches);
+        *matches = NULL;
+        *count = 0;
+    }
+
+    for (size_t i = 0; i < map.count; i++)
+    {
+        free(job.res[i].matches);
+        free(job.res[i].edge);
+    }
+    free(job.res);
+    pthread_mutex_destroy(&job.mu);
+    free(map.blocks);
+    return rc;
 }
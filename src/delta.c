@@ -0,0 +1,279 @@
+#include "delta.h"
+
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define DELTA_SSE2 1
+#endif
+
+/* =======================
+ *  Detección del tamaño de registro
+ *  Autocorrelación sobre el principio del bloque: para cada lag se cuentan
+ *  los bytes cuya diferencia con el byte 'lag' posiciones antes es pequeña
+ *  (|d| < DELTA_SMALL como int8), 16 bytes por iteración con SSE2. El
+ *  mejor lag solo se acepta si la entropía de orden 0 de una muestra más
+ *  larga, ya filtrada, baja claramente respecto a la original; así el
+ *  texto, los datos aleatorios y los bloques sin estructura no pagan el
+ *  filtro.
+ * ======================= */
+
+#define DELTA_SAMPLE 4096
+#define DELTA_SCAN 1024 /* bytes de la muestra usados para elegir el lag */
+#define DELTA_SMALL 16
+
+static size_t small_diffs_scalar(const uint8_t *x, size_t lag, size_t from, size_t len)
+{
+    size_t count = 0;
+    for (size_t i = from; i < len; i++)
+    {
+        uint8_t d = (uint8_t)(x[i] - x[i - lag]);
+        count += (d < DELTA_SMALL || d > 256 - DELTA_SMALL);
+    }
+    return count;
+}
+
+/* Bytes de x[0..len) con |x[i] - x[i - lag]| < DELTA_SMALL */
+static size_t small_diffs(const uint8_t *x, size_t lag, size_t len)
+{
+    size_t count = 0, i = 0;
+#ifdef DELTA_SSE2
+    const __m128i limit = _mm_set1_epi8(DELTA_SMALL - 1);
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i d = _mm_sub_epi8(_mm_loadu_si128((const __m128i *)(x + i)),
+                                 _mm_loadu_si128((const __m128i *)(x + i - lag)));
+        __m128i mag = _mm_min_epu8(d, _mm_sub_epi8(_mm_setzero_si128(), d));
+        __m128i small = _mm_cmpeq_epi8(_mm_min_epu8(mag, limit), mag);
+        count += (size_t)__builtin_popcount((unsigned)_mm_movemask_epi8(small));
+    }
+#endif
+    return count + small_diffs_scalar(x, lag, i, len);
+}
+
+/* log2(v) en punto fijo con 4 bits de fracción (aproximación lineal) */
+static unsigned log2_q4(uint32_t v)
+{
+    if (v == 0)
+        return 0;
+    unsigned e = 31u - (unsigned)__builtin_clz(v);
+    uint32_t frac = (e >= 4) ? (v >> (e - 4)) & 15u : (v << (4 - e)) & 15u;
+    return e * 16u + frac;
+}
+
+/* Tamaño de orden 0 de un histograma, en 1/16 de bit */
+static uint64_t histogram_cost(const uint32_t hist[256], uint32_t total)
+{
+    unsigned log_total = log2_q4(total);
+    uint64_t cost = 0;
+    for (int s = 0; s < 256; s++)
+    {
+        if (hist[s])
+            cost += (uint64_t)hist[s] * (log_total - log2_q4(hist[s]));
+    }
+    return cost;
+}
+
+/* Coste de orden 0 de la muestra filtrada con 'lag', con el mejor modo */
+static uint64_t lag_cost(const uint8_t *x, size_t len, size_t lag, int *mode)
+{
+    uint32_t sub[256], xr[256];
+    memset(sub, 0, sizeof(sub));
+    memset(xr, 0, sizeof(xr));
+    for (size_t i = 0; i < len; i++)
+    {
+        sub[(uint8_t)(x[i] - x[i - lag])]++;
+        xr[x[i] ^ x[i - lag]]++;
+    }
+    uint64_t sub_cost = histogram_cost(sub, (uint32_t)len);
+    uint64_t xor_cost = histogram_cost(xr, (uint32_t)len);
+    *mode = (xor_cost < sub_cost) ? DELTA_XOR : DELTA_SUB;
+    return (xor_cost < sub_cost) ? xor_cost : sub_cost;
+}
+
+size_t delta_detect(const uint8_t *buf, size_t n, int *mode)
+{
+    if (n < DELTA_MAX_STRIDE + DELTA_SCAN)
+        return 0;
+
+    /* la muestra empieza tras DELTA_MAX_STRIDE bytes para que todos los
+     * lags tengan byte anterior */
+    const uint8_t *x = buf + DELTA_MAX_STRIDE;
+    size_t len = n - DELTA_MAX_STRIDE;
+    if (len > DELTA_SAMPLE)
+        len = DELTA_SAMPLE;
+
+    size_t scan = (len < DELTA_SCAN) ? len : DELTA_SCAN;
+    size_t best = 0, best_score = 0;
+    for (size_t lag = 1; lag <= DELTA_MAX_STRIDE; lag++)
+    {
+        size_t score = small_diffs(x, lag, scan);
+        if (score > best_score)
+        {
+            best_score = score;
+            best = lag;
+        }
+    }
+    if (best == 0 || best_score < scan / 2)
+        return 0;
+
+    uint64_t cost = lag_cost(x, len, best, mode);
+
+    /* un múltiplo del registro puntúa casi igual que el registro: se
+     * prefiere el divisor más pequeño que puntúe cerca y no cueste más */
+    for (size_t lag = 1; lag < best; lag++)
+    {
+        if (best % lag != 0 || small_diffs(x, lag, scan) < best_score - best_score / 16)
+            continue;
+        int lag_mode;
+        uint64_t c = lag_cost(x, len, lag, &lag_mode);
+        if (c <= cost)
+        {
+            best = lag;
+            *mode = lag_mode;
+            cost = c;
+            break;
+        }
+    }
+
+    uint32_t raw[256];
+    memset(raw, 0, sizeof(raw));
+    for (size_t i = 0; i < len; i++)
+        raw[x[i]]++;
+    uint64_t raw_cost = histogram_cost(raw, (uint32_t)len);
+    if (cost >= raw_cost - raw_cost / 4)
+        return 0;
+    return best;
+}
+
+/* =======================
+ *  Filtro e inverso
+ *  El encoder recorre el bloque hacia atrás: cada trozo de 16 bytes se
+ *  calcula con bytes anteriores aún sin filtrar, así que vale en su sitio
+ *  para cualquier stride. El inverso va hacia delante y cada byte depende
+ *  del ya reconstruido un registro antes:
+ *    stride >= 16    trozos de 16 bytes independientes
+ *    stride 8..15    trozos de 8 bytes
+ *    stride 1/2/4    suma prefija dentro del vector (desplazar y sumar)
+ *                    más el último registro del vector anterior
+ *    resto           escalar
+ * ======================= */
+
+static inline uint8_t combine(uint8_t a, uint8_t b, int mode)
+{
+    return (mode == DELTA_XOR) ? (uint8_t)(a ^ b) : (uint8_t)(a + b);
+}
+
+void delta_encode(uint8_t *buf, size_t n, size_t stride, int mode)
+{
+    if (stride == 0 || stride >= n)
+        return;
+    size_t i = n;
+#ifdef DELTA_SSE2
+    while (i >= stride + 16)
+    {
+        i -= 16;
+        __m128i x = _mm_loadu_si128((const __m128i *)(buf + i));
+        __m128i y = _mm_loadu_si128((const __m128i *)(buf + i - stride));
+        __m128i r = (mode == DELTA_XOR) ? _mm_xor_si128(x, y) : _mm_sub_epi8(x, y);
+        _mm_storeu_si128((__m128i *)(buf + i), r);
+    }
+#endif
+    while (i > stride)
+    {
+        i--;
+        buf[i] = (mode == DELTA_XOR) ? (uint8_t)(buf[i] ^ buf[i - stride])
+                                     : (uint8_t)(buf[i] - buf[i - stride]);
+    }
+}
+
+#ifdef DELTA_SSE2
+static inline __m128i combine_sse2(__m128i a, __m128i b, int mode)
+{
+    return (mode == DELTA_XOR) ? _mm_xor_si128(a, b) : _mm_add_epi8(a, b);
+}
+
+/* Desplazamientos de bytes con inmediato (stride 1, 2, 4 u 8) */
+static inline __m128i shift_left(__m128i v, size_t k)
+{
+    switch (k)
+    {
+    case 1:
+        return _mm_slli_si128(v, 1);
+    case 2:
+        return _mm_slli_si128(v, 2);
+    case 4:
+        return _mm_slli_si128(v, 4);
+    default:
+        return _mm_slli_si128(v, 8);
+    }
+}
+
+static inline __m128i last_record(__m128i v, size_t k)
+{
+    switch (k)
+    {
+    case 1:
+        return _mm_srli_si128(v, 15);
+    case 2:
+        return _mm_srli_si128(v, 14);
+    case 4:
+        return _mm_srli_si128(v, 12);
+    default:
+        return _mm_srli_si128(v, 8);
+    }
+}
+
+/* stride 1, 2 o 4: a partir de i >= 16 */
+static size_t decode_prefix_sse2(uint8_t *buf, size_t i, size_t n, size_t stride, int mode)
+{
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+        for (size_t k = stride; k < 16; k *= 2)
+            v = combine_sse2(v, shift_left(v, k), mode);
+
+        /* último registro ya reconstruido, repetido en todo el vector */
+        __m128i carry = last_record(_mm_loadu_si128((const __m128i *)(buf + i - 16)), stride);
+        for (size_t k = stride; k < 16; k *= 2)
+            carry = _mm_or_si128(carry, shift_left(carry, k));
+        _mm_storeu_si128((__m128i *)(buf + i), combine_sse2(v, carry, mode));
+    }
+    return i;
+}
+#endif /* DELTA_SSE2 */
+
+void delta_decode(uint8_t *buf, size_t n, size_t stride, int mode)
+{
+    if (stride == 0 || stride >= n)
+        return;
+    size_t i = stride;
+#ifdef DELTA_SSE2
+    if (stride >= 16)
+    {
+        for (; i + 16 <= n; i += 16)
+        {
+            __m128i x = _mm_loadu_si128((const __m128i *)(buf + i));
+            __m128i y = _mm_loadu_si128((const __m128i *)(buf + i - stride));
+            _mm_storeu_si128((__m128i *)(buf + i), combine_sse2(x, y, mode));
+        }
+    }
+    else if (stride >= 8)
+    {
+        for (; i + 8 <= n; i += 8)
+        {
+            __m128i x = _mm_loadl_epi64((const __m128i *)(buf + i));
+            __m128i y = _mm_loadl_epi64((const __m128i *)(buf + i - stride));
+            _mm_storel_epi64((__m128i *)(buf + i), combine_sse2(x, y, mode));
+        }
+    }
+    else if ((stride & (stride - 1)) == 0 && n >= 16)
+    {
+        for (; i < 16; i++)
+            buf[i] = combine(buf[i], buf[i - stride], mode);
+        i = decode_prefix_sse2(buf, i, n, stride, mode);
+    }
+#endif
+    for (; i < n; i++)
+        buf[i] = combine(buf[i], buf[i - stride], mode);
+}
@@ -0,0 +1,282 @@
+#include "dict.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const uint8_t DICT_MAGIC[4] = {'R', 'L', 'E', 'D'};
+
+static inline uint64_t load64(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+/* FNV-1a del contenido: dos diccionarios distintos casi nunca coinciden */
+static uint32_t dict_hash(const uint8_t *p, size_t n)
+{
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < n; i++)
+        h = (h ^ p[i]) * 16777619u;
+    return h;
+}
+
+/* Toma posesión de 'data' (malloc) y prepara las tablas del encoder */
+static RLE2Dict *dict_create(uint8_t *data, size_t size)
+{
+    RLE2Dict *d = (RLE2Dict *)calloc(1, sizeof(RLE2Dict));
+    LZDict *lz = (LZDict *)malloc(sizeof(LZDict));
+    if (!d || !lz)
+    {
+        fprintf(stderr, "malloc failed\n");
+        free(d);
+        free(lz);
+        free(data);
+        return NULL;
+    }
+    d->id = dict_hash(data, size);
+    d->data = data;
+    d->size = size;
+    d->lz = lz;
+    lz_dict_init(lz, data, size);
+    return d;
+}
+
+void dict_free(RLE2Dict *d)
+{
+    if (!d)
+        return;
+    free(d->data);
+    free(d->lz);
+    free(d);
+}
+
+/* =======================
+ *  Entrenamiento
+ *  Como el COVER de zstd, en versión rápida: se cuenta en cuántas
+ *  muestras aparece cada cadena de DICT_DMER bytes (por hash, una vez por
+ *  muestra; las que solo salen en una no sirven para las demás). La
+ *  entrada se parte en tantas épocas como segmentos caben en el
+ *  diccionario y de cada una se elige el tramo de DICT_SEGMENT bytes cuyas
+ *  cadenas distintas suman más; sus cadenas se ponen a 0 para que no se
+ *  repitan en otro segmento. Los mejores segmentos van al final, donde
+ *  quedan a menos distancia de todo el bloque.
+ * ======================= */
+
+#define DICT_DMER 8
+#define DICT_SEGMENT 256
+#define DICT_HASH_BITS 20
+#define DICT_HASH_SIZE (1u << DICT_HASH_BITS)
+
+typedef struct
+{
+    size_t start;
+    size_t len;
+    uint64_t score;
+} DictSegment;
+
+static inline uint32_t dmer_hash(const uint8_t *p)
+{
+    return (uint32_t)((load64(p) * 0x9E3779B97F4A7C15ull) >> (64 - DICT_HASH_BITS));
+}
+
+static int segment_by_score(const void *a, const void *b)
+{
+    const DictSegment *x = (const DictSegment *)a, *y = (const DictSegment *)b;
+    if (x->score != y->score)
+        return (x->score < y->score) ? -1 : 1;
+    return (x->start < y->start) ? -1 : (x->start > y->start);
+}
+
+/* Mejor segmento de [begin, end); 0 si ninguno tiene cadenas compartidas */
+static uint64_t best_segment(const uint8_t *data, size_t begin, size_t end, const uint32_t *freq,
+                             uint16_t *active, size_t *best_start)
+{
+    uint64_t score = 0, best = 0;
+    size_t ws = begin;
+    size_t i = begin;
+    for (; i + DICT_DMER <= end; i++)
+    {
+        uint32_t h = dmer_hash(data + i);
+        if (active[h]++ == 0)
+            score += freq[h];
+        if (i + DICT_DMER - ws > DICT_SEGMENT)
+        {
+            uint32_t o = dmer_hash(data + ws);
+            if (--active[o] == 0)
+                score -= freq[o];
+            ws++;
+        }
+        if (score > best)
+        {
+            best = score;
+            *best_start = ws;
+        }
+    }
+    /* vaciar la ventana para la siguiente época */
+    for (; ws < i; ws++)
+        active[dmer_hash(data + ws)]--;
+    return best;
+}
+
+RLE2Dict *dict_train(const uint8_t *data, const size_t *sizes, size_t count, size_t size)
+{
+    size_t total = 0;
+    for (size_t s = 0; s < count; s++)
+        total += sizes[s];
+    if (size > DICT_MAX_SIZE)
+        size = DICT_MAX_SIZE;
+    if (count < 2 || total < 2 * DICT_SEGMENT || size < DICT_SEGMENT)
+    {
+        fprintf(stderr, "Not enough samples to train a dictionary.\n");
+        return NULL;
+    }
+
+    uint32_t *freq = (uint32_t *)calloc(DICT_HASH_SIZE, sizeof(uint32_t));
+    uint32_t *last = (uint32_t *)calloc(DICT_HASH_SIZE, sizeof(uint32_t));
+    uint16_t *active = (uint16_t *)calloc(DICT_HASH_SIZE, sizeof(uint16_t));
+    size_t nseg = size / DICT_SEGMENT;
+    DictSegment *segs = (DictSegment *)malloc(nseg * sizeof(DictSegment));
+    uint8_t *out = (uint8_t *)malloc(size);
+    if (!freq || !last || !active || !segs || !out)
+    {
+        fprintf(stderr, "malloc failed\n");
+        free(freq);
+        free(last);
+        free(active);
+        free(segs);
+        free(out);
+        return NULL;
+    }
+
+    /* en cuántas muestras aparece cada cadena */
+    size_t off = 0;
+    for (size_t s = 0; s < count; s++)
+    {
+        for (size_t i = off; i + DICT_DMER <= off + sizes[s]; i++)
+        {
+            uint32_t h = dmer_hash(data + i);
+            if (last[h] != (uint32_t)s + 1)
+            {
+                last[h] = (uint32_t)s + 1;
+                freq[h]++;
+            }
+        }
+        off += sizes[s];
+    }
+    for (uint32_t h = 0; h < DICT_HASH_SIZE; h++)
+    {
+        if (freq[h] < 2)
+            freq[h] = 0;
+    }
+
+    size_t epoch = total / nseg;
+    if (epoch < DICT_SEGMENT)
+    {
+        epoch = DICT_SEGMENT;
+        nseg = total / epoch;
+    }
+    size_t found = 0;
+    for (size_t e = 0; e < nseg; e++)
+    {
+        size_t begin = e * epoch;
+        size_t end = (e + 1 == nseg) ? total : begin + epoch;
+        size_t start = begin;
+        uint64_t score = best_segment(data, begin, end, freq, active, &start);
+        if (score == 0)
+            continue;
+        size_t len = (total - start < DICT_SEGMENT) ? total - start : DICT_SEGMENT;
+        for (size_t i = start; i + DICT_DMER <= start + len; i++)
+            freq[dmer_hash(data + i)] = 0;
+        segs[found].start = start;
+        segs[found].len = len;
+        segs[found].score = score;
+        found++;
+    }
+
+    qsort(segs, found, sizeof(DictSegment), segment_by_score);
+    size_t n = 0;
+    for (size_t i = 0; i < found && n + segs[i].len <= size; i++)
+    {
+        memcpy(out + n, data + segs[i].start, segs[i].len);
+        n += segs[i].len;
+    }
+
+    free(freq);
+    free(last);
+    free(active);
+    free(segs);
+    if (n == 0)
+    {
+        fprintf(stderr, "The samples share no content to build a dictionary from.\n");
+        free(out);
+        return NULL;
+    }
+    return dict_create(out, n);
+}
+
+/* =======================
+ *  Archivo de diccionario
+ * ======================= */
+
+static void u32le_put(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static uint32_t u32le_get(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+int dict_save(const RLE2Dict *d, const char *path)
+{
+    FILE *f = fopen(path, "wb");
+    if (!f)
+    {
+        perror("open dictionary");
+        return 1;
+    }
+    uint8_t hdr[DICT_HEADER_SIZE];
+    memcpy(hdr, DICT_MAGIC, 4);
+    u32le_put(hdr + 4, d->id);
+    int rc = (fwrite(hdr, 1, sizeof(hdr), f) != sizeof(hdr) ||
+              fwrite(d->data, 1, d->size, f) != d->size);
+    if (fclose(f) != 0)
+        rc = 1;
+    if (rc)
+        perror("write dictionary");
+    return rc;
+}
+
+RLE2Dict *dict_load(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f)
+    {
+        perror("open dictionary");
+        return NULL;
+    }
+    uint8_t hdr[DICT_HEADER_SIZE];
+    uint8_t *data = (uint8_t *)malloc(DICT_MAX_SIZE + 1);
+    size_t n = 0;
+    int ok = data && fread(hdr, 1, sizeof(hdr), f) == sizeof(hdr) &&
+             memcmp(hdr, DICT_MAGIC, 4) == 0;
+    if (ok)
+    {
+        n = fread(data, 1, DICT_MAX_SIZE + 1, f);
+        ok = n > 0 && n <= DICT_MAX_SIZE && dict_hash(data, n) == u32le_get(hdr + 4);
+    }
+    fclose(f);
+    if (!ok)
+    {
+        fprintf(stderr, "%s is not a valid dictionary.\n", path);
+        free(data);
+        return NULL;
+    }
+    return dict_create(data, n);
+}
@@ -1,3 +1,4 @@
+#define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,6 +8,7 @@
 #include <unistd.h>
 #include <dirent.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <pthread.h>
 #include <limits.h>
 #include <time.h>
@@ -20,7 +22,9 @@
 #define PATH_MAX 4096
 #endif
 
+#include "blockstat.h"
 #include "compressor.h"
+#include "dict.h"
 #include "file_manager.h"
 
 /* ===========================================================
@@ -101,12 +105,107 @@ static void print_results_table(const char *title, const FMResult *rows, int nro
     printf("==============================================\n\n");
 }
 
+/* ===========================================================
+ *                  CONTENT SNIFFING (STORE MODE)
+ * =========================================================== */
+
+/* Formatos ya comprimidos: la firma sola no basta (un ZIP puede guardar
+ * sin comprimir, un TIFF dentro de un contenedor...), solo baja el listón
+ * del sondeo de entropía */
+typedef struct
+{
+    size_t off;
+    const char *magic;
+    size_t len;
+} MagicSig;
+
+static const MagicSig STORE_MAGICS[] = {
+    {0, "\xFF\xD8\xFF", 3},            /* JPEG */
+    {0, "\x89PNG\r\n\x1A\n", 8},     /* PNG */
+    {0, "GIF8", 4},                     /* GIF */
+    {8, "WEBP", 4},                     /* WebP (RIFF) */
+    {0, "PK\x03\x04", 4},               /* ZIP, JAR, DOCX... */
+    {0, "\x1F\x8B", 2},                 /* gzip */
+    {0, "BZh", 3},                      /* bzip2 */
+    {0, "\xFD" "7zXZ\x00", 6},          /* xz */
+    {0, "\x28\xB5\x2F\xFD", 4},         /* zstd */
+    {0, "\x04\x22\x4D\x18", 4},         /* LZ4 */
+    {0, "7z\xBC\xAF\x27\x1C", 6},       /* 7z */
+    {0, "Rar!\x1A\x07", 6},             /* RAR */
+    {0, "ID3", 3},                      /* MP3 con etiqueta */
+    {4, "ftyp", 4},                     /* MP4, MOV, HEIC */
+    {0, "\x1A\x45\xDF\xA3", 4},         /* Matroska, WebM */
+    {0, "OggS", 4},                     /* Ogg */
+    {0, "fLaC", 4},                     /* FLAC */
+    {0, "RLE2", 4},                     /* ya es nuestro */
+    {0, "RLE3", 4},
+};
+
+#define STORE_MIN_SIZE (128 * 1024)
+#define STORE_WINDOWS 8
+#define STORE_WINDOW (64 * 1024)
+
+static int has_store_magic(const uint8_t *h, size_t n)
+{
+    for (size_t i = 0; i < sizeof(STORE_MAGICS) / sizeof(STORE_MAGICS[0]); i++)
+    {
+        const MagicSig *m = &STORE_MAGICS[i];
+        if (n >= m->off + m->len && memcmp(h + m->off, m->magic, m->len) == 0)
+            return 1;
+    }
+    /* MP3 sin etiqueta: sincronía de trama (11 bits a 1) */
+    return n >= 2 && h[0] == 0xFF && (h[1] & 0xE0) == 0xE0;
+}
+
+/* 1 si el archivo debe guardarse tal cual. Se leen STORE_WINDOWS ventanas
+ * repartidas por el archivo y se pasan por la misma muestra que decide los
+ * bloques RAW: si todas salen incompresibles (7 de 8 con una firma
+ * conocida), el codificador habría dejado casi todo en RAW igualmente y se
+ * ahorra leer, muestrear y escribir bloque a bloque. */
+static int should_store(int fd, const RLE2Options *opts)
+{
+    struct stat st;
+    if (opts->max_ratio || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) ||
+        st.st_size < STORE_MIN_SIZE)
+        return 0;
+
+    uint8_t *buf = malloc(STORE_WINDOW);
+    if (!buf)
+        return 0;
+
+    uint64_t size = (uint64_t)st.st_size;
+    int magic = 0, raw = 0;
+    for (int w = 0; w < STORE_WINDOWS; w++)
+    {
+        uint64_t span = (size > STORE_WINDOW) ? size - STORE_WINDOW : 0;
+        off_t off = (off_t)(span * (uint64_t)w / (STORE_WINDOWS - 1));
+        ssize_t r = pread(fd, buf, STORE_WINDOW, off);
+        if (r <= 0)
+            break;
+        if (w == 0)
+            magic = has_store_magic(buf, (size_t)r);
+
+        BlockStats bs;
+        blockstat_sample(buf, (size_t)r, opts->run_threshold, &bs);
+        raw += blockstat_incompressible(&bs);
+    }
+    free(buf);
+    return raw >= (magic ? STORE_WINDOWS - 1 : STORE_WINDOWS);
+}
+
 /* ===========================================================
  *               BASIC FILE OPERATIONS (SERIAL)
  * =========================================================== */
 
-int compress_file_rle(const char *src, const char *dest)
+int compress_file_rle(const char *src, const char *dest, const RLE2Options *opts)
 {
+    RLE2Options defaults;
+    if (!opts)
+    {
+        rle2_default_options(&defaults);
+        opts = &defaults;
+    }
+
     int fd_in = open(src, O_RDONLY);
     if (fd_in < 0)
     {
@@ -122,14 +221,40 @@ int compress_file_rle(const char *src, const char *dest)
         return 1;
     }
 
-    int rc = rle2_compress_stream(fd_in, fd_out);
+    int rc = should_store(fd_in, opts) ? rle2_store_stream(fd_in, fd_out)
+                                       : rle2_compress_stream(fd_in, fd_out, opts);
 
     close(fd_in);
     close(fd_out);
     return rc;
 }
 
-int decompress_file_rle(const char *src, const char *dest)
+/* Con revisión >= 1 el tamaño final es conocido: la salida se dimensiona
+ * con ftruncate y se decodifica directamente sobre el mmap. Si no se puede
+ * mapear (o el archivo es de revisión 0) se usa la API de streams, y
+ * también con --sparse, que necesita ver los ceros antes de escribirlos. */
+static int decompress_mapped(const uint8_t *in, size_t n, int fd_out, uint64_t total,
+                             const RLE2Options *opts)
+{
+    if (ftruncate(fd_out, (off_t)total) != 0)
+    {
+        perror("ftruncate");
+        return 1;
+    }
+    if (total == 0)
+        return 0;
+
+    uint8_t *dst = (uint8_t *)mmap(NULL, (size_t)total, PROT_READ | PROT_WRITE, MAP_SHARED, fd_out, 0);
+    if (dst == MAP_FAILED)
+        return -1;
+
+    size_t out_len = 0;
+    int rc = rle2_decompress_buffer(in, n, dst, (size_t)total, &out_len, opts);
+    munmap(dst, (size_t)total);
+    return rc;
+}
+
+int decompress_file_rle(const char *src, const char *dest, const RLE2Options *opts)
 {
     int fd_in = open(src, O_RDONLY);
     if (fd_in < 0)
@@ -138,7 +263,7 @@ int decompress_file_rle(const char *src, const char *dest)
         return 1;
     }
 
-    int fd_out = open(dest, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    int fd_out = open(dest, O_RDWR | O_CREAT | O_TRUNC, 0644);
     if (fd_out < 0)
     {
         perror("open output");
@@ -146,16 +271,15 @@ int decompress_file_rle(const char *src, const char *dest)
         return 1;
     }
 
-    uint8_t hdr[8];
-    ssize_t r = read(fd_in, hdr, sizeof(hdr));
-    if (r < 0)
+    struct stat st;
+    if (fstat(fd_in, &st) != 0)
     {
-        perror("read");
+        perror("fstat");
         close(fd_in);
         close(fd_out);
         return 1;
     }
-    if (r != 8)
+    if (st.st_size < 8)
     {
         fprintf(stderr, "Invalid header (too short).\n");
         close(fd_in);
@@ -163,34 +287,555 @@ int decompress_file_rle(const char *src, const char *dest)
         return 1;
     }
 
-    if (lseek(fd_in, 0, SEEK_SET) < 0)
+    int rc = -1;
+    size_t in_len = (size_t)st.st_size;
+    uint8_t *in = (uint8_t *)mmap(NULL, in_len, PROT_READ, MAP_PRIVATE, fd_in, 0);
+    if (in != MAP_FAILED)
+    {
+        uint64_t total;
+        int known = rle2_buffer_raw_size(in, in_len, &total);
+        if (known == -1)
+        {
+            fprintf(stderr, "Unknown format (not RLE2).\n");
+            rc = 1;
+        }
+        else if (known == 0 && !(opts && opts->sparse))
+        {
+            rc = decompress_mapped(in, in_len, fd_out, total, opts);
+        }
+        munmap(in, in_len);
+    }
+
+    if (rc == -1)
+    {
+        /* revisión 0, stream truncado o sin mmap: decodificar por bloques
+         * (también reporta dónde está el error) */
+        rc = rle2_decompress_stream(fd_in, fd_out, opts);
+    }
+
+    close(fd_in);
+    close(fd_out);
+    return rc;
+}
+
+int extract_range_rle(const char *src, const char *dest,
+                      unsigned long long offset, unsigned long long length,
+                      const RLE2Options *opts)
+{
+    int fd_in = open(src, O_RDONLY);
+    if (fd_in < 0)
+    {
+        perror("open input");
+        return 1;
+    }
+
+    int fd_out = open(dest, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd_out < 0)
     {
-        perror("lseek");
+        perror("open output");
         close(fd_in);
-        close(fd_out);
         return 1;
     }
 
-    int rc;
-    if (memcmp(hdr, "RLE2\0\0\0\0", 8) == 0)
+    int rc = rle2_extract_range(fd_in, fd_out, (uint64_t)offset, (uint64_t)length, opts);
+
+    close(fd_in);
+    close(fd_out);
+    return rc;
+}
+
+/* ===========================================================
+ *                  APPEND / JOIN (NO RECOMPRESSION)
+ * =========================================================== */
+
+/* Una salida que no se puede alargar en su sitio se reescribe en
+ * dest.tmp, que la sustituye solo si todo ha ido bien */
+static int append_rewrite_rle(int fd_in, int fd_rle, const char *dest, const RLE2Options *opts)
+{
+    char tmp_path[PATH_MAX];
+    struct stat st;
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", dest);
+    mode_t mode = (fstat(fd_rle, &st) == 0) ? (st.st_mode & 0777) : 0644;
+    int fd_tmp = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, mode);
+    if (fd_tmp < 0)
     {
-        rc = rle2_decompress_stream(fd_in, fd_out);
+        perror("open temporary output");
+        return 1;
     }
-    else
+
+    int rc = rle2_append_rewrite(fd_in, fd_rle, fd_tmp, opts);
+    if (close(fd_tmp) != 0 && rc == 0)
+    {
+        perror("close temporary output");
+        rc = 1;
+    }
+    if (rc == 0 && rename(tmp_path, dest) != 0)
     {
-        fprintf(stderr, "Unknown format (not RLE2).\n");
+        perror("rename");
         rc = 1;
     }
+    if (rc != 0)
+        unlink(tmp_path);
+    return rc;
+}
+
+int append_file_rle(const char *src, const char *dest, const RLE2Options *opts)
+{
+    int fd_in = open(src, O_RDONLY);
+    if (fd_in < 0)
+    {
+        perror("open input");
+        return 1;
+    }
+
+    int fd_out = open(dest, O_RDWR | O_CREAT, 0644);
+    if (fd_out < 0)
+    {
+        perror("open output");
+        close(fd_in);
+        return 1;
+    }
+
+    /* Salida nueva: compresión normal, sin sondeo de almacenado, porque un
+     * archivo almacenado habría que reescribirlo en el siguiente --append */
+    struct stat st;
+    int rc;
+    int in_place = 1;
+    if (fstat(fd_out, &st) == 0 && st.st_size == 0)
+        rc = rle2_compress_stream(fd_in, fd_out, opts);
+    else if ((in_place = rle2_append_in_place(fd_out)) == 1)
+        rc = rle2_append_stream(fd_in, fd_out, opts);
+    else if (in_place < 0)
+        rc = 1;
+    else
+        rc = append_rewrite_rle(fd_in, fd_out, dest, opts);
 
     close(fd_in);
     close(fd_out);
     return rc;
 }
 
+/* Archivos regulares de un directorio, por orden de nombre. NULL (con
+ * mensaje) si no se pudo listar; se libera con free_paths. */
+static char **list_regular_files(const char *src_dir, size_t *count)
+{
+    struct dirent **list;
+    *count = 0;
+    int n = scandir(src_dir, &list, NULL, alphasort);
+    if (n < 0)
+    {
+        perror("scandir");
+        return NULL;
+    }
+
+    char **paths = (char **)calloc((size_t)n + 1, sizeof(char *));
+    for (int i = 0; i < n; i++)
+    {
+        char path[PATH_MAX];
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/%s", src_dir, list[i]->d_name);
+        if (paths && stat(path, &st) == 0 && S_ISREG(st.st_mode))
+        {
+            paths[*count] = strdup(path);
+            if (paths[*count])
+                (*count)++;
+        }
+        free(list[i]);
+    }
+    free(list);
+    if (!paths)
+        fprintf(stderr, "malloc failed\n");
+    return paths;
+}
+
+static void free_paths(char **paths, size_t count)
+{
+    for (size_t i = 0; paths && i < count; i++)
+        free(paths[i]);
+    free(paths);
+}
+
+static int join_directory_rle(const char *src_dir, const char *dest, off_t *input_size)
+{
+    size_t count;
+    char **paths = list_regular_files(src_dir, &count);
+    int rc = 1;
+    if (paths && count == 0)
+        fprintf(stderr, "No files to join in %s.\n", src_dir);
+    else if (paths)
+        rc = join_files_rle((const char *const *)paths, count, dest, input_size);
+    free_paths(paths, count);
+    return rc;
+}
+
+int join_files_rle(const char *const *srcs, size_t count, const char *dest, off_t *input_size)
+{
+    struct stat st;
+    *input_size = 0;
+    if (count == 1 && stat(srcs[0], &st) == 0 && S_ISDIR(st.st_mode))
+        return join_directory_rle(srcs[0], dest, input_size);
+
+    /* dest no puede ser una de las entradas: O_TRUNC la borraría */
+    struct stat st_dest;
+    int dest_exists = (stat(dest, &st_dest) == 0);
+    int *fds = (int *)malloc(count * sizeof(int));
+    if (!fds)
+    {
+        fprintf(stderr, "malloc failed\n");
+        return 1;
+    }
+    size_t opened = 0;
+    int rc = 0;
+    for (; opened < count; opened++)
+    {
+        fds[opened] = open(srcs[opened], O_RDONLY);
+        if (fds[opened] < 0 || fstat(fds[opened], &st) != 0)
+        {
+            perror(srcs[opened]);
+            if (fds[opened] >= 0)
+                close(fds[opened]);
+            rc = 1;
+            break;
+        }
+        if (dest_exists && st.st_dev == st_dest.st_dev && st.st_ino == st_dest.st_ino)
+        {
+            fprintf(stderr, "The output cannot be one of the inputs (%s).\n", srcs[opened]);
+            close(fds[opened]);
+            rc = 1;
+            break;
+        }
+        *input_size += st.st_size;
+    }
+
+    if (rc == 0)
+    {
+        int fd_out = open(dest, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd_out < 0)
+        {
+            perror("open output");
+            rc = 1;
+        }
+        else
+        {
+            rc = rle2_concat_streams(fds, count, fd_out);
+            close(fd_out);
+        }
+    }
+
+    for (size_t i = 0; i < opened; i++)
+        close(fds[i]);
+    free(fds);
+    return rc;
+}
+
+/* ===========================================================
+ *                  SEARCH (COMPRESSED DOMAIN)
+ * =========================================================== */
+
+typedef struct
+{
+    const char *path;
+    RLE2Match *matches;
+    size_t count;
+    int rc;
+} GrepFile;
+
+typedef struct
+{
+    GrepFile *files;
+    size_t nfiles;
+    const uint8_t *pat;
+    size_t pat_len;
+    RLE2Options opts;
+
+    pthread_mutex_t mu;
+    size_t next;
+} GrepQueue;
+
+static int grep_one_file(GrepFile *f, const uint8_t *pat, size_t pat_len, const RLE2Options *opts)
+{
+    int fd = open(f->path, O_RDONLY);
+    if (fd < 0)
+    {
+        perror(f->path);
+        return 1;
+    }
+    int rc = rle2_grep_stream(fd, pat, pat_len, opts, &f->matches, &f->count);
+    if (rc != 0)
+        fprintf(stderr, "%s: search failed.\n", f->path);
+    close(fd);
+    return rc;
+}
+
+/* Varios archivos: uno por hilo, cada uno buscado en serie */
+static void *grep_file_worker(void *arg)
+{
+    GrepQueue *q = (GrepQueue *)arg;
+    for (;;)
+    {
+        pthread_mutex_lock(&q->mu);
+        size_t idx = q->next++;
+        pthread_mutex_unlock(&q->mu);
+        if (idx >= q->nfiles)
+            break;
+        q->files[idx].rc = grep_one_file(&q->files[idx], q->pat, q->pat_len, &q->opts);
+    }
+    return NULL;
+}
+
+static int grep_paths_rle(const char *const *srcs, size_t count, const uint8_t *pat, size_t pat_len,
+                          const RLE2Options *opts, unsigned long long *total, size_t *with_matches)
+{
+    GrepFile *files = (GrepFile *)calloc(count, sizeof(GrepFile));
+    if (!files)
+    {
+        fprintf(stderr, "malloc failed\n");
+        return 1;
+    }
+    for (size_t i = 0; i < count; i++)
+        files[i].path = srcs[i];
+
+    if (count == 1)
+    {
+        files[0].rc = grep_one_file(&files[0], pat, pat_len, opts);
+    }
+    else
+    {
+        GrepQueue q;
+        memset(&q, 0, sizeof(q));
+        q.files = files;
+        q.nfiles = count;
+        q.pat = pat;
+        q.pat_len = pat_len;
+        q.opts = *opts;
+        q.opts.threads = 1;
+        pthread_mutex_init(&q.mu, NULL);
+
+        int nthreads = opts->threads;
+        if (nthreads <= 0)
+        {
+            long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+            nthreads = (cpus > RLE2_MAX_THREADS) ? RLE2_MAX_THREADS : (cpus > 0 ? (int)cpus : 1);
+        }
+        if ((size_t)nthreads > count)
+            nthreads = (int)count;
+
+        pthread_t threads[RLE2_MAX_THREADS];
+        int started = 0;
+        for (; started < nthreads && started < RLE2_MAX_THREADS; started++)
+        {
+            if (pthread_create(&threads[started], NULL, grep_file_worker, &q) != 0)
+                break;
+        }
+        if (started == 0)
+            grep_file_worker(&q);
+        for (int i = 0; i < started; i++)
+            pthread_join(threads[i], NULL);
+        pthread_mutex_destroy(&q.mu);
+    }
+
+    /* resultados en el orden de la línea de comandos */
+    int rc = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        const GrepFile *f = &files[i];
+        if (f->rc != 0)
+            rc = 1;
+        for (size_t k = 0; k < f->count; k++)
+        {
+            const RLE2Match *mt = &f->matches[k];
+            if (mt->count == 1)
+                printf("%s:%llu\n", f->path, (unsigned long long)mt->offset);
+            else
+                printf("%s:%llu-%llu (%llu matches in a run)\n", f->path,
+                       (unsigned long long)mt->offset,
+                       (unsigned long long)(mt->offset + mt->count - 1),
+                       (unsigned long long)mt->count);
+            *total += mt->count;
+        }
+        if (f->count > 0)
+            (*with_matches)++;
+        free(f->matches);
+    }
+    free(files);
+    return rc;
+}
+
+int grep_files_rle(const char *const *srcs, size_t count, const uint8_t *pat, size_t pat_len,
+                   const RLE2Options *opts)
+{
+    unsigned long long total = 0;
+    size_t with_matches = 0, searched = count;
+    struct stat st;
+    int rc;
+
+    long long t0 = now_ns();
+    if (count == 1 && stat(srcs[0], &st) == 0 && S_ISDIR(st.st_mode))
+    {
+        char **paths = list_regular_files(srcs[0], &searched);
+        rc = paths ? grep_paths_rle((const char *const *)paths, searched, pat, pat_len, opts, &total,
+                                    &with_matches)
+                   : 1;
+        free_paths(paths, searched);
+    }
+    else
+    {
+        rc = grep_paths_rle(srcs, count, pat, pat_len, opts, &total, &with_matches);
+    }
+    long long t1 = now_ns();
+
+    printf("\n%llu match(es) in %zu of %zu file(s), %.2f ms\n", total, with_matches, searched,
+           ns_to_ms(t1 - t0));
+    return rc;
+}
+
+/* ===========================================================
+ *                  DICTIONARY TRAINING
+ * =========================================================== */
+
+/* De cada archivo basta el principio: en configs y logs lo que se repite
+ * entre archivos (cabeceras, claves, prefijos) está ahí */
+#define TRAIN_MAX_FILE (128 * 1024)
+#define TRAIN_MAX_TOTAL (64 * 1024 * 1024)
+
+/* Lee el principio de un archivo al final de *buf. Devuelve los bytes
+ * añadidos, 0 si no se pudo leer. */
+static size_t append_sample(const char *path, uint8_t **buf, size_t *len, size_t *cap)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return 0;
+    if (*cap - *len < TRAIN_MAX_FILE)
+    {
+        size_t ncap = *cap ? *cap * 2 : 4 * TRAIN_MAX_FILE;
+        uint8_t *nb = (uint8_t *)realloc(*buf, ncap);
+        if (!nb)
+        {
+            close(fd);
+            return 0;
+        }
+        *buf = nb;
+        *cap = ncap;
+    }
+    size_t got = 0;
+    while (got < TRAIN_MAX_FILE)
+    {
+        ssize_t r = read(fd, *buf + *len + got, TRAIN_MAX_FILE - got);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            break;
+        got += (size_t)r;
+    }
+    close(fd);
+    *len += got;
+    return got;
+}
+
+int train_dictionary_rle(const char *src_dir, const char *dict_path, off_t *samples_size)
+{
+    DIR *dir = opendir(src_dir);
+    if (!dir)
+    {
+        perror("opendir");
+        return 1;
+    }
+
+    uint8_t *buf = NULL;
+    size_t len = 0, cap = 0;
+    size_t *sizes = NULL;
+    size_t count = 0, sizes_cap = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL && len < TRAIN_MAX_TOTAL)
+    {
+        char path[PATH_MAX];
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/%s", src_dir, entry->d_name);
+        if (stat(path, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+            continue;
+        if (count == sizes_cap)
+        {
+            size_t ncap = sizes_cap ? sizes_cap * 2 : 256;
+            size_t *ns = (size_t *)realloc(sizes, ncap * sizeof(size_t));
+            if (!ns)
+                break;
+            sizes = ns;
+            sizes_cap = ncap;
+        }
+        size_t got = append_sample(path, &buf, &len, &cap);
+        if (got > 0)
+            sizes[count++] = got;
+    }
+    closedir(dir);
+    *samples_size = (off_t)len;
+
+    RLE2Dict *d = dict_train(buf, sizes, count, DICT_DEFAULT_SIZE);
+    free(buf);
+    free(sizes);
+    if (!d)
+        return 1;
+
+    int rc = dict_save(d, dict_path);
+    if (rc == 0)
+        printf("Dictionary %08X: %zu bytes from %zu files\n", d->id, d->size, count);
+    dict_free(d);
+    return rc;
+}
+
 /* ===========================================================
  *                  CONCURRENT COMPRESSION
  * =========================================================== */
 
+/* Archivos regulares de src_dir que se van a procesar (con el sufijo
+ * dado, si no es NULL) */
+static int count_dir_files(const char *src_dir, const char *suffix)
+{
+    DIR *dir = opendir(src_dir);
+    if (!dir)
+        return 0;
+    int count = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        size_t len = strlen(entry->d_name);
+        size_t slen = suffix ? strlen(suffix) : 0;
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0 ||
+            (suffix && !(len >= slen && strcmp(entry->d_name + len - slen, suffix) == 0)))
+            continue;
+
+        char path[PATH_MAX];
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/%s", src_dir, entry->d_name);
+        if (stat(path, &st) == 0 && S_ISREG(st.st_mode))
+            count++;
+    }
+    closedir(dir);
+    return count;
+}
+
+/* Opciones de cada archivo de un directorio (compresión y descompresión):
+ * los núcleos (--threads, o todos en auto) se reparten entre los
+ * file_threads archivos que van a la vez, para no lanzar
+ * file_threads x RLE2_MAX_THREADS hilos de bloques. Un directorio con un
+ * solo archivo se lo queda entero. */
+static void dir_file_options(const RLE2Options *opts, int file_threads, RLE2Options *out)
+{
+    if (opts)
+        *out = *opts;
+    else
+        rle2_default_options(out);
+
+    int budget = out->threads;
+    if (budget <= 0)
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        budget = (cpus > 0) ? (int)cpus : 1;
+    }
+    if (file_threads < 1)
+        file_threads = 1;
+    out->threads = (budget > file_threads) ? budget / file_threads : 1;
+}
+
 typedef struct
 {
     char input_path[PATH_MAX];
@@ -198,6 +843,8 @@ typedef struct
 
     int thread_id; /* ID del hilo para logs */
 
+    const RLE2Options *opts; /* opciones de compresion (puede ser NULL) */
+
     int index; /* posicion en el array results[] */
     FMResult *results;
 } ThreadTask;
@@ -219,7 +866,7 @@ static void *thread_compress_rle(void *arg)
     printf("[CompThread %d] Compressing: %s -> %s\n",
            task->thread_id, task->input_path, task->output_path);
     long long t0 = now_ns();
-    int rc = compress_file_rle(task->input_path, task->output_path);
+    int rc = compress_file_rle(task->input_path, task->output_path, task->opts);
     long long t1 = now_ns();
 
     if (row)
@@ -240,7 +887,7 @@ static void *thread_compress_rle(void *arg)
     return NULL;
 }
 
-int compress_directory_rle(const char *src_dir, const char *dest_dir)
+int compress_directory_rle(const char *src_dir, const char *dest_dir, const RLE2Options *opts)
 {
     DIR *dir = opendir(src_dir);
     if (!dir)
@@ -261,6 +908,9 @@ int compress_directory_rle(const char *src_dir, const char *dest_dir)
     }
 
     const int MAX_THREADS = 8;
+    RLE2Options file_opts;
+    int files = count_dir_files(src_dir, NULL);
+    dir_file_options(opts, (files < MAX_THREADS) ? files : MAX_THREADS, &file_opts);
     pthread_t threads[MAX_THREADS];
     int thread_count = 0;
     int next_thread_id = 1;
@@ -304,6 +954,7 @@ int compress_directory_rle(const char *src_dir, const char *dest_dir)
         task->index = -1;
         task->results = NULL;
         task->thread_id = next_thread_id++;
+        task->opts = &file_opts;
 
         if (pthread_create(&threads[thread_count], NULL,
                            thread_compress_rle, task) != 0)
@@ -372,7 +1023,7 @@ static void *thread_decompress_rle(void *arg)
     printf("[DecompThread %d] Decompressing: %s -> %s\n",
            task->thread_id, task->input_path, task->output_path);
     long long t0 = now_ns();
-    int rc = decompress_file_rle(task->input_path, task->output_path);
+    int rc = decompress_file_rle(task->input_path, task->output_path, task->opts);
     long long t1 = now_ns();
 
     if (row)
@@ -393,7 +1044,7 @@ static void *thread_decompress_rle(void *arg)
     return NULL;
 }
 
-int decompress_directory_rle(const char *src_dir, const char *dest_dir)
+int decompress_directory_rle(const char *src_dir, const char *dest_dir, const RLE2Options *opts)
 {
     DIR *dir = opendir(src_dir);
     if (!dir)
@@ -414,6 +1065,9 @@ int decompress_directory_rle(const char *src_dir, const char *dest_dir)
     }
 
     const int MAX_THREADS = 64;
+    RLE2Options file_opts;
+    int files = count_dir_files(src_dir, ".rle");
+    dir_file_options(opts, (files < MAX_THREADS) ? files : MAX_THREADS, &file_opts);
     pthread_t threads[MAX_THREADS];
     int thread_count = 0;
     int next_thread_id = 1;
@@ -464,6 +1118,7 @@ int decompress_directory_rle(const char *src_dir, const char *dest_dir)
         task->index = -1;
         task->results = NULL;
         task->thread_id = next_thread_id++;
+        task->opts = &file_opts;
 
         if (pthread_create(&threads[thread_count], NULL,
                            thread_decompress_rle, task) != 0)
@@ -496,7 +1151,7 @@ int decompress_directory_rle(const char *src_dir, const char *dest_dir)
  *             WITH-REPORT VARIANTS (TABLE OUTPUT)
  * =========================================================== */
 
-int compress_file_rle_with_report(const char *src, const char *dest)
+int compress_file_rle_with_report(const char *src, const char *dest, const RLE2Options *opts)
 {
     FMResult row;
     memset(&row, 0, sizeof row);
@@ -507,7 +1162,7 @@ int compress_file_rle_with_report(const char *src, const char *dest)
     row.input_size = get_file_size_or_minus1(src);
 
     long long t0 = now_ns();
-    int rc = compress_file_rle(src, dest);
+    int rc = compress_file_rle(src, dest, opts);
     long long t1 = now_ns();
 
     row.rc = rc;
@@ -518,7 +1173,7 @@ int compress_file_rle_with_report(const char *src, const char *dest)
     return rc;
 }
 
-int decompress_file_rle_with_report(const char *src, const char *dest)
+int decompress_file_rle_with_report(const char *src, const char *dest, const RLE2Options *opts)
 {
     FMResult row;
     memset(&row, 0, sizeof row);
@@ -529,7 +1184,7 @@ int decompress_file_rle_with_report(const char *src, const char *dest)
     row.input_size = get_file_size_or_minus1(src);
 
     long long t0 = now_ns();
-    int rc = decompress_file_rle(src, dest);
+    int rc = decompress_file_rle(src, dest, opts);
     long long t1 = now_ns();
 
     row.rc = rc;
@@ -540,7 +1195,93 @@ int decompress_file_rle_with_report(const char *src, const char *dest)
     return rc;
 }
 
-int compress_directory_rle_with_report(const char *src_dir, const char *dest_dir)
+int extract_range_rle_with_report(const char *src, const char *dest,
+                                  unsigned long long offset, unsigned long long length,
+                                  const RLE2Options *opts)
+{
+    FMResult row;
+    memset(&row, 0, sizeof row);
+
+    const char *slash = strrchr(src, '/');
+    snprintf(row.name, sizeof(row.name), "%s", slash ? slash + 1 : src);
+
+    row.input_size = get_file_size_or_minus1(src);
+
+    long long t0 = now_ns();
+    int rc = extract_range_rle(src, dest, offset, length, opts);
+    long long t1 = now_ns();
+
+    row.rc = rc;
+    row.elapsed_ms = ns_to_ms(t1 - t0);
+    row.output_size = get_file_size_or_minus1(dest);
+
+    print_results_table("Range Extraction Report", &row, 1);
+    return rc;
+}
+
+int append_file_rle_with_report(const char *src, const char *dest, const RLE2Options *opts)
+{
+    FMResult row;
+    memset(&row, 0, sizeof row);
+
+    const char *slash = strrchr(src, '/');
+    snprintf(row.name, sizeof(row.name), "%s", slash ? slash + 1 : src);
+
+    row.input_size = get_file_size_or_minus1(src);
+
+    long long t0 = now_ns();
+    int rc = append_file_rle(src, dest, opts);
+    long long t1 = now_ns();
+
+    row.rc = rc;
+    row.elapsed_ms = ns_to_ms(t1 - t0);
+    row.output_size = get_file_size_or_minus1(dest);
+
+    print_results_table("Append Report", &row, 1);
+    return rc;
+}
+
+int join_files_with_report(const char *const *srcs, size_t count, const char *dest)
+{
+    FMResult row;
+    memset(&row, 0, sizeof row);
+
+    const char *slash = strrchr(dest, '/');
+    snprintf(row.name, sizeof(row.name), "%s", slash ? slash + 1 : dest);
+
+    long long t0 = now_ns();
+    int rc = join_files_rle(srcs, count, dest, &row.input_size);
+    long long t1 = now_ns();
+
+    row.rc = rc;
+    row.elapsed_ms = ns_to_ms(t1 - t0);
+    row.output_size = get_file_size_or_minus1(dest);
+
+    print_results_table("Join Report", &row, 1);
+    return rc;
+}
+
+int train_dictionary_with_report(const char *src_dir, const char *dict_path)
+{
+    FMResult row;
+    memset(&row, 0, sizeof row);
+
+    const char *slash = strrchr(dict_path, '/');
+    snprintf(row.name, sizeof(row.name), "%s", slash ? slash + 1 : dict_path);
+
+    long long t0 = now_ns();
+    int rc = train_dictionary_rle(src_dir, dict_path, &row.input_size);
+    long long t1 = now_ns();
+
+    row.rc = rc;
+    row.elapsed_ms = ns_to_ms(t1 - t0);
+    row.output_size = get_file_size_or_minus1(dict_path);
+
+    print_results_table("Dictionary Training Report", &row, 1);
+    return rc;
+}
+
+int compress_directory_rle_with_report(const char *src_dir, const char *dest_dir, const RLE2Options *opts)
 {
     DIR *dir = opendir(src_dir);
     if (!dir)
@@ -561,6 +1302,9 @@ int compress_directory_rle_with_report(const char *src_dir, const char *dest_dir
     }
 
     const int MAX_THREADS = 64;
+    RLE2Options file_opts;
+    int files = count_dir_files(src_dir, NULL);
+    dir_file_options(opts, (files < MAX_THREADS) ? files : MAX_THREADS, &file_opts);
     const int MAX_FILES = 8192;
     pthread_t threads[MAX_THREADS];
     int thread_count = 0;
@@ -622,6 +1366,7 @@ int compress_directory_rle_with_report(const char *src_dir, const char *dest_dir
         task->index = results_count++;
         task->results = results;
         task->thread_id = next_thread_id++;
+        task->opts = &file_opts;
 
         if (pthread_create(&threads[thread_count], NULL,
                            thread_compress_rle, task) != 0)
@@ -656,7 +1401,7 @@ int compress_directory_rle_with_report(const char *src_dir, const char *dest_dir
     return 0;
 }
 
-int decompress_directory_rle_with_report(const char *src_dir, const char *dest_dir)
+int decompress_directory_rle_with_report(const char *src_dir, const char *dest_dir, const RLE2Options *opts)
 {
     DIR *dir = opendir(src_dir);
     if (!dir)
@@ -677,6 +1422,9 @@ int decompress_directory_rle_with_report(const char *src_dir, const char *dest_d
     }
 
     const int MAX_THREADS = 64;
+    RLE2Options file_opts;
+    int files = count_dir_files(src_dir, ".rle");
+    dir_file_options(opts, (files < MAX_THREADS) ? files : MAX_THREADS, &file_opts);
     const int MAX_FILES = 8192;
     pthread_t threads[MAX_THREADS];
     int thread_count = 0;
@@ -745,6 +1493,7 @@ int decompress_directory_rle_with_report(const char *src_dir, const char *dest_d
         task->index = results_count++;
         task->results = results;
         task->thread_id = next_thread_id++;
+        task->opts = &file_opts;
 
         if (pthread_create(&threads[thread_count], NULL,
                            thread_decompress_rle, task) != 0)
@@ -0,0 +1,453 @@
+#include "huffman.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static uint32_t u32le_get(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void u32le_put(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+/* Tamaño de cada cuarto: los tres primeros ceil(n/4), el último el resto */
+static size_t quarter_size(size_t n)
+{
+    return (n + HUFFMAN_STREAMS - 1) / HUFFMAN_STREAMS;
+}
+
+/* =======================
+ *  Longitudes de código
+ *  Huffman con dos colas: hojas ordenadas por frecuencia y nodos internos
+ *  en orden de creación (ya salen ordenados). Si algún código supera
+ *  HUFFMAN_MAX_BITS se aplanan las frecuencias y se repite; en la práctica
+ *  solo pasa con distribuciones muy sesgadas y converge en 1-2 vueltas.
+ * ======================= */
+
+typedef struct
+{
+    uint32_t freq;
+    uint16_t sym;
+} HuffLeaf;
+
+static int leaf_cmp(const void *a, const void *b)
+{
+    const HuffLeaf *x = (const HuffLeaf *)a;
+    const HuffLeaf *y = (const HuffLeaf *)b;
+    if (x->freq != y->freq)
+        return (x->freq < y->freq) ? -1 : 1;
+    return (int)x->sym - (int)y->sym;
+}
+
+/* Devuelve la longitud máxima */
+static unsigned build_lengths_once(const uint32_t freq[256], uint8_t len[256])
+{
+    HuffLeaf leaves[256];
+    uint64_t weight[512];
+    uint16_t parent[512];
+    size_t m = 0;
+
+    memset(len, 0, 256);
+    for (int s = 0; s < 256; s++)
+    {
+        if (freq[s])
+        {
+            leaves[m].freq = freq[s];
+            leaves[m].sym = (uint16_t)s;
+            m++;
+        }
+    }
+    if (m == 0)
+        return 0;
+    if (m == 1)
+    {
+        len[leaves[0].sym] = 1;
+        return 1;
+    }
+    qsort(leaves, m, sizeof(HuffLeaf), leaf_cmp);
+
+    /* nodos 0..m-1 = hojas, m..2m-2 = internos */
+    for (size_t i = 0; i < m; i++)
+        weight[i] = leaves[i].freq;
+    size_t li = 0, ii = m, next = m;
+    while (next < 2 * m - 1)
+    {
+        size_t pick[2];
+        for (int t = 0; t < 2; t++)
+        {
+            if (li < m && (ii >= next || weight[li] <= weight[ii]))
+                pick[t] = li++;
+            else
+                pick[t] = ii++;
+        }
+        weight[next] = weight[pick[0]] + weight[pick[1]];
+        parent[pick[0]] = parent[pick[1]] = (uint16_t)next;
+        next++;
+    }
+
+    /* profundidades: la raíz es el último nodo */
+    uint8_t depth[512];
+    depth[2 * m - 2] = 0;
+    for (size_t i = 2 * m - 2; i-- > 0;)
+        depth[i] = (uint8_t)(depth[parent[i]] + 1);
+
+    unsigned max_len = 0;
+    for (size_t i = 0; i < m; i++)
+    {
+        len[leaves[i].sym] = depth[i];
+        if (depth[i] > max_len)
+            max_len = depth[i];
+    }
+    return max_len;
+}
+
+static void build_lengths(const uint32_t freq_in[256], uint8_t len[256])
+{
+    uint32_t freq[256];
+    memcpy(freq, freq_in, sizeof(freq));
+    while (build_lengths_once(freq, len) > HUFFMAN_MAX_BITS)
+    {
+        for (int s = 0; s < 256; s++)
+        {
+            if (freq[s])
+                freq[s] = (freq[s] + 1) / 2;
+        }
+    }
+}
+
+/* Códigos canónicos (por longitud y luego por símbolo), invertidos para
+ * escribirlos LSB-first */
+static void assign_codes(const uint8_t len[256], uint16_t code[256])
+{
+    unsigned count[HUFFMAN_MAX_BITS + 1] = {0};
+    unsigned next[HUFFMAN_MAX_BITS + 2];
+    for (int s = 0; s < 256; s++)
+        count[len[s]]++;
+    count[0] = 0;
+
+    unsigned c = 0;
+    for (int l = 1; l <= HUFFMAN_MAX_BITS; l++)
+    {
+        c = (c + count[l - 1]) << 1;
+        next[l] = c;
+    }
+
+    for (int s = 0; s < 256; s++)
+    {
+        unsigned l = len[s];
+        code[s] = 0;
+        if (l == 0)
+            continue;
+        unsigned v = next[l]++, r = 0;
+        for (unsigned b = 0; b < l; b++)
+            r |= ((v >> b) & 1u) << (l - 1 - b);
+        code[s] = (uint16_t)r;
+    }
+}
+
+/* =======================
+ *  Encoder
+ * ======================= */
+
+size_t huffman_plan(const uint8_t *in, size_t n, HuffmanPlan *plan)
+{
+    /* un histograma por cuarto: sirve para el tamaño exacto de cada stream
+     * y reparte los incrementos entre 4 tablas */
+    uint32_t hist[HUFFMAN_STREAMS][256];
+    uint32_t freq[256];
+    size_t q = quarter_size(n);
+    memset(hist, 0, sizeof(hist));
+
+    size_t common = (n > 3 * q) ? n - 3 * q : 0; /* tamaño del último cuarto */
+    size_t t = 0;
+    for (; t < common; t++)
+    {
+        hist[0][in[t]]++;
+        hist[1][in[q + t]]++;
+        hist[2][in[2 * q + t]]++;
+        hist[3][in[3 * q + t]]++;
+    }
+    for (int st = 0; st < HUFFMAN_STREAMS; st++)
+    {
+        size_t from = (size_t)st * q + t;
+        size_t to = (size_t)(st + 1) * q;
+        if (to > n)
+            to = n;
+        for (size_t i = from; i < to; i++)
+            hist[st][in[i]]++;
+    }
+
+    for (int s = 0; s < 256; s++)
+        freq[s] = hist[0][s] + hist[1][s] + hist[2][s] + hist[3][s];
+    build_lengths(freq, plan->len);
+    assign_codes(plan->len, plan->code);
+
+    plan->size = HUFFMAN_HEADER_SIZE;
+    for (int st = 0; st < HUFFMAN_STREAMS; st++)
+    {
+        uint64_t bits = 0;
+        for (int s = 0; s < 256; s++)
+            bits += (uint64_t)hist[st][s] * plan->len[s];
+        plan->stream_size[st] = (uint32_t)((bits + 7) / 8);
+        plan->size += plan->stream_size[st];
+    }
+    return plan->size;
+}
+
+static uint8_t *encode_stream(const uint8_t *in, size_t n, const uint32_t *tab, uint8_t *out)
+{
+    uint64_t acc = 0;
+    unsigned cnt = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        uint32_t e = tab[in[i]];
+        acc |= (uint64_t)(e & 0xFFFF) << cnt;
+        cnt += e >> 16;
+        if (cnt >= 32)
+        {
+            out[0] = (uint8_t)acc;
+            out[1] = (uint8_t)(acc >> 8);
+            out[2] = (uint8_t)(acc >> 16);
+            out[3] = (uint8_t)(acc >> 24);
+            out += 4;
+            acc >>= 32;
+            cnt -= 32;
+        }
+    }
+    while (cnt > 0)
+    {
+        *out++ = (uint8_t)acc;
+        acc >>= 8;
+        cnt = (cnt > 8) ? cnt - 8 : 0;
+    }
+    return out;
+}
+
+size_t huffman_encode(const uint8_t *in, size_t n, const HuffmanPlan *plan, uint8_t *out)
+{
+    uint8_t *p = out;
+    u32le_put(p, (uint32_t)n);
+    p += 4;
+    for (int s = 0; s < 256; s += 2)
+        *p++ = (uint8_t)(plan->len[s] | (plan->len[s + 1] << 4));
+    for (int st = 0; st < HUFFMAN_STREAMS - 1; st++)
+    {
+        u32le_put(p, plan->stream_size[st]);
+        p += 4;
+    }
+
+    /* código | longitud << 16 en una tabla local: las escrituras en out no
+     * obligan a recargarla */
+    uint32_t tab[256];
+    for (int sym = 0; sym < 256; sym++)
+        tab[sym] = plan->code[sym] | ((uint32_t)plan->len[sym] << 16);
+
+    size_t q = quarter_size(n);
+    for (int st = 0; st < HUFFMAN_STREAMS; st++)
+    {
+        size_t from = (size_t)st * q, to = from + q;
+        if (from > n)
+            from = n;
+        if (to > n)
+            to = n;
+        p = encode_stream(in + from, to - from, tab, p);
+    }
+    return (size_t)(p - out);
+}
+
+/* =======================
+ *  Decoder
+ *  Tabla de 2^HUFFMAN_MAX_BITS entradas (símbolo | longitud << 8)
+ *  indexada por los próximos bits. El bucle principal avanza los 4 streams
+ *  a la vez: cada uno carga 8 bytes sin alinear (>= 57 bits válidos) y
+ *  decodifica 4 símbolos, así las cadenas de dependencias de los streams
+ *  se solapan. La cola, cerca del final de cada stream, lee byte a byte.
+ * ======================= */
+
+#define HUFF_TABLE_SIZE (1u << HUFFMAN_MAX_BITS)
+#define HUFF_MASK (HUFF_TABLE_SIZE - 1)
+#define HUFF_SYMS_PER_LOAD 4 /* 4 * 11 bits <= 57 */
+
+typedef struct
+{
+    const uint8_t *base;
+    size_t size; /* bytes */
+    uint64_t pos; /* bits consumidos */
+    uint8_t *out;
+    size_t count; /* símbolos pendientes */
+} HuffStream;
+
+static inline uint64_t load64le(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, 8);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+/* Lectura segura cerca del final (bytes ausentes = 0) */
+static uint64_t peek_tail(const HuffStream *s)
+{
+    size_t byte = (size_t)(s->pos >> 3);
+    uint64_t v = 0;
+    for (size_t b = 0; b < 8 && byte + b < s->size; b++)
+        v |= (uint64_t)s->base[byte + b] << (8 * b);
+    return v >> (s->pos & 7);
+}
+
+static int build_decode_table(const uint8_t len[256], uint16_t *table)
+{
+    uint16_t code[256];
+    uint32_t kraft = 0;
+    for (int s = 0; s < 256; s++)
+    {
+        if (len[s])
+            kraft += HUFF_TABLE_SIZE >> len[s];
+    }
+    if (kraft > HUFF_TABLE_SIZE)
+        return 1; /* sobresuscrito: no es un código de prefijo */
+
+    memset(table, 0, HUFF_TABLE_SIZE * sizeof(uint16_t));
+    assign_codes(len, code);
+    for (int s = 0; s < 256; s++)
+    {
+        unsigned l = len[s];
+        if (l == 0)
+            continue;
+        uint16_t e = (uint16_t)(s | (l << 8));
+        for (unsigned f = code[s]; f < HUFF_TABLE_SIZE; f += 1u << l)
+            table[f] = e;
+    }
+    return 0;
+}
+
+int huffman_decode(const uint8_t *in, size_t n, uint8_t *out, size_t out_cap, size_t *out_len)
+{
+    if (n < HUFFMAN_HEADER_SIZE)
+        return 1;
+
+    size_t total = u32le_get(in);
+    if (total > out_cap)
+        return 1;
+
+    uint8_t len[256];
+    for (int s = 0; s < 256; s += 2)
+    {
+        len[s] = in[4 + s / 2] & 0x0F;
+        len[s + 1] = in[4 + s / 2] >> 4;
+        if (len[s] > HUFFMAN_MAX_BITS || len[s + 1] > HUFFMAN_MAX_BITS)
+            return 1;
+    }
+
+    uint16_t table[HUFF_TABLE_SIZE];
+    if (build_decode_table(len, table) != 0)
+        return 1;
+
+    /* streams */
+    HuffStream st[HUFFMAN_STREAMS];
+    size_t q = quarter_size(total);
+    size_t off = HUFFMAN_HEADER_SIZE;
+    for (int i = 0; i < HUFFMAN_STREAMS; i++)
+    {
+        size_t sz = (i < HUFFMAN_STREAMS - 1) ? u32le_get(in + 4 + 128 + 4 * i) : n - off;
+        if (sz > n - off)
+            return 1;
+        size_t from = (size_t)i * q, to = from + q;
+        if (from > total)
+            from = total;
+        if (to > total)
+            to = total;
+        st[i].base = in + off;
+        st[i].size = sz;
+        st[i].pos = 0;
+        st[i].out = out + from;
+        st[i].count = to - from;
+        off += sz;
+    }
+
+    /* Bucle principal: los 4 streams con margen para cargas de 8 bytes.
+     * Estado en variables locales para que las escrituras de bytes no
+     * obliguen a recargarlo. */
+    {
+        const uint8_t *b0 = st[0].base, *b1 = st[1].base, *b2 = st[2].base, *b3 = st[3].base;
+        uint64_t p0 = 0, p1 = 0, p2 = 0, p3 = 0;
+        uint8_t *o0 = st[0].out, *o1 = st[1].out, *o2 = st[2].out, *o3 = st[3].out;
+        size_t left = st[3].count; /* el último cuarto es el más corto */
+        size_t lim0 = st[0].size, lim1 = st[1].size, lim2 = st[2].size, lim3 = st[3].size;
+
+#define HUFF_STEP4(b, p, o)                                               \
+    do                                                                    \
+    {                                                                     \
+        uint64_t bits = load64le(b + (p >> 3)) >> (p & 7);                \
+        uint16_t e0 = table[bits & HUFF_MASK];                            \
+        bits >>= e0 >> 8;                                                 \
+        uint16_t e1 = table[bits & HUFF_MASK];                            \
+        bits >>= e1 >> 8;                                                 \
+        uint16_t e2 = table[bits & HUFF_MASK];                            \
+        bits >>= e2 >> 8;                                                 \
+        uint16_t e3 = table[bits & HUFF_MASK];                            \
+        o[0] = (uint8_t)e0;                                               \
+        o[1] = (uint8_t)e1;                                               \
+        o[2] = (uint8_t)e2;                                               \
+        o[3] = (uint8_t)e3;                                               \
+        o += 4;                                                           \
+        p += (unsigned)(e0 >> 8) + (e1 >> 8) + (e2 >> 8) + (e3 >> 8);     \
+    } while (0)
+
+        while (left >= HUFF_SYMS_PER_LOAD &&
+               (p0 >> 3) + 8 <= lim0 && (p1 >> 3) + 8 <= lim1 &&
+               (p2 >> 3) + 8 <= lim2 && (p3 >> 3) + 8 <= lim3)
+        {
+            HUFF_STEP4(b0, p0, o0);
+            HUFF_STEP4(b1, p1, o1);
+            HUFF_STEP4(b2, p2, o2);
+            HUFF_STEP4(b3, p3, o3);
+            left -= HUFF_SYMS_PER_LOAD;
+        }
+#undef HUFF_STEP4
+
+        size_t done = st[3].count - left;
+        st[0].pos = p0;
+        st[1].pos = p1;
+        st[2].pos = p2;
+        st[3].pos = p3;
+        st[0].out = o0;
+        st[1].out = o1;
+        st[2].out = o2;
+        st[3].out = o3;
+        for (int i = 0; i < HUFFMAN_STREAMS; i++)
+            st[i].count -= done;
+    }
+
+    /* Cola de cada stream */
+    for (int i = 0; i < HUFFMAN_STREAMS; i++)
+    {
+        HuffStream *s = &st[i];
+        while (s->count > 0)
+        {
+            if ((s->pos >> 3) >= s->size)
+                return 1; /* stream agotado */
+            uint64_t bits = peek_tail(s);
+            uint16_t e = table[bits & HUFF_MASK];
+            if ((e >> 8) == 0)
+                return 1; /* código inexistente */
+            *s->out++ = (uint8_t)e;
+            s->pos += e >> 8;
+            s->count--;
+        }
+        /* cada stream termina en su último byte */
+        if ((s->pos + 7) / 8 != s->size)
+            return 1;
+    }
+
+    *out_len = total;
+    return 0;
+}
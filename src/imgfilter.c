@@ -0,0 +1,348 @@
+#include "imgfilter.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define IMGFILTER_SSE2 1
+#endif
+
+static uint32_t u16le_get(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8);
+}
+
+static uint32_t u32le_get(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/* =======================
+ *  Detección por cabecera
+ *  BMP: "BM", BITMAPINFOHEADER o posterior, 24/32 bpp sin compresión
+ *  (BI_RGB, o BI_BITFIELDS en 32 bpp). Filas alineadas a 4 bytes.
+ *  PNM: "P5"/"P6" binario con maxval <= 255, filas sin relleno.
+ * ======================= */
+
+#define IMGFILTER_MAX_WIDTH (1u << 24)
+
+static int sniff_bmp(const uint8_t *buf, size_t n, ImageLayout *img)
+{
+    if (n < 54 || buf[0] != 'B' || buf[1] != 'M')
+        return 0;
+    uint32_t offset = u32le_get(buf + 10);
+    uint32_t dib = u32le_get(buf + 14);
+    int32_t width = (int32_t)u32le_get(buf + 18);
+    int32_t height = (int32_t)u32le_get(buf + 22);
+    uint32_t planes = u16le_get(buf + 26);
+    uint32_t bits = u16le_get(buf + 28);
+    uint32_t compression = u32le_get(buf + 30);
+
+    if (dib < 40 || planes != 1 || width <= 0 || (uint32_t)width > IMGFILTER_MAX_WIDTH || height == 0)
+        return 0;
+    if (!(bits == 24 && compression == 0) && !(bits == 32 && (compression == 0 || compression == 3)))
+        return 0;
+
+    img->offset = offset;
+    img->stride = (((size_t)width * bits + 31) / 32) * 4;
+    img->rows = (height < 0) ? (uint64_t)(-(int64_t)height) : (uint64_t)height;
+    img->bpp = (int)(bits / 8);
+    return 1;
+}
+
+/* Siguiente número decimal de la cabecera PNM (saltando blancos y
+ * comentarios). Devuelve 0 si no hay. */
+static int pnm_number(const uint8_t *buf, size_t n, size_t *pos, uint32_t *value)
+{
+    size_t i = *pos;
+    for (;;)
+    {
+        while (i < n && (buf[i] == ' ' || buf[i] == '\t' || buf[i] == '\n' || buf[i] == '\r'))
+            i++;
+        if (i < n && buf[i] == '#')
+        {
+            while (i < n && buf[i] != '\n')
+                i++;
+            continue;
+        }
+        break;
+    }
+    if (i >= n || buf[i] < '0' || buf[i] > '9')
+        return 0;
+    uint32_t v = 0;
+    while (i < n && buf[i] >= '0' && buf[i] <= '9')
+    {
+        if (v > IMGFILTER_MAX_WIDTH)
+            return 0;
+        v = v * 10 + (uint32_t)(buf[i] - '0');
+        i++;
+    }
+    *pos = i;
+    *value = v;
+    return 1;
+}
+
+static int sniff_pnm(const uint8_t *buf, size_t n, ImageLayout *img)
+{
+    if (n < 3 || buf[0] != 'P' || (buf[1] != '5' && buf[1] != '6'))
+        return 0;
+    size_t pos = 2;
+    uint32_t width, height, maxval;
+    if (!pnm_number(buf, n, &pos, &width) || !pnm_number(buf, n, &pos, &height) ||
+        !pnm_number(buf, n, &pos, &maxval))
+        return 0;
+    /* un único blanco separa la cabecera de los píxeles */
+    if (pos >= n || width == 0 || height == 0 || maxval == 0 || maxval > 255)
+        return 0;
+
+    img->bpp = (buf[1] == '6') ? 3 : 1;
+    img->offset = pos + 1;
+    img->stride = (size_t)width * (size_t)img->bpp;
+    img->rows = height;
+    return 1;
+}
+
+int imgfilter_sniff(const uint8_t *buf, size_t n, ImageLayout *img)
+{
+    memset(img, 0, sizeof(*img));
+    if (sniff_bmp(buf, n, img) || sniff_pnm(buf, n, img))
+        return 1;
+    memset(img, 0, sizeof(*img));
+    return 0;
+}
+
+/* =======================
+ *  Predictores
+ *  a = byte a la izquierda (mismo canal del píxel anterior), b = arriba,
+ *  c = arriba a la izquierda. El encoder calcula los 4 residuos de una
+ *  fila a la vez (SSE2: 16 bytes por iteración, Paeth en 16 bits) y su
+ *  coste como suma de |residuo| con signo. Las filas se filtran de abajo
+ *  arriba para que la fila de encima siga original.
+ *  En el decoder solo Up es vectorizable: Sub, Average y Paeth dependen
+ *  del byte recién reconstruido a la izquierda.
+ * ======================= */
+
+static inline uint8_t paeth(uint8_t a, uint8_t b, uint8_t c)
+{
+    int p = (int)a + (int)b - (int)c;
+    int pa = abs(p - (int)a), pb = abs(p - (int)b), pc = abs(p - (int)c);
+    if (pa <= pb && pa <= pc)
+        return a;
+    return (pb <= pc) ? b : c;
+}
+
+/* Coste de un residuo: valor absoluto como int8 */
+static inline unsigned residual_cost(uint8_t r)
+{
+    return (r < 128) ? r : 256u - r;
+}
+
+/* res[t] = residuos del filtro t+1 (Sub, Up, Average, Paeth) para los bytes
+ * [from, to) de la fila x (from >= bpp). Devuelve el coste en cost[t]. */
+static void filter_span_scalar(const uint8_t *x, const uint8_t *up, size_t from, size_t to, int bpp,
+                               uint8_t *res[4], uint64_t cost[4])
+{
+    for (size_t i = from; i < to; i++)
+    {
+        uint8_t a = x[i - bpp], b = up[i], c = up[i - bpp];
+        uint8_t r0 = (uint8_t)(x[i] - a);
+        uint8_t r1 = (uint8_t)(x[i] - b);
+        uint8_t r2 = (uint8_t)(x[i] - (uint8_t)(((unsigned)a + b) >> 1));
+        uint8_t r3 = (uint8_t)(x[i] - paeth(a, b, c));
+        res[0][i] = r0;
+        res[1][i] = r1;
+        res[2][i] = r2;
+        res[3][i] = r3;
+        cost[0] += residual_cost(r0);
+        cost[1] += residual_cost(r1);
+        cost[2] += residual_cost(r2);
+        cost[3] += residual_cost(r3);
+    }
+}
+
+#ifdef IMGFILTER_SSE2
+static inline __m128i abs_epi16_sse2(__m128i v)
+{
+    return _mm_max_epi16(v, _mm_sub_epi16(_mm_setzero_si128(), v));
+}
+
+/* Paeth sobre 8 bytes ampliados a 16 bits */
+static inline __m128i paeth_epi16_sse2(__m128i a, __m128i b, __m128i c)
+{
+    __m128i pa = abs_epi16_sse2(_mm_sub_epi16(b, c));
+    __m128i pb = abs_epi16_sse2(_mm_sub_epi16(a, c));
+    __m128i pc = abs_epi16_sse2(_mm_add_epi16(_mm_sub_epi16(b, c), _mm_sub_epi16(a, c)));
+    __m128i not_a = _mm_or_si128(_mm_cmpgt_epi16(pa, pb), _mm_cmpgt_epi16(pa, pc));
+    __m128i use_c = _mm_cmpgt_epi16(pb, pc);
+    __m128i bc = _mm_or_si128(_mm_and_si128(use_c, c), _mm_andnot_si128(use_c, b));
+    return _mm_or_si128(_mm_and_si128(not_a, bc), _mm_andnot_si128(not_a, a));
+}
+
+/* Suma de |residuo| (int8) de 16 bytes, en las dos mitades de 64 bits */
+static inline __m128i cost_sse2(__m128i r)
+{
+    __m128i mag = _mm_min_epu8(r, _mm_sub_epi8(_mm_setzero_si128(), r));
+    return _mm_sad_epu8(mag, _mm_setzero_si128());
+}
+
+static size_t filter_span_sse2(const uint8_t *x, const uint8_t *up, size_t from, size_t to, int bpp,
+                               uint8_t *res[4], uint64_t cost[4])
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi8(1);
+    __m128i acc0 = zero, acc1 = zero, acc2 = zero, acc3 = zero;
+    size_t i = from;
+    for (; i + 16 <= to; i += 16)
+    {
+        __m128i vx = _mm_loadu_si128((const __m128i *)(x + i));
+        __m128i va = _mm_loadu_si128((const __m128i *)(x + i - bpp));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(up + i));
+        __m128i vc = _mm_loadu_si128((const __m128i *)(up + i - bpp));
+
+        __m128i r0 = _mm_sub_epi8(vx, va);
+        __m128i r1 = _mm_sub_epi8(vx, vb);
+        /* media truncada: avg_epu8 redondea hacia arriba */
+        __m128i avg = _mm_sub_epi8(_mm_avg_epu8(va, vb), _mm_and_si128(_mm_xor_si128(va, vb), one));
+        __m128i r2 = _mm_sub_epi8(vx, avg);
+        __m128i plo = paeth_epi16_sse2(_mm_unpacklo_epi8(va, zero), _mm_unpacklo_epi8(vb, zero),
+                                       _mm_unpacklo_epi8(vc, zero));
+        __m128i phi = paeth_epi16_sse2(_mm_unpackhi_epi8(va, zero), _mm_unpackhi_epi8(vb, zero),
+                                       _mm_unpackhi_epi8(vc, zero));
+        __m128i r3 = _mm_sub_epi8(vx, _mm_packus_epi16(plo, phi));
+
+        _mm_storeu_si128((__m128i *)(res[0] + i), r0);
+        _mm_storeu_si128((__m128i *)(res[1] + i), r1);
+        _mm_storeu_si128((__m128i *)(res[2] + i), r2);
+        _mm_storeu_si128((__m128i *)(res[3] + i), r3);
+        acc0 = _mm_add_epi64(acc0, cost_sse2(r0));
+        acc1 = _mm_add_epi64(acc1, cost_sse2(r1));
+        acc2 = _mm_add_epi64(acc2, cost_sse2(r2));
+        acc3 = _mm_add_epi64(acc3, cost_sse2(r3));
+    }
+
+    __m128i accs[4] = {acc0, acc1, acc2, acc3};
+    for (int t = 0; t < 4; t++)
+    {
+        uint64_t half[2];
+        _mm_storeu_si128((__m128i *)half, accs[t]);
+        cost[t] += half[0] + half[1];
+    }
+    return i;
+}
+#endif /* IMGFILTER_SSE2 */
+
+int imgfilter_encode(uint8_t *buf, size_t stride, size_t rows, int bpp, uint8_t *types)
+{
+    if (rows == 0 || stride == 0)
+        return 0;
+
+    /* 4 filas de residuos + una fila de ceros (encima de la primera) */
+    uint8_t *tmp = (uint8_t *)calloc(5, stride);
+    if (!tmp)
+        return 1;
+    uint8_t *res[4] = {tmp, tmp + stride, tmp + 2 * stride, tmp + 3 * stride};
+    const uint8_t *zero_row = tmp + 4 * stride;
+    size_t head = ((size_t)bpp < stride) ? (size_t)bpp : stride;
+
+    for (size_t r = rows; r-- > 0;)
+    {
+        uint8_t *x = buf + r * stride;
+        const uint8_t *up = (r > 0) ? x - stride : zero_row;
+        uint64_t cost[4] = {0, 0, 0, 0};
+        uint64_t none_cost = 0;
+
+        /* primer píxel: sin vecino a la izquierda (a = c = 0) */
+        for (size_t i = 0; i < head; i++)
+        {
+            uint8_t b = up[i];
+            res[0][i] = x[i];
+            res[1][i] = (uint8_t)(x[i] - b);
+            res[2][i] = (uint8_t)(x[i] - (b >> 1));
+            res[3][i] = (uint8_t)(x[i] - b); /* paeth(0, b, 0) = b */
+            for (int t = 0; t < 4; t++)
+                cost[t] += residual_cost(res[t][i]);
+        }
+        size_t i = head;
+#ifdef IMGFILTER_SSE2
+        i = filter_span_sse2(x, up, i, stride, bpp, res, cost);
+#endif
+        filter_span_scalar(x, up, i, stride, bpp, res, cost);
+        for (size_t k = 0; k < stride; k++)
+            none_cost += residual_cost(x[k]);
+
+        int best = IMGFILTER_NONE;
+        uint64_t best_cost = none_cost;
+        for (int t = 0; t < 4; t++)
+        {
+            if (cost[t] < best_cost)
+            {
+                best_cost = cost[t];
+                best = t + 1;
+            }
+        }
+        types[r] = (uint8_t)best;
+        if (best != IMGFILTER_NONE)
+            memcpy(x, res[best - 1], stride);
+    }
+
+    free(tmp);
+    return 0;
+}
+
+static void unfilter_up(uint8_t *x, const uint8_t *up, size_t stride)
+{
+    size_t i = 0;
+#ifdef IMGFILTER_SSE2
+    for (; i + 16 <= stride; i += 16)
+    {
+        __m128i v = _mm_add_epi8(_mm_loadu_si128((const __m128i *)(x + i)),
+                                 _mm_loadu_si128((const __m128i *)(up + i)));
+        _mm_storeu_si128((__m128i *)(x + i), v);
+    }
+#endif
+    for (; i < stride; i++)
+        x[i] = (uint8_t)(x[i] + up[i]);
+}
+
+int imgfilter_decode(uint8_t *buf, size_t stride, size_t rows, int bpp, const uint8_t *types)
+{
+    size_t head = ((size_t)bpp < stride) ? (size_t)bpp : stride;
+    for (size_t r = 0; r < rows; r++)
+    {
+        uint8_t *x = buf + r * stride;
+        const uint8_t *up = (r > 0) ? x - stride : NULL; /* NULL: fila de ceros */
+        switch (types[r])
+        {
+        case IMGFILTER_NONE:
+            break;
+        case IMGFILTER_SUB:
+            for (size_t i = head; i < stride; i++)
+                x[i] = (uint8_t)(x[i] + x[i - bpp]);
+            break;
+        case IMGFILTER_UP:
+            if (up)
+                unfilter_up(x, up, stride);
+            break;
+        case IMGFILTER_AVERAGE:
+            for (size_t i = 0; i < stride; i++)
+            {
+                unsigned a = (i >= head) ? x[i - bpp] : 0, b = up ? up[i] : 0;
+                x[i] = (uint8_t)(x[i] + ((a + b) >> 1));
+            }
+            break;
+        case IMGFILTER_PAETH:
+            for (size_t i = 0; i < stride; i++)
+            {
+                uint8_t a = (i >= head) ? x[i - bpp] : 0;
+                uint8_t b = up ? up[i] : 0;
+                uint8_t c = (up && i >= head) ? up[i - bpp] : 0;
+                x[i] = (uint8_t)(x[i] + paeth(a, b, c));
+            }
+            break;
+        default:
+            return 1;
+        }
+    }
+    return 0;
+}
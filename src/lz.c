@@ -0,0 +1,366 @@
+#include "lz.h"
+
+#include <string.h>
+
+/* Las versiones con y sin diccionario comparten el núcleo; inline forzado
+ * para que sin diccionario desaparezcan las comprobaciones extra */
+#define LZ_INLINE static inline __attribute__((always_inline))
+
+static inline uint32_t load32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static inline uint64_t load64le(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, 8);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+/* =======================
+ *  Encoder
+ *  Hash de 4 bytes -> última posición, y por cada posición de la ventana
+ *  la distancia a la anterior con el mismo hash (cadena). Se recorren como
+ *  mucho LZ_MAX_CHAIN candidatos y se toma el match más largo (greedy).
+ *  Tras 2^LZ_SKIP_TRIGGER fallos seguidos el paso crece, así los bloques
+ *  sin repeticiones se descartan rápido.
+ *  Con diccionario, sus bytes ocupan las posiciones 0..n-1 y el bloque
+ *  empieza en la n: las tablas ya hasheadas del diccionario se copian al
+ *  principio y un candidato por debajo de n apunta dentro de él.
+ * ======================= */
+
+#define LZ_MAX_CHAIN 8
+#define LZ_SKIP_TRIGGER 6
+#define LZ_NO_POS UINT32_MAX
+#define LZ_MAX_OFFSET (LZ_WINDOW - 1)
+
+static inline uint32_t lz_hash(uint32_t v)
+{
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/* 'p' apunta a los bytes de la posición 'pos' */
+static inline void lz_insert(uint32_t *head, uint16_t *chain, const uint8_t *p, uint32_t pos)
+{
+    uint32_t h = lz_hash(load32(p));
+    uint32_t prev = head[h];
+    uint32_t d = (prev == LZ_NO_POS || pos - prev > LZ_MAX_OFFSET) ? 0 : pos - prev;
+    chain[pos & (LZ_WINDOW - 1)] = (uint16_t)d;
+    head[h] = pos;
+}
+
+/* Bytes iguales a partir de a y b, sin pasar de 'end' (a > b) */
+static size_t match_length(const uint8_t *a, const uint8_t *b, const uint8_t *end)
+{
+    const uint8_t *start = a;
+    while (a + 8 <= end)
+    {
+        uint64_t x = load64le(a) ^ load64le(b);
+        if (x)
+            return (size_t)(a - start) + (size_t)(__builtin_ctzll(x) >> 3);
+        a += 8;
+        b += 8;
+    }
+    while (a < end && *a == *b)
+    {
+        a++;
+        b++;
+    }
+    return (size_t)(a - start);
+}
+
+/* Match que empieza en el diccionario: si llega a su final sigue
+ * comparando con el principio del bloque */
+static size_t dict_match_length(const uint8_t *ip, const uint8_t *ref, const uint8_t *dict_end,
+                                const uint8_t *in, const uint8_t *end)
+{
+    const uint8_t *lim = (end - ip > dict_end - ref) ? ip + (dict_end - ref) : end;
+    size_t len = match_length(ip, ref, lim);
+    if (ip + len == lim && lim < end)
+        len += match_length(ip + len, in, end);
+    return len;
+}
+
+/* Bytes extra de una longitud >= 15 */
+static uint8_t *put_length(uint8_t *op, size_t len)
+{
+    while (len >= 255)
+    {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+/* Tamaño máximo de una secuencia: token, longitudes, literales, offset */
+static size_t sequence_bound(size_t lit, size_t ml)
+{
+    return 1 + (lit / 255 + 1) + lit + 2 + (ml / 255 + 1);
+}
+
+LZ_INLINE size_t lz_encode_core(const LZDict *d, const uint8_t *in, size_t n, uint8_t *out,
+                                size_t out_cap)
+{
+    uint32_t head[LZ_HASH_SIZE];
+    uint16_t chain[LZ_WINDOW];
+    const uint8_t *ip = in, *anchor = in, *end = in + n;
+    uint8_t *op = out, *oend = out + out_cap;
+    unsigned misses = 0;
+    const uint8_t *dict = d ? d->data : NULL;
+    uint32_t base = d ? (uint32_t)d->n : 0; /* posición de in[0] */
+
+    if (d)
+    {
+        memcpy(head, d->head, sizeof(head));
+        memcpy(chain, d->chain, base * sizeof(chain[0]));
+    }
+    else
+        memset(head, 0xFF, sizeof(head));
+
+    while (n >= LZ_MIN_MATCH && ip <= end - LZ_MIN_MATCH)
+    {
+        uint32_t pos = base + (uint32_t)(ip - in);
+        uint32_t cand = head[lz_hash(load32(ip))];
+        size_t best_len = 0;
+        uint32_t best_off = 0;
+
+        for (int depth = 0; depth < LZ_MAX_CHAIN && cand != LZ_NO_POS; depth++)
+        {
+            uint32_t off = pos - cand;
+            if (off > LZ_MAX_OFFSET)
+                break;
+            const uint8_t *ref = (cand < base) ? dict + cand : in + (cand - base);
+            if (load32(ref) == load32(ip))
+            {
+                size_t len = (cand < base) ? dict_match_length(ip, ref, dict + base, in, end)
+                                           : match_length(ip, ref, end);
+                if (len > best_len)
+                {
+                    best_len = len;
+                    best_off = off;
+                    if (ip + len == end)
+                        break;
+                }
+            }
+            uint16_t d = chain[cand & (LZ_WINDOW - 1)];
+            if (d == 0)
+                break;
+            cand -= d;
+        }
+        lz_insert(head, chain, ip, pos);
+
+        if (best_len < LZ_MIN_MATCH)
+        {
+            ip += 1 + (misses++ >> LZ_SKIP_TRIGGER);
+            continue;
+        }
+
+        size_t lit = (size_t)(ip - anchor);
+        size_t ml = best_len - LZ_MIN_MATCH;
+        if ((size_t)(oend - op) < sequence_bound(lit, ml))
+            return 0;
+
+        uint8_t *token = op++;
+        *token = (uint8_t)(((lit >= 15 ? 15 : lit) << 4) | (ml >= 15 ? 15 : ml));
+        if (lit >= 15)
+            op = put_length(op, lit - 15);
+        memcpy(op, anchor, lit);
+        op += lit;
+        *op++ = (uint8_t)best_off;
+        *op++ = (uint8_t)(best_off >> 8);
+        if (ml >= 15)
+            op = put_length(op, ml - 15);
+
+        /* del interior del match solo se insertan las 2 últimas posiciones:
+         * casi la misma ganancia que insertarlas todas y bastante más rápido */
+        for (uint32_t p = pos + (uint32_t)best_len - 2; p < pos + best_len && p - base + LZ_MIN_MATCH <= n; p++)
+            lz_insert(head, chain, in + (p - base), p);
+        ip += best_len;
+        anchor = ip;
+        misses = 0;
+    }
+
+    /* última secuencia: solo literales */
+    size_t lit = (size_t)(end - anchor);
+    if ((size_t)(oend - op) < 1 + (lit / 255 + 1) + lit)
+        return 0;
+    uint8_t *token = op++;
+    *token = (uint8_t)((lit >= 15 ? 15 : lit) << 4);
+    if (lit >= 15)
+        op = put_length(op, lit - 15);
+    memcpy(op, anchor, lit);
+    op += lit;
+    return (size_t)(op - out);
+}
+
+size_t lz_encode(const uint8_t *in, size_t n, uint8_t *out, size_t out_cap)
+{
+    return lz_encode_core(NULL, in, n, out, out_cap);
+}
+
+size_t lz_encode_dict(const LZDict *d, const uint8_t *in, size_t n, uint8_t *out, size_t out_cap)
+{
+    return lz_encode_core(d, in, n, out, out_cap);
+}
+
+void lz_dict_init(LZDict *d, const uint8_t *dict, size_t n)
+{
+    if (n > LZ_MAX_DICT)
+    {
+        dict += n - LZ_MAX_DICT;
+        n = LZ_MAX_DICT;
+    }
+    d->data = dict;
+    d->n = n;
+    memset(d->head, 0xFF, sizeof(d->head));
+    for (uint32_t p = 0; p + LZ_MIN_MATCH <= n; p++)
+        lz_insert(d->head, d->chain, dict + p, p);
+}
+
+/* =======================
+ *  Decoder
+ *  Literales cortos y matches con offset >= 8 se copian en trozos fijos
+ *  de 16/8 bytes que pueden pasarse del final (siempre dentro de out_cap
+ *  e in); el resto se copia exacto. Cada longitud y offset se comprueba
+ *  contra los límites antes de copiar. Un offset que pasa del principio
+ *  de la salida solo es válido con diccionario, y va por el camino lento.
+ * ======================= */
+
+#define LZ_WILD 16
+
+static int read_length(const uint8_t **pp, const uint8_t *end, size_t *len)
+{
+    const uint8_t *p = *pp;
+    unsigned b;
+    do
+    {
+        if (p >= end)
+            return 1;
+        b = *p++;
+        *len += b;
+    } while (b == 255);
+    *pp = p;
+    return 0;
+}
+
+LZ_INLINE int lz_decode_core(const uint8_t *dict, size_t dict_n, const uint8_t *in, size_t n,
+                             uint8_t *out, size_t out_cap, size_t *out_len)
+{
+    const uint8_t *ip = in, *iend = in + n;
+    uint8_t *op = out, *oend = out + out_cap;
+
+    for (;;)
+    {
+        if (ip >= iend)
+            return 1;
+        unsigned token = *ip++;
+
+        /* Atajo para la secuencia típica: < 15 literales, match de < 19
+         * bytes con offset >= 16, y margen para copiar 16 + 32 bytes */
+        size_t lit = token >> 4;
+        if (lit < 15 && (token & 15) < 15 && iend - ip >= LZ_WILD + 2 && oend - op >= 3 * LZ_WILD)
+        {
+            size_t off = (size_t)ip[lit] | ((size_t)ip[lit + 1] << 8);
+            if (off >= LZ_WILD && off <= (size_t)(op - out) + lit)
+            {
+                memcpy(op, ip, LZ_WILD);
+                op += lit;
+                ip += lit + 2;
+                const uint8_t *m = op - off;
+                memcpy(op, m, LZ_WILD);
+                memcpy(op + LZ_WILD, m + LZ_WILD, LZ_WILD);
+                op += (token & 15) + LZ_MIN_MATCH;
+                continue;
+            }
+        }
+
+        /* literales */
+        if (lit == 15 && read_length(&ip, iend, &lit) != 0)
+            return 1;
+        if (lit > (size_t)(iend - ip) || lit > (size_t)(oend - op))
+            return 1;
+        if (lit <= LZ_WILD && iend - ip >= LZ_WILD && oend - op >= LZ_WILD)
+            memcpy(op, ip, LZ_WILD);
+        else
+            memcpy(op, ip, lit);
+        op += lit;
+        ip += lit;
+        if (ip == iend)
+            break;
+
+        /* match */
+        if (iend - ip < 2)
+            return 1;
+        size_t off = (size_t)ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        if (off == 0 || off > (size_t)(op - out) + dict_n)
+            return 1;
+        size_t ml = token & 15;
+        if (ml == 15 && read_length(&ip, iend, &ml) != 0)
+            return 1;
+        ml += LZ_MIN_MATCH;
+        if (ml > (size_t)(oend - op))
+            return 1;
+
+        if (off > (size_t)(op - out))
+        {
+            /* desde el diccionario, y lo que sobre desde el principio */
+            size_t back = off - (size_t)(op - out);
+            size_t k = (ml < back) ? ml : back;
+            memcpy(op, dict + dict_n - back, k);
+            op += k;
+            const uint8_t *m = out;
+            for (size_t i = k; i < ml; i++)
+                *op++ = *m++;
+            continue;
+        }
+
+        const uint8_t *m = op - off;
+        uint8_t *mend = op + ml;
+        if (off >= 16 && (size_t)(oend - op) >= ml + 16)
+        {
+            do
+            {
+                memcpy(op, m, 16);
+                op += 16;
+                m += 16;
+            } while (op < mend);
+        }
+        else if (off >= 8 && (size_t)(oend - op) >= ml + 8)
+        {
+            do
+            {
+                memcpy(op, m, 8);
+                op += 8;
+                m += 8;
+            } while (op < mend);
+        }
+        else
+        {
+            while (op < mend)
+                *op++ = *m++;
+        }
+        op = mend;
+    }
+
+    *out_len = (size_t)(op - out);
+    return 0;
+}
+
+int lz_decode(const uint8_t *in, size_t n, uint8_t *out, size_t out_cap, size_t *out_len)
+{
+    return lz_decode_core(NULL, 0, in, n, out, out_cap, out_len);
+}
+
+int lz_decode_dict(const uint8_t *dict, size_t dict_n, const uint8_t *in, size_t n, uint8_t *out,
+                   size_t out_cap, size_t *out_len)
+{
+    return lz_decode_core(dict, dict_n, in, n, out, out_cap, out_len);
+}
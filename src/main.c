@@ -8,6 +8,8 @@
 #include "cli.h"
 #include "file_manager.h"
 #include "encryptor.h"
+#include "compressor.h"
+#include "dict.h"
 
 /**
  * Revisar si hay alguna flag de operaciones (e.g., 'c', 'd', 'e', 'u')
@@ -20,6 +22,14 @@ static int has_flag(const char *ops, char f)
     return strchr(ops, f) != NULL;
 }
 
+/* Diccionario de --dict: se libera al salir, por cualquier camino */
+static RLE2Dict *loaded_dict = NULL;
+
+static void free_loaded_dict(void)
+{
+    dict_free(loaded_dict);
+}
+
 int main(int argc, char *argv[])
 {
     ProgramOptions options;
@@ -33,12 +43,49 @@ int main(int argc, char *argv[])
 
     printf("Operation: %s\n", options.operation);
     printf("Input: %s\n", options.input_path);
-    printf("Output: %s\n", options.output_path);
+    if (options.output_path)
+        printf("Output: %s\n", options.output_path);
     if (options.key)
     {
         printf("Key: %s\n", options.key);
     }
 
+    RLE2Options rle_opts;
+    rle2_default_options(&rle_opts);
+    rle_opts.threads = options.threads;
+    rle_opts.seekable = options.seekable;
+    if (options.codec == 1)
+    {
+        rle_opts.codec = RLE2_CODEC_BWT;
+        rle_opts.block_size = RLE2_BWT_BLOCK_SIZE;
+    }
+    if (options.block_size)
+        rle_opts.block_size = (size_t)options.block_size;
+    if (options.run_threshold)
+        rle_opts.run_threshold = options.run_threshold;
+    rle_opts.max_ratio = options.max_ratio;
+    rle_opts.shuffle = options.shuffle;
+    rle_opts.sparse = options.sparse;
+    if (rle2_validate_options(&rle_opts) != 0)
+        return 1;
+
+    struct stat st_in;
+    if (options.append && (strcmp(options.operation, "c") != 0 ||
+                           (stat(options.input_path, &st_in) == 0 && S_ISDIR(st_in.st_mode))))
+    {
+        fprintf(stderr, "--append only works with -c on a single file.\n");
+        return 1;
+    }
+
+    if (options.dict_path && !has_flag(options.operation, 't'))
+    {
+        loaded_dict = dict_load(options.dict_path);
+        if (!loaded_dict)
+            return 1;
+        atexit(free_loaded_dict);
+        rle_opts.dict = loaded_dict;
+    }
+
     char temp_path[PATH_MAX];
     const char *current_input = options.input_path;
     const char *final_output = options.output_path;
@@ -113,7 +160,7 @@ int main(int argc, char *argv[])
             printf("\n[MODE] Directory decompression (concurrent)\n");
             printf("Source directory : %s\n", current_input);
             printf("Target directory : %s\n\n", final_output);
-            int rc = decompress_directory_rle_with_report(current_input, final_output);
+            int rc = decompress_directory_rle_with_report(current_input, final_output, &rle_opts);
             if (rc != 0)
             {
                 fprintf(stderr, "Directory decompression failed.\n");
@@ -125,8 +172,20 @@ int main(int argc, char *argv[])
         }
         else
         {
-            printf("\n[MODE] Single file decompression\n");
-            int rc = decompress_file_rle_with_report(current_input, final_output);
+            int rc;
+            if (options.has_range)
+            {
+                printf("\n[MODE] Single file range extraction (%llu:%llu)\n",
+                       options.range_offset, options.range_length);
+                rc = extract_range_rle_with_report(current_input, final_output,
+                                                   options.range_offset, options.range_length,
+                                                   &rle_opts);
+            }
+            else
+            {
+                printf("\n[MODE] Single file decompression\n");
+                rc = decompress_file_rle_with_report(current_input, final_output, &rle_opts);
+            }
             if (rc != 0)
             {
                 fprintf(stderr, "Decompression failed.\n");
@@ -161,7 +220,7 @@ int main(int argc, char *argv[])
             printf("\n[MODE] Directory compression (concurrent)\n");
             printf("Source directory : %s\n", current_input);
             printf("Target directory : %s\n\n", temp_path);
-            int rc = compress_directory_rle_with_report(current_input, temp_path);
+            int rc = compress_directory_rle_with_report(current_input, temp_path, &rle_opts);
             if (rc != 0)
             {
                 fprintf(stderr, "Directory compression failed.\n");
@@ -174,7 +233,7 @@ int main(int argc, char *argv[])
         else
         {
             printf("\n[MODE] Single file compression\n");
-            int rc = compress_file_rle_with_report(current_input, temp_path);
+            int rc = compress_file_rle_with_report(current_input, temp_path, &rle_opts);
             if (rc != 0)
             {
                 fprintf(stderr, "File compression failed.\n");
@@ -227,6 +286,46 @@ int main(int argc, char *argv[])
     else
     {
         // Operaciones simples sin archivos temporales
+        if (has_flag(options.operation, 't'))
+        {
+            printf("\n[MODE] Dictionary training\n");
+            printf("Source directory : %s\n", current_input);
+            printf("Dictionary       : %s\n\n", final_output);
+            int rc = train_dictionary_with_report(current_input, final_output);
+            if (rc != 0)
+            {
+                fprintf(stderr, "Dictionary training failed.\n");
+                return rc;
+            }
+            printf("\nDictionary training completed successfully.\n");
+        }
+
+        if (has_flag(options.operation, 'j'))
+        {
+            printf("\n[MODE] Join compressed files\n");
+            int rc = join_files_with_report((const char *const *)options.input_paths,
+                                            (size_t)options.input_count, final_output);
+            if (rc != 0)
+            {
+                fprintf(stderr, "Join failed.\n");
+                return rc;
+            }
+            printf("\nJoin completed successfully.\n");
+        }
+
+        if (has_flag(options.operation, 'g'))
+        {
+            printf("\n[MODE] Compressed search\n\n");
+            int rc = grep_files_rle((const char *const *)options.input_paths,
+                                    (size_t)options.input_count, options.pattern,
+                                    (size_t)options.pattern_len, &rle_opts);
+            if (rc != 0)
+            {
+                fprintf(stderr, "Search failed.\n");
+                return rc;
+            }
+        }
+
         if (has_flag(options.operation, 'c'))
         {
             if (stat(current_input, &st) == 0 && S_ISDIR(st.st_mode))
@@ -234,17 +333,27 @@ int main(int argc, char *argv[])
                 printf("\n[MODE] Directory compression (concurrent)\n");
                 printf("Source directory : %s\n", current_input);
                 printf("Target directory : %s\n\n", final_output);
-                int rc = compress_directory_rle_with_report(current_input, final_output);
+                int rc = compress_directory_rle_with_report(current_input, final_output, &rle_opts);
                 if (rc != 0)
                 {
                     fprintf(stderr, "Directory compression failed.\n");
                     return rc;
                 }
             }
+            else if (options.append)
+            {
+                printf("\n[MODE] Single file append\n");
+                int rc = append_file_rle_with_report(current_input, final_output, &rle_opts);
+                if (rc != 0)
+                {
+                    fprintf(stderr, "File append failed.\n");
+                    return rc;
+                }
+            }
             else
             {
                 printf("\n[MODE] Single file compression\n");
-                int rc = compress_file_rle_with_report(current_input, final_output);
+                int rc = compress_file_rle_with_report(current_input, final_output, &rle_opts);
                 if (rc != 0)
                 {
                     fprintf(stderr, "File compression failed.\n");
@@ -261,7 +370,7 @@ int main(int argc, char *argv[])
                 printf("\n[MODE] Directory decompression (concurrent)\n");
                 printf("Source directory : %s\n", current_input);
                 printf("Target directory : %s\n\n", final_output);
-                int rc = decompress_directory_rle_with_report(current_input, final_output);
+                int rc = decompress_directory_rle_with_report(current_input, final_output, &rle_opts);
                 if (rc != 0)
                 {
                     fprintf(stderr, "Directory decompression failed.\n");
@@ -270,8 +379,20 @@ int main(int argc, char *argv[])
             }
             else
             {
-                printf("\n[MODE] Single file decompression\n");
-                int rc = decompress_file_rle_with_report(current_input, final_output);
+                int rc;
+                if (options.has_range)
+                {
+                    printf("\n[MODE] Single file range extraction (%llu:%llu)\n",
+                           options.range_offset, options.range_length);
+                    rc = extract_range_rle_with_report(current_input, final_output,
+                                                       options.range_offset, options.range_length,
+                                                       &rle_opts);
+                }
+                else
+                {
+                    printf("\n[MODE] Single file decompression\n");
+                    rc = decompress_file_rle_with_report(current_input, final_output, &rle_opts);
+                }
                 if (rc != 0)
                 {
                     fprintf(stderr, "Decompression failed.\n");
@@ -357,7 +478,9 @@ int main(int argc, char *argv[])
     }
 
     if (!has_flag(options.operation, 'c') && !has_flag(options.operation, 'd') &&
-        !has_flag(options.operation, 'e') && !has_flag(options.operation, 'u'))
+        !has_flag(options.operation, 'e') && !has_flag(options.operation, 'u') &&
+        !has_flag(options.operation, 't') && !has_flag(options.operation, 'j') &&
+        !has_flag(options.operation, 'g'))
     {
         fprintf(stderr, "No valid operation specified.\n");
         print_help();
@@ -0,0 +1,1063 @@
+#include "packbits.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PACKBITS_X86 1
+#endif
+
+/* Los encoders se instancian con k constante (ver "Instancias por umbral") */
+#define PACKBITS_INLINE static inline __attribute__((always_inline))
+
+/* =======================
+ *  Encoder escalar (una sola pasada)
+ *  La entrada se recorre como una secuencia de tramos de bytes iguales.
+ *  Un literal se extiende tramo a tramo hasta 128 bytes o hasta el primer
+ *  tramo de al menos k bytes; ese tramo se mide una vez y se emite como
+ *  run. Cada byte se compara un número constante de veces y la salida es
+ *  la misma que la del parse greedy original (run si mide >= k, literal
+ *  que se corta justo antes del siguiente run).
+ * ======================= */
+
+PACKBITS_INLINE size_t encode_scalar_impl(const uint8_t *in, size_t n, uint8_t *out, size_t out_cap,
+                                          size_t k)
+{
+    size_t i = 0, o = 0;
+
+    while (i < n)
+    {
+        /* tramo que empieza en i (máx. 128) */
+        size_t run = 1;
+        while (i + run < n && run < 128 && in[i + run] == in[i])
+            run++;
+
+        if (run >= k)
+        {
+            if (out_cap - o < 2)
+                return 0;
+            out[o++] = 0x80 | (uint8_t)(run - 1); /* MSB=1, length-1 */
+            out[o++] = in[i];
+            i += run;
+            continue;
+        }
+
+        /* LITERAL: avanzar por tramos cortos sin volver atrás */
+        size_t limit = (n - i > 128) ? i + 128 : n;
+        size_t seq = i + run;
+        size_t end = limit;
+        while (seq < limit)
+        {
+            size_t len = 1;
+            while (seq + len < n && len < k && len < 128 && in[seq + len] == in[seq])
+                len++;
+            if (len >= k)
+            {
+                end = seq; /* cortar justo antes del run */
+                break;
+            }
+            seq += len;
+        }
+
+        /* emit LITERAL packet: ctrl = (len-1) with MSB=0 */
+        size_t lit_len = end - i;
+        if (out_cap - o < 1 + lit_len)
+            return 0;
+        out[o++] = (uint8_t)(lit_len - 1);
+        memcpy(out + o, in + i, lit_len);
+        o += lit_len;
+        i = end;
+    }
+    return o;
+}
+
+/* =======================
+ *  Encoder vectorizado
+ *  eq_mask64(p): bit t = (p[t] == p[t+1]) para t en [0, 64); lee p[0..64].
+ *  En j empieza un run de al menos k bytes si los bits j..j+k-2 están a 1,
+ *  así que la máscara de inicios es E & (E>>1) & ... & (E>>(k-2)).
+ *  El literal salta directamente al primer inicio de run; el run se mide
+ *  comparando 16/32 bytes contra el valor repetido.
+ * ======================= */
+
+typedef struct
+{
+    const char *name;
+    uint64_t (*eq_mask64)(const uint8_t *p);
+    size_t (*run_length)(const uint8_t *p, size_t avail);
+    /* camino rápido del decoder (ver "Decoder"); avanza *pi y devuelve los bytes escritos */
+    size_t (*decode_fast)(const uint8_t *in, size_t n, size_t *pi, uint8_t *out, size_t out_cap);
+    /* runs periódicos: bit t = (p[t] == p[t+d]), lee p[0..64+d) */
+    uint64_t (*eq_mask64_at)(const uint8_t *p, size_t d);
+    /* bytes iguales al principio de a y b (como máximo avail) */
+    size_t (*match_length)(const uint8_t *a, const uint8_t *b, size_t avail);
+} PackbitsKernel;
+
+/* El SIMD cubre umbrales en los que la máscara deja suficientes bits válidos */
+#define PACKBITS_SIMD_MAX_K 32
+
+/* El camino rápido del decoder copia en trozos fijos redondeando hacia
+ * arriba, hasta 128 bytes por paquete: necesita un paquete completo de
+ * entrada (control + 128) y 128 bytes libres de salida. */
+#define PACKBITS_DECODE_IN_MARGIN 129
+#define PACKBITS_DECODE_OUT_MARGIN 128
+
+static inline unsigned ctz64(uint64_t v)
+{
+    return (unsigned)__builtin_ctzll(v);
+}
+
+/* ¿Empieza en j un run de al menos k bytes? (misma condición que el escalar) */
+static inline int run_starts_at(const uint8_t *in, size_t n, size_t j, int k)
+{
+    if (j + (size_t)k > n)
+        return 0;
+    for (int t = 1; t < k; t++)
+    {
+        if (in[j + t] != in[j])
+            return 0;
+    }
+    return 1;
+}
+
+/* Primer j en [from, limit) donde empieza un run >= k; limit si no hay. */
+PACKBITS_INLINE size_t find_run_start(const PackbitsKernel *kn, const uint8_t *in, size_t n,
+                             size_t from, size_t limit, int k)
+{
+    const unsigned span = 64 - (unsigned)(k - 2); /* bits válidos por ventana */
+    const uint64_t valid = (span < 64) ? (((uint64_t)1 << span) - 1) : ~(uint64_t)0;
+    size_t j = from;
+
+    while (j < limit && j + 64 < n)
+    {
+        uint64_t e = kn->eq_mask64(in + j);
+        uint64_t s = e;
+        for (int t = 1; t <= k - 2; t++)
+            s &= e >> t;
+        s &= valid;
+        if (s)
+        {
+            size_t r = j + ctz64(s);
+            return (r < limit) ? r : limit;
+        }
+        j += span;
+    }
+
+    /* cola: menos de 65 bytes hasta el final del bloque */
+    for (; j < limit; j++)
+    {
+        if (run_starts_at(in, n, j, k))
+            return j;
+    }
+    return limit;
+}
+
+PACKBITS_INLINE size_t encode_simd_impl(const PackbitsKernel *kn, const uint8_t *in, size_t n,
+                                        uint8_t *out, size_t out_cap, int k_min_run)
+{
+    size_t i = 0, o = 0;
+    const size_t k = (size_t)k_min_run;
+
+    while (i < n)
+    {
+        size_t avail = (n - i > 128) ? 128 : n - i;
+        size_t run = kn->run_length(in + i, avail);
+
+        if (run >= k)
+        {
+            if (out_cap - o < 2)
+                return 0;
+            out[o++] = 0x80 | (uint8_t)(run - 1);
+            out[o++] = in[i];
+            i += run;
+            continue;
+        }
+
+        size_t limit = i + avail;
+        size_t end = find_run_start(kn, in, n, i + 1, limit, k_min_run);
+        size_t lit_len = end - i;
+        if (out_cap - o < 1 + lit_len)
+            return 0;
+
+        out[o++] = (uint8_t)(lit_len - 1);
+        memcpy(out + o, in + i, lit_len);
+        o += lit_len;
+        i = end;
+    }
+    return o;
+}
+
+#ifdef PACKBITS_X86
+
+static uint64_t eq_mask64_sse2(const uint8_t *p)
+{
+    uint64_t m = 0;
+    for (int c = 0; c < 4; c++)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *)(p + 16 * c));
+        __m128i b = _mm_loadu_si128((const __m128i *)(p + 16 * c + 1));
+        m |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) << (16 * c);
+    }
+    return m;
+}
+
+static size_t run_length_sse2(const uint8_t *p, size_t avail)
+{
+    const __m128i v = _mm_set1_epi8((char)p[0]);
+    size_t r = 0;
+    while (r + 16 <= avail)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i *)(p + r));
+        unsigned diff = ~(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(x, v)) & 0xFFFFu;
+        if (diff)
+            return r + (size_t)__builtin_ctz(diff);
+        r += 16;
+    }
+    while (r < avail && p[r] == p[0])
+        r++;
+    return r;
+}
+
+__attribute__((target("avx2"))) static uint64_t eq_mask64_avx2(const uint8_t *p)
+{
+    __m256i a0 = _mm256_loadu_si256((const __m256i *)p);
+    __m256i b0 = _mm256_loadu_si256((const __m256i *)(p + 1));
+    __m256i a1 = _mm256_loadu_si256((const __m256i *)(p + 32));
+    __m256i b1 = _mm256_loadu_si256((const __m256i *)(p + 33));
+    uint32_t lo = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a0, b0));
+    uint32_t hi = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a1, b1));
+    return (uint64_t)lo | ((uint64_t)hi << 32);
+}
+
+__attribute__((target("avx2"))) static size_t run_length_avx2(const uint8_t *p, size_t avail)
+{
+    const __m256i v = _mm256_set1_epi8((char)p[0]);
+    size_t r = 0;
+    while (r + 32 <= avail)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(p + r));
+        uint32_t diff = ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, v));
+        if (diff)
+            return r + (size_t)__builtin_ctz(diff);
+        r += 32;
+    }
+    while (r < avail && p[r] == p[0])
+        r++;
+    return r;
+}
+
+/* Sobre-copia: literales en trozos de 16 bytes, runs en trozos de 64 */
+static size_t decode_fast_sse2(const uint8_t *in, size_t n, size_t *pi, uint8_t *out, size_t out_cap)
+{
+    size_t i = *pi, o = 0;
+    while (i + PACKBITS_DECODE_IN_MARGIN <= n && o + PACKBITS_DECODE_OUT_MARGIN <= out_cap)
+    {
+        uint8_t ctrl = in[i];
+        size_t len = (size_t)(ctrl & 0x7F) + 1;
+        uint8_t *dst = out + o;
+        if ((ctrl & 0x80) == 0)
+        {
+            const uint8_t *src = in + i + 1;
+            size_t c = 0;
+            do
+            {
+                _mm_storeu_si128((__m128i *)(dst + c), _mm_loadu_si128((const __m128i *)(src + c)));
+                _mm_storeu_si128((__m128i *)(dst + c + 16), _mm_loadu_si128((const __m128i *)(src + c + 16)));
+                c += 32;
+            } while (c < len);
+            i += 1 + len;
+        }
+        else
+        {
+            const __m128i v = _mm_set1_epi8((char)in[i + 1]);
+            size_t c = 0;
+            do
+            {
+                _mm_storeu_si128((__m128i *)(dst + c), v);
+                _mm_storeu_si128((__m128i *)(dst + c + 16), v);
+                _mm_storeu_si128((__m128i *)(dst + c + 32), v);
+                _mm_storeu_si128((__m128i *)(dst + c + 48), v);
+                c += 64;
+            } while (c < len);
+            i += 2;
+        }
+        o += len;
+    }
+    *pi = i;
+    return o;
+}
+
+__attribute__((target("avx2"))) static size_t decode_fast_avx2(const uint8_t *in, size_t n, size_t *pi,
+                                                               uint8_t *out, size_t out_cap)
+{
+    size_t i = *pi, o = 0;
+    while (i + PACKBITS_DECODE_IN_MARGIN <= n && o + PACKBITS_DECODE_OUT_MARGIN <= out_cap)
+    {
+        uint8_t ctrl = in[i];
+        size_t len = (size_t)(ctrl & 0x7F) + 1;
+        uint8_t *dst = out + o;
+        if ((ctrl & 0x80) == 0)
+        {
+            const uint8_t *src = in + i + 1;
+            size_t c = 0;
+            do
+            {
+                _mm256_storeu_si256((__m256i *)(dst + c), _mm256_loadu_si256((const __m256i *)(src + c)));
+                c += 32;
+            } while (c < len);
+            i += 1 + len;
+        }
+        else
+        {
+            const __m256i v = _mm256_set1_epi8((char)in[i + 1]);
+            size_t c = 0;
+            do
+            {
+                _mm256_storeu_si256((__m256i *)(dst + c), v);
+                _mm256_storeu_si256((__m256i *)(dst + c + 32), v);
+                c += 64;
+            } while (c < len);
+            i += 2;
+        }
+        o += len;
+    }
+    *pi = i;
+    return o;
+}
+
+static uint64_t eq_mask64_at_sse2(const uint8_t *p, size_t d)
+{
+    uint64_t m = 0;
+    for (int c = 0; c < 4; c++)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *)(p + 16 * c));
+        __m128i b = _mm_loadu_si128((const __m128i *)(p + 16 * c + d));
+        m |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) << (16 * c);
+    }
+    return m;
+}
+
+static size_t match_length_sse2(const uint8_t *a, const uint8_t *b, size_t avail)
+{
+    size_t r = 0;
+    while (r + 16 <= avail)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i *)(a + r));
+        __m128i y = _mm_loadu_si128((const __m128i *)(b + r));
+        unsigned diff = ~(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) & 0xFFFFu;
+        if (diff)
+            return r + (size_t)__builtin_ctz(diff);
+        r += 16;
+    }
+    while (r < avail && a[r] == b[r])
+        r++;
+    return r;
+}
+
+__attribute__((target("avx2"))) static uint64_t eq_mask64_at_avx2(const uint8_t *p, size_t d)
+{
+    __m256i a0 = _mm256_loadu_si256((const __m256i *)p);
+    __m256i b0 = _mm256_loadu_si256((const __m256i *)(p + d));
+    __m256i a1 = _mm256_loadu_si256((const __m256i *)(p + 32));
+    __m256i b1 = _mm256_loadu_si256((const __m256i *)(p + 32 + d));
+    uint32_t lo = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a0, b0));
+    uint32_t hi = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a1, b1));
+    return (uint64_t)lo | ((uint64_t)hi << 32);
+}
+
+__attribute__((target("avx2"))) static size_t match_length_avx2(const uint8_t *a, const uint8_t *b,
+                                                                size_t avail)
+{
+    size_t r = 0;
+    while (r + 32 <= avail)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(a + r));
+        __m256i y = _mm256_loadu_si256((const __m256i *)(b + r));
+        uint32_t diff = ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+        if (diff)
+            return r + (size_t)__builtin_ctz(diff);
+        r += 32;
+    }
+    while (r < avail && a[r] == b[r])
+        r++;
+    return r;
+}
+
+static const PackbitsKernel KERNEL_SSE2 = {"sse2", eq_mask64_sse2, run_length_sse2, decode_fast_sse2,
+                                           eq_mask64_at_sse2, match_length_sse2};
+static const PackbitsKernel KERNEL_AVX2 = {"avx2", eq_mask64_avx2, run_length_avx2, decode_fast_avx2,
+                                           eq_mask64_at_avx2, match_length_avx2};
+
+#endif /* PACKBITS_X86 */
+
+/* =======================
+ *  Selección del kernel (una vez por proceso)
+ * ======================= */
+
+static const PackbitsKernel *g_kernel; /* NULL = escalar */
+static const char *g_kernel_name = "scalar";
+static pthread_once_t g_kernel_once = PTHREAD_ONCE_INIT;
+
+static void packbits_detect_kernel(void)
+{
+#ifdef PACKBITS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        g_kernel = &KERNEL_AVX2;
+    else
+        g_kernel = &KERNEL_SSE2; /* SSE2 es la base en x86-64 */
+    g_kernel_name = g_kernel->name;
+#endif
+}
+
+int packbits_set_kernel(const char *name)
+{
+    pthread_once(&g_kernel_once, packbits_detect_kernel);
+    if (strcmp(name, "scalar") == 0)
+    {
+        g_kernel = NULL;
+        g_kernel_name = "scalar";
+        return 1;
+    }
+#ifdef PACKBITS_X86
+    if (strcmp(name, "sse2") == 0)
+    {
+        g_kernel = &KERNEL_SSE2;
+        g_kernel_name = g_kernel->name;
+        return 1;
+    }
+    if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2"))
+    {
+        g_kernel = &KERNEL_AVX2;
+        g_kernel_name = g_kernel->name;
+        return 1;
+    }
+#endif
+    return 0;
+}
+
+const char *packbits_kernel_name(void)
+{
+    pthread_once(&g_kernel_once, packbits_detect_kernel);
+    return g_kernel_name;
+}
+
+/* =======================
+ *  Instancias por umbral
+ *  Para los umbrales habituales (2..8) se genera una copia de cada encoder
+ *  con k constante: el compilador desenrolla el AND de máscaras y las
+ *  comparaciones del literal, así que un umbral elegido en tiempo de
+ *  ejecución cuesta lo mismo que el de compilación.
+ * ======================= */
+
+#define PACKBITS_SPEC_MIN_K 2
+#define PACKBITS_SPEC_MAX_K 8
+
+typedef size_t (*EncodeScalarFn)(const uint8_t *in, size_t n, uint8_t *out, size_t out_cap);
+typedef size_t (*EncodeSimdFn)(const PackbitsKernel *kn, const uint8_t *in, size_t n, uint8_t *out,
+                               size_t out_cap);
+
+#define PACKBITS_SPECIALIZE(K)                                                                 \
+    static size_t encode_scalar_k##K(const uint8_t *in, size_t n, uint8_t *out, size_t out_cap) \
+    {                                                                                          \
+        return encode_scalar_impl(in, n, out, out_cap, K);                                     \
+    }                                                                                          \
+    static size_t encode_simd_k##K(const PackbitsKernel *kn, const uint8_t *in, size_t n,      \
+                                   uint8_t *out, size_t out_cap)                               \
+    {                                                                                          \
+        return encode_simd_impl(kn, in, n, out, out_cap, K);                                   \
+    }
+
+PACKBITS_SPECIALIZE(2)
+PACKBITS_SPECIALIZE(3)
+PACKBITS_SPECIALIZE(4)
+PACKBITS_SPECIALIZE(5)
+PACKBITS_SPECIALIZE(6)
+PACKBITS_SPECIALIZE(7)
+PACKBITS_SPECIALIZE(8)
+
+static const EncodeScalarFn SCALAR_BY_K[] = {
+    encode_scalar_k2, encode_scalar_k3, encode_scalar_k4, encode_scalar_k5,
+    encode_scalar_k6, encode_scalar_k7, encode_scalar_k8};
+static const EncodeSimdFn SIMD_BY_K[] = {
+    encode_simd_k2, encode_simd_k3, encode_simd_k4, encode_simd_k5,
+    encode_simd_k6, encode_simd_k7, encode_simd_k8};
+
+static size_t encode_scalar_capped(const uint8_t *in, size_t n, uint8_t *out, size_t out_cap,
+                                   int k_min_run)
+{
+    if (k_min_run >= PACKBITS_SPEC_MIN_K && k_min_run <= PACKBITS_SPEC_MAX_K)
+        return SCALAR_BY_K[k_min_run - PACKBITS_SPEC_MIN_K](in, n, out, out_cap);
+    return encode_scalar_impl(in, n, out, out_cap, (k_min_run < 1) ? 1 : (size_t)k_min_run);
+}
+
+size_t packbits_encode_scalar(const uint8_t *in, size_t n, uint8_t *out, int k_min_run)
+{
+    return encode_scalar_capped(in, n, out, SIZE_MAX, k_min_run);
+}
+
+size_t packbits_encode_capped(const uint8_t *in, size_t n, uint8_t *out, size_t out_cap, int k_min_run)
+{
+    pthread_once(&g_kernel_once, packbits_detect_kernel);
+    if (g_kernel && k_min_run >= PACKBITS_SPEC_MIN_K && k_min_run <= PACKBITS_SPEC_MAX_K)
+        return SIMD_BY_K[k_min_run - PACKBITS_SPEC_MIN_K](g_kernel, in, n, out, out_cap);
+    if (g_kernel && k_min_run >= 2 && k_min_run <= PACKBITS_SIMD_MAX_K)
+        return encode_simd_impl(g_kernel, in, n, out, out_cap, k_min_run);
+    return encode_scalar_capped(in, n, out, out_cap, k_min_run);
+}
+
+size_t packbits_encode_threshold(const uint8_t *in, size_t n, uint8_t *out, int k_min_run)
+{
+    return packbits_encode_capped(in, n, out, SIZE_MAX, k_min_run);
+}
+
+/* =======================
+ *  Modo de runs largos
+ *  Mismo parse que PackBits pero sin el límite de 128 bytes por paquete:
+ *  cada paquete empieza con un varint LEB128 v, tipo = v & 1 (1 = run) y
+ *  longitud = (v >> 1) + 1. Un run va seguido de su byte y un literal de
+ *  sus bytes, así que un run de megas (o un bloque entero) es un paquete.
+ * ======================= */
+
+#define PACKBITS_VARINT_MAX 10
+
+static size_t varint_put(uint8_t *out, uint64_t v)
+{
+    size_t o = 0;
+    while (v >= 0x80)
+    {
+        out[o++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    out[o++] = (uint8_t)v;
+    return o;
+}
+
+/* 0 si OK, 1 si el varint está truncado o no cabe en 64 bits */
+static int varint_get(const uint8_t *in, size_t n, size_t *pi, uint64_t *out)
+{
+    uint64_t v = 0;
+    unsigned shift = 0;
+    size_t i = *pi;
+    for (;;)
+    {
+        if (i >= n || shift >= 64)
+            return 1;
+        uint8_t b = in[i++];
+        v |= (uint64_t)(b & 0x7F) << shift;
+        shift += 7;
+        if ((b & 0x80) == 0)
+            break;
+    }
+    *pi = i;
+    *out = v;
+    return 0;
+}
+
+static size_t run_length_scalar(const uint8_t *p, size_t avail)
+{
+    size_t r = 1;
+    while (r < avail && p[r] == p[0])
+        r++;
+    return r;
+}
+
+/* Primer j >= from donde empieza un run >= k, recorriendo tramos; n si no hay */
+static size_t find_run_start_scalar(const uint8_t *in, size_t n, size_t from, size_t k)
+{
+    size_t seq = from;
+    while (seq < n)
+    {
+        size_t len = 1;
+        while (seq + len < n && len < k && in[seq + len] == in[seq])
+            len++;
+        if (len >= k)
+            return seq;
+        seq += len;
+    }
+    return n;
+}
+
+size_t packbits_encode_long(const uint8_t *in, size_t n, uint8_t *out, size_t out_cap, int k_min_run)
+{
+    pthread_once(&g_kernel_once, packbits_detect_kernel);
+    const size_t k = (k_min_run < 1) ? 1 : (size_t)k_min_run;
+    const int simd = (g_kernel && k_min_run >= 2 && k_min_run <= PACKBITS_SIMD_MAX_K);
+    size_t i = 0, o = 0;
+
+    while (i < n)
+    {
+        size_t run = g_kernel ? g_kernel->run_length(in + i, n - i) : run_length_scalar(in + i, n - i);
+        if (run >= k)
+        {
+            if (out_cap - o < PACKBITS_VARINT_MAX + 1)
+                return 0;
+            o += varint_put(out + o, ((uint64_t)(run - 1) << 1) | 1);
+            out[o++] = in[i];
+            i += run;
+            continue;
+        }
+
+        /* LITERAL hasta el siguiente run (sin límite de longitud) */
+        size_t end = simd ? find_run_start(g_kernel, in, n, i + run, n, k_min_run)
+                          : find_run_start_scalar(in, n, i + run, k);
+        size_t lit_len = end - i;
+        if (out_cap - o < PACKBITS_VARINT_MAX + lit_len)
+            return 0;
+        o += varint_put(out + o, (uint64_t)(lit_len - 1) << 1);
+        memcpy(out + o, in + i, lit_len);
+        o += lit_len;
+        i = end;
+    }
+    return o;
+}
+
+int packbits_decode_long(const uint8_t *in, size_t n, uint8_t *out, size_t out_cap, size_t *out_len)
+{
+    size_t i = 0, o = 0;
+    while (i < n)
+    {
+        uint64_t v;
+        if (varint_get(in, n, &i, &v) != 0)
+            return 1;
+
+        uint64_t len = (v >> 1) + 1;
+        if (len > out_cap - o)
+            return 1; /* overflow */
+        if (v & 1)
+        {
+            /* RUN: un solo memset, sea cual sea la longitud */
+            if (i >= n)
+                return 1; /* missing value */
+            memset(out + o, in[i++], (size_t)len);
+        }
+        else
+        {
+            if (len > n - i)
+                return 1; /* truncated */
+            memcpy(out + o, in + i, (size_t)len);
+            i += (size_t)len;
+        }
+        o += (size_t)len;
+    }
+    *out_len = o;
+    return 0;
+}
+
+/* =======================
+ *  Runs periódicos
+ *  Un run de periodo p es un patrón de p bytes repetido: en i empieza un
+ *  run de L bytes si in[i+t] == in[i+t+p] para t en [0, L-p). Con las
+ *  máscaras E_p (bit t = in[j+t] == in[j+t+p]) un run de al menos L bytes
+ *  empieza donde hay L-p unos seguidos, igual que find_run_start con p = 1.
+ *  Los paquetes son los del modo de runs largos; un run lleva detrás su
+ *  patrón de p bytes. Los runs de un solo byte también son periódicos.
+ * ======================= */
+
+static const int PERIODS[] = {2, 3, 4, 8};
+
+static size_t match_length_scalar(const uint8_t *a, const uint8_t *b, size_t avail)
+{
+    size_t r = 0;
+    while (r < avail && a[r] == b[r])
+        r++;
+    return r;
+}
+
+/* Longitud del run periódico que empieza en i (0 si no hay patrón completo) */
+static size_t period_run_length(const uint8_t *in, size_t n, size_t i, size_t p)
+{
+    if (n - i < p)
+        return 0;
+    size_t avail = n - i - p;
+    return p + (g_kernel ? g_kernel->match_length(in + i, in + i + p, avail)
+                         : match_length_scalar(in + i, in + i + p, avail));
+}
+
+/* s con bit t = 1 si e tiene m unos seguidos desde t (AND por duplicación) */
+static inline uint64_t ones_run_mask(uint64_t e, unsigned m)
+{
+    uint64_t s = e;
+    unsigned have = 1;
+    while (have < m)
+    {
+        unsigned sh = (m - have < have) ? m - have : have;
+        s &= s >> sh;
+        have += sh;
+    }
+    return s;
+}
+
+/* Primer j >= from donde empieza un run periódico de al menos min_len
+ * bytes; n si no hay. */
+static size_t find_period_run_start(const uint8_t *in, size_t n, size_t from, size_t p, size_t min_len)
+{
+    const size_t m = min_len - p; /* comparaciones iguales seguidas */
+    size_t j = from;
+
+    if (g_kernel && m <= 32)
+    {
+        const unsigned span = 64 - (unsigned)(m - 1);
+        const uint64_t valid = (span < 64) ? (((uint64_t)1 << span) - 1) : ~(uint64_t)0;
+        while (j + 64 + p <= n)
+        {
+            uint64_t s = ones_run_mask(g_kernel->eq_mask64_at(in + j, p), (unsigned)m) & valid;
+            if (s)
+                return j + ctz64(s);
+            j += span;
+        }
+    }
+
+    /* escalar: contar comparaciones iguales seguidas */
+    size_t cnt = 0;
+    for (size_t t = j; t + p < n; t++)
+    {
+        cnt = (in[t] == in[t + p]) ? cnt + 1 : 0;
+        if (cnt >= m)
+            return t + 1 - m;
+    }
+    return n;
+}
+
+/* Posiciones con in[t] == in[t+d] en una muestra del bloque: una ventana
+ * de 64 bytes de cada PERIOD_SAMPLE_STRIDE. Devuelve también el tamaño de
+ * la muestra. */
+#define PERIOD_SAMPLE_STRIDE 256
+
+static size_t count_matches_sampled(const uint8_t *in, size_t n, size_t d, size_t *sampled)
+{
+    size_t c = 0, total = 0;
+    for (size_t j = 0; j + 64 + d <= n; j += PERIOD_SAMPLE_STRIDE)
+    {
+        if (g_kernel)
+        {
+            c += (size_t)__builtin_popcountll(g_kernel->eq_mask64_at(in + j, d));
+        }
+        else
+        {
+            for (size_t t = j; t < j + 64; t++)
+                c += (in[t] == in[t + d]);
+        }
+        total += 64;
+    }
+    *sampled = total;
+    return c;
+}
+
+int packbits_best_period(const uint8_t *in, size_t n)
+{
+    pthread_once(&g_kernel_once, packbits_detect_kernel);
+
+    /* El periodo 1 (runs de un byte) ya lo cubre PackBits y un run de un
+     * byte coincide con cualquier desplazamiento: solo se prueba un periodo
+     * mayor si repite claramente más (+1/32 de la muestra) y cubre al
+     * menos 1/8 del bloque */
+    size_t sampled;
+    size_t base = count_matches_sampled(in, n, 1, &sampled);
+    int best = 0;
+    size_t best_count = base + sampled / 32;
+    for (size_t t = 0; t < sizeof(PERIODS) / sizeof(PERIODS[0]); t++)
+    {
+        size_t ns;
+        size_t c = count_matches_sampled(in, n, (size_t)PERIODS[t], &ns);
+        if (c > best_count)
+        {
+            best = PERIODS[t];
+            best_count = c;
+        }
+    }
+    return (sampled > 0 && best_count >= sampled / 8) ? best : 0;
+}
+
+size_t packbits_encode_period(const uint8_t *in, size_t n, uint8_t *out, size_t out_cap,
+                              int period, int k_min_run)
+{
+    pthread_once(&g_kernel_once, packbits_detect_kernel);
+    const size_t p = (size_t)period;
+    /* al menos k repeticiones (mínimo 2) del patrón */
+    const size_t min_len = p * (size_t)((k_min_run < 2) ? 2 : k_min_run);
+    size_t i = 0, o = 0;
+
+    while (i < n)
+    {
+        size_t run = period_run_length(in, n, i, p);
+        if (run >= min_len)
+        {
+            if (out_cap - o < PACKBITS_VARINT_MAX + p)
+                return 0;
+            o += varint_put(out + o, ((uint64_t)(run - 1) << 1) | 1);
+            memcpy(out + o, in + i, p);
+            o += p;
+            i += run;
+            continue;
+        }
+
+        size_t end = find_period_run_start(in, n, i + 1, p, min_len);
+        size_t lit_len = end - i;
+        if (out_cap - o < PACKBITS_VARINT_MAX + lit_len)
+            return 0;
+        o += varint_put(out + o, (uint64_t)(lit_len - 1) << 1);
+        memcpy(out + o, in + i, lit_len);
+        o += lit_len;
+        i = end;
+    }
+    return o;
+}
+
+int packbits_decode_period(const uint8_t *in, size_t n, int period, uint8_t *out, size_t out_cap,
+                           size_t *out_len)
+{
+    const size_t p = (size_t)period;
+    size_t i = 0, o = 0;
+    if (period < 1)
+        return 1;
+
+    while (i < n)
+    {
+        uint64_t v;
+        if (varint_get(in, n, &i, &v) != 0)
+            return 1;
+
+        uint64_t len = (v >> 1) + 1;
+        if (len > out_cap - o)
+            return 1; /* overflow */
+        if (v & 1)
+        {
+            /* RUN: patrón y luego duplicar lo ya escrito (log2(len/p) memcpy) */
+            if (p > n - i || len < p)
+                return 1;
+            uint8_t *dst = out + o;
+            memcpy(dst, in + i, p);
+            i += p;
+            size_t done = p;
+            while (done < len)
+            {
+                size_t chunk = (done < len - done) ? done : (size_t)len - done;
+                memcpy(dst + done, dst, chunk);
+                done += chunk;
+            }
+        }
+        else
+        {
+            if (len > n - i)
+                return 1; /* truncated */
+            memcpy(out + o, in + i, (size_t)len);
+            i += (size_t)len;
+        }
+        o += (size_t)len;
+    }
+    *out_len = o;
+    return 0;
+}
+
+/* =======================
+ *  Parse óptimo
+ *  best[i] = bytes mínimos para codificar in[0, i) con el último paquete
+ *  cerrado. Es no decreciente en i, así que el mejor RUN que termina en i
+ *  es el más largo posible (hasta 128 bytes). Para los literales basta un
+ *  estado abierto por posición, el de menor coste y, a igual coste, menor
+ *  longitud: uno más caro nunca gana, porque cerrar el paquete y abrir
+ *  otro cuesta solo 1 byte. El tamaño final es best[n] y la salida se
+ *  reconstruye de atrás hacia delante.
+ * ======================= */
+
+#define PACKBITS_MAX_PACKET 128
+
+typedef struct
+{
+    uint32_t *best;
+    uint32_t *lit_cost;
+    uint8_t *lit_len;   /* paquete literal abierto en i */
+    uint8_t *lit_fresh; /* su paquete empezó desde best[i-1] */
+    uint8_t *run_len;   /* best[i] viene de un RUN de esta longitud (0 = literal) */
+} OptimalParse;
+
+static size_t optimal_parse(const uint8_t *in, size_t n, uint8_t *out, size_t out_cap,
+                            const OptimalParse *p)
+{
+    uint32_t *best = p->best, *lit_cost = p->lit_cost;
+    uint8_t *lit_len = p->lit_len, *lit_fresh = p->lit_fresh, *run_len = p->run_len;
+
+    best[0] = 0;
+    lit_len[0] = 0;
+    size_t run = 0;
+    for (size_t i = 1; i <= n; i++)
+    {
+        /* literal in[i-1]: paquete nuevo, o seguir / partir el abierto */
+        uint32_t c = best[i - 1] + 2;
+        unsigned len = 1, fresh = 1;
+        if (lit_len[i - 1] != 0)
+        {
+            if (lit_len[i - 1] < PACKBITS_MAX_PACKET && lit_cost[i - 1] + 1 < c)
+            {
+                c = lit_cost[i - 1] + 1;
+                len = lit_len[i - 1] + 1u;
+                fresh = 0;
+            }
+            else if (lit_len[i - 1] == PACKBITS_MAX_PACKET && lit_cost[i - 1] + 2 < c)
+            {
+                c = lit_cost[i - 1] + 2;
+                fresh = 0;
+            }
+        }
+        lit_cost[i] = c;
+        lit_len[i] = (uint8_t)len;
+        lit_fresh[i] = (uint8_t)fresh;
+
+        /* RUN terminado en i, el más largo posible */
+        run = (i >= 2 && in[i - 1] == in[i - 2]) ? run + 1 : 1;
+        size_t l = run < PACKBITS_MAX_PACKET ? run : PACKBITS_MAX_PACKET;
+        if (best[i - l] + 2 < c)
+        {
+            best[i] = best[i - l] + 2;
+            run_len[i] = (uint8_t)l;
+        }
+        else
+        {
+            best[i] = c;
+            run_len[i] = 0;
+        }
+    }
+
+    size_t size = best[n], o = size, i = n;
+    if (size > out_cap)
+        return 0;
+    int in_lit = 0;
+    while (i > 0)
+    {
+        if (!in_lit && run_len[i] != 0)
+        {
+            size_t l = run_len[i];
+            o -= 2;
+            out[o] = (uint8_t)(0x80 | (l - 1));
+            out[o + 1] = in[i - 1];
+            i -= l;
+            continue;
+        }
+        size_t l = lit_len[i], start = i - l;
+        o -= 1 + l;
+        out[o] = (uint8_t)(l - 1);
+        memcpy(out + o + 1, in + start, l);
+        in_lit = !lit_fresh[start + 1];
+        i = start;
+    }
+    return size;
+}
+
+size_t packbits_encode_optimal(const uint8_t *in, size_t n, uint8_t *out, size_t out_cap)
+{
+    if (n == 0)
+        return 0;
+
+    OptimalParse p;
+    p.best = (uint32_t *)malloc(sizeof(uint32_t) * (n + 1));
+    p.lit_cost = (uint32_t *)malloc(sizeof(uint32_t) * (n + 1));
+    p.lit_len = (uint8_t *)malloc(n + 1);
+    p.lit_fresh = (uint8_t *)malloc(n + 1);
+    p.run_len = (uint8_t *)malloc(n + 1);
+
+    size_t size = 0;
+    if (p.best && p.lit_cost && p.lit_len && p.lit_fresh && p.run_len)
+        size = optimal_parse(in, n, out, out_cap, &p);
+
+    free(p.best);
+    free(p.lit_cost);
+    free(p.lit_len);
+    free(p.lit_fresh);
+    free(p.run_len);
+    return size;
+}
+
+/* =======================
+ *  Decoder
+ *  El camino rápido del kernel no comprueba nada por paquete: los márgenes
+ *  de su bucle garantizan que cualquier paquete (y su sobre-copia) cabe.
+ *  La cola (último paquete de entrada / últimos 128 bytes de salida) pasa
+ *  por el bucle exacto, que valida cada paquete contra out_cap.
+ * ======================= */
+
+/* Camino rápido portable: copias de 16 bytes con memcpy de tamaño fijo */
+static size_t decode_fast_generic(const uint8_t *in, size_t n, size_t *pi, uint8_t *out, size_t out_cap)
+{
+    size_t i = *pi, o = 0;
+    while (i + PACKBITS_DECODE_IN_MARGIN <= n && o + PACKBITS_DECODE_OUT_MARGIN <= out_cap)
+    {
+        uint8_t ctrl = in[i];
+        size_t len = (size_t)(ctrl & 0x7F) + 1;
+        uint8_t *dst = out + o;
+        if ((ctrl & 0x80) == 0)
+        {
+            const uint8_t *src = in + i + 1;
+            size_t c = 0;
+            do
+            {
+                memcpy(dst + c, src + c, 16);
+                c += 16;
+            } while (c < len);
+            i += 1 + len;
+        }
+        else
+        {
+            uint64_t v = (uint64_t)in[i + 1] * 0x0101010101010101ULL;
+            size_t c = 0;
+            do
+            {
+                memcpy(dst + c, &v, 8);
+                memcpy(dst + c + 8, &v, 8);
+                c += 16;
+            } while (c < len);
+            i += 2;
+        }
+        o += len;
+    }
+    *pi = i;
+    return o;
+}
+
+/* Bucle exacto a partir de (i, o); comprueba cada paquete. */
+static int decode_checked(const uint8_t *in, size_t n, size_t i, uint8_t *out, size_t out_cap,
+                          size_t o, size_t *out_len)
+{
+    while (i < n)
+    {
+        uint8_t ctrl = in[i++];
+        if ((ctrl & 0x80) == 0)
+        {
+            /* LITERAL: len = ctrl+1 */
+            size_t len = (size_t)ctrl + 1;
+            if (i + len > n || len > out_cap - o)
+                return 1; /* truncated / overflow */
+            memcpy(out + o, in + i, len);
+            o += len;
+            i += len;
+        }
+        else
+        {
+            /* RUN: len = (ctrl&0x7F)+1, then one value */
+            size_t len = (size_t)(ctrl & 0x7F) + 1;
+            if (i >= n || len > out_cap - o)
+                return 1; /* missing value / overflow */
+            uint8_t val = in[i++];
+            memset(out + o, val, len);
+            o += len;
+        }
+    }
+    *out_len = o;
+    return 0;
+}
+
+int packbits_decode_simple(const uint8_t *in, size_t n, uint8_t *out, size_t out_cap, size_t *out_len)
+{
+    return decode_checked(in, n, 0, out, out_cap, 0, out_len);
+}
+
+int packbits_decode(const uint8_t *in, size_t n, uint8_t *out, size_t out_cap, size_t *out_len)
+{
+    pthread_once(&g_kernel_once, packbits_detect_kernel);
+    size_t i = 0;
+    size_t o = g_kernel ? g_kernel->decode_fast(in, n, &i, out, out_cap)
+                        : decode_fast_generic(in, n, &i, out, out_cap);
+    return decode_checked(in, n, i, out, out_cap, o, out_len);
+}
@@ -0,0 +1,168 @@
+#include "shuffle.h"
+
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define SHUFFLE_SSE2 1
+#endif
+
+/* =======================
+ *  Detección del tamaño de elemento
+ *  Para 2, 4 y 8 bytes se mira en una muestra qué fracción de "carriles"
+ *  (byte k de cada elemento) repite casi siempre el valor del elemento
+ *  anterior: exponentes de float, bytes altos de enteros pequeños. Gana
+ *  el tamaño con más fracción de carriles planos (a igualdad, el menor),
+ *  y al menos 1/4 de los carriles tiene que serlo.
+ * ======================= */
+
+#define SHUFFLE_SAMPLE 4096
+
+size_t shuffle_detect(const uint8_t *in, size_t n)
+{
+    size_t len = (n < SHUFFLE_SAMPLE) ? n : SHUFFLE_SAMPLE;
+    size_t best = 0;
+    unsigned best_flat = 0, best_lanes = 1;
+
+    for (size_t elem = 2; elem <= 8; elem *= 2)
+    {
+        size_t count = len / elem;
+        if (count < 64)
+            break;
+        unsigned same[8] = {0};
+        for (size_t i = 1; i < count; i++)
+        {
+            const uint8_t *e = in + i * elem;
+            for (size_t k = 0; k < elem; k++)
+                same[k] += (e[k] == e[k - elem]);
+        }
+
+        /* carril plano: repite el byte en 3/4 de los elementos */
+        unsigned flat = 0;
+        for (size_t k = 0; k < elem; k++)
+            flat += (same[k] >= (count - 1) - (count - 1) / 4);
+        if (flat * best_lanes > best_flat * (unsigned)elem)
+        {
+            best = elem;
+            best_flat = flat;
+            best_lanes = (unsigned)elem;
+        }
+    }
+    if (best == 0 || best_flat * 4 < best_lanes)
+        return 0;
+    return best;
+}
+
+/* =======================
+ *  Transposición
+ *  Con SSE2 y elem = 2, 4 u 8 se toman 16 elementos por iteración
+ *  (elem vectores) y se separan en bytes pares e impares log2(elem)
+ *  veces; cada separación es una máscara + packus. Tras la última, el
+ *  vector p tiene el byte p de los 16 elementos. El inverso aplica
+ *  otras tantas veces unpacklo/unpackhi. El resto de tamaños, y la cola
+ *  de menos de 16 elementos, van en escalar.
+ * ======================= */
+
+#ifdef SHUFFLE_SSE2
+/* v[j], v[elem/2 + j] <- bytes pares / impares de v[2j], v[2j+1] */
+static inline void split_round(__m128i *v, size_t elem)
+{
+    const __m128i low = _mm_set1_epi16(0x00FF);
+    __m128i t[8];
+    size_t half = elem / 2;
+    for (size_t j = 0; j < half; j++)
+    {
+        __m128i a = v[2 * j], b = v[2 * j + 1];
+        t[j] = _mm_packus_epi16(_mm_and_si128(a, low), _mm_and_si128(b, low));
+        t[half + j] = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+    }
+    memcpy(v, t, elem * sizeof(__m128i));
+}
+
+/* inverso de split_round */
+static inline void merge_round(__m128i *v, size_t elem)
+{
+    __m128i t[8];
+    size_t half = elem / 2;
+    for (size_t j = 0; j < half; j++)
+    {
+        t[2 * j] = _mm_unpacklo_epi8(v[j], v[half + j]);
+        t[2 * j + 1] = _mm_unpackhi_epi8(v[j], v[half + j]);
+    }
+    memcpy(v, t, elem * sizeof(__m128i));
+}
+
+static size_t shuffle_sse2(const uint8_t *in, size_t count, size_t elem, uint8_t *out)
+{
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i v[8];
+        for (size_t j = 0; j < elem; j++)
+            v[j] = _mm_loadu_si128((const __m128i *)(in + i * elem + j * 16));
+        for (size_t r = 2; r <= elem; r *= 2)
+            split_round(v, elem);
+        for (size_t p = 0; p < elem; p++)
+            _mm_storeu_si128((__m128i *)(out + p * count + i), v[p]);
+    }
+    return i;
+}
+
+static size_t unshuffle_sse2(const uint8_t *in, size_t count, size_t elem, uint8_t *out)
+{
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i v[8];
+        for (size_t p = 0; p < elem; p++)
+            v[p] = _mm_loadu_si128((const __m128i *)(in + p * count + i));
+        for (size_t r = 2; r <= elem; r *= 2)
+            merge_round(v, elem);
+        for (size_t j = 0; j < elem; j++)
+            _mm_storeu_si128((__m128i *)(out + i * elem + j * 16), v[j]);
+    }
+    return i;
+}
+#endif /* SHUFFLE_SSE2 */
+
+void shuffle_encode(const uint8_t *in, size_t n, size_t elem, uint8_t *out)
+{
+    if (elem < 2)
+    {
+        memcpy(out, in, n);
+        return;
+    }
+    size_t count = n / elem;
+    size_t i = 0;
+#ifdef SHUFFLE_SSE2
+    if (elem == 2 || elem == 4 || elem == 8)
+        i = shuffle_sse2(in, count, elem, out);
+#endif
+    for (; i < count; i++)
+    {
+        for (size_t p = 0; p < elem; p++)
+            out[p * count + i] = in[i * elem + p];
+    }
+    memcpy(out + count * elem, in + count * elem, n - count * elem);
+}
+
+void shuffle_decode(const uint8_t *in, size_t n, size_t elem, uint8_t *out)
+{
+    if (elem < 2)
+    {
+        memcpy(out, in, n);
+        return;
+    }
+    size_t count = n / elem;
+    size_t i = 0;
+#ifdef SHUFFLE_SSE2
+    if (elem == 2 || elem == 4 || elem == 8)
+        i = unshuffle_sse2(in, count, elem, out);
+#endif
+    for (; i < count; i++)
+    {
+        for (size_t p = 0; p < elem; p++)
+            out[i * elem + p] = in[p * count + i];
+    }
+    memcpy(out + count * elem, in + count * elem, n - count * elem);
+}